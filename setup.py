@@ -4,13 +4,23 @@ native_module = Extension(
 		name='fastset',
 		sources = [
 			"src/bitvec.c",
+			"src/closure.c",
+			"src/container.c",
 			"src/domain.c",
+			"src/expr.c",
 			"src/extension.c",
+			"src/matrix.c",
 			"src/member.c",
+			"src/pool.c",
+			"src/relation.c",
 			"src/set.c",
+			"src/setarray.c",
+			"src/setindex.c",
+			"src/simd.c",
 			"src/transform.c",
 		],
-		extra_compile_args = ["-Wall", "-D_GNU_SOURCE", "-mavx2"],
+		extra_compile_args = ["-Wall", "-D_GNU_SOURCE", "-pthread"],
+		extra_link_args = ["-pthread"],
 	      )
 kwargs = {
       'name' : 'src',
@@ -18,30 +18,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include "fastsets.h"
 
 static const unsigned int	FASTVEC_WORD_SIZE = 8 * sizeof(((fastset_bitvec_t *) 0)->words[0]);
 
-static const unsigned int	bits_per_octet[256] = {
-	0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
-	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-	4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8,
-};
-
 static inline unsigned int
 fastset_bitvec_bits_to_size(unsigned int size)
 {
@@ -67,6 +49,12 @@ MIN(unsigned int a, unsigned int b)
 	return (a < b)? a : b;
 }
 
+static inline void
+fastset_bitvec_invalidate_count(fastset_bitvec_t *vec)
+{
+	vec->cardinality = -1;
+}
+
 static inline void
 fastset_bitvec_swap(fastset_bitvec_t **p1, fastset_bitvec_t **p2)
 {
@@ -96,21 +84,100 @@ fastset_bitvec_bit_to_index(const fastset_bitvec_t *vec, unsigned int i, unsigne
 
 fastset_bitvec_t *
 fastset_bitvec_new(unsigned int initial_size)
+{
+	return fastset_bitvec_new_pooled(NULL, initial_size);
+}
+
+fastset_bitvec_t *
+fastset_bitvec_new_pooled(fastset_bitvec_pool_t *pool, unsigned int initial_size)
 {
 	fastset_bitvec_t *vec;
 
-	vec = calloc(1, sizeof(*vec));
+	vec = fastset_bitvec_pool_get_header(pool);
+	vec->pool = pool;
+	vec->cardinality = 0;
 	if (initial_size)
 		fastset_bitvec_resize(vec, initial_size);
 	vec->refcount = 1;
 	return vec;
 }
 
+/*
+ * Initialize a bitvec that is embedded in another object, using the
+ * given storage for up to ninline words.
+ */
+void
+fastset_bitvec_init_inline(fastset_bitvec_t *vec, fastset_bitvec_pool_t *pool, fastset_bitvec_word_t *words, unsigned int ninline)
+{
+	memset(vec, 0, sizeof(*vec));
+	vec->pool = pool;
+	vec->inline_words = words;
+	vec->ninline = ninline;
+	vec->words = words;
+	vec->nalloc = ninline;
+	vec->refcount = 1;
+}
+
+/*
+ * Drop all bits and storage, returning to the empty dense representation
+ */
 static void
-fastset_bitvec_free(fastset_bitvec_t *vec)
+fastset_bitvec_reset(fastset_bitvec_t *vec)
 {
+	if (vec->compressed)
+		fastset_bitvec_chunked_destroy(vec);
 	fastset_bitvec_resize(vec, 0);
-	free(vec);
+}
+
+static void
+fastset_bitvec_free(fastset_bitvec_t *vec)
+{
+	fastset_bitvec_reset(vec);
+	if (!fastset_bitvec_is_embedded(vec))
+		fastset_bitvec_pool_put_header(vec->pool, vec);
+}
+
+/*
+ * Release the word array, reverting to inline storage if the
+ * vector has any.
+ */
+void
+fastset_bitvec_free_words(fastset_bitvec_t *vec)
+{
+	if (vec->words != vec->inline_words)
+		fastset_bitvec_pool_put_words(vec->pool, vec->words, vec->nalloc);
+	vec->words = vec->inline_words;
+	vec->nalloc = vec->ninline;
+	vec->nwords = 0;
+}
+
+/*
+ * Move the contents of an embedded bitvec to a heap allocated one that
+ * can be shared, leaving the embedded vector empty. Vectors that live
+ * in inline storage are copied, everything else changes owner.
+ */
+fastset_bitvec_t *
+fastset_bitvec_detach(fastset_bitvec_t *vec)
+{
+	fastset_bitvec_t *res;
+
+	if (!fastset_bitvec_is_embedded(vec))
+		return vec;
+
+	if (fastset_bitvec_is_inline(vec)) {
+		res = fastset_bitvec_copy(vec);
+		fastset_bitvec_reset(vec);
+		return res;
+	}
+
+	res = fastset_bitvec_new_pooled(vec->pool, 0);
+	*res = *vec;
+	res->inline_words = NULL;
+	res->ninline = 0;
+	res->refcount = 1;
+
+	fastset_bitvec_init_inline(vec, vec->pool, vec->inline_words, vec->ninline);
+	return res;
 }
 
 fastset_bitvec_t *
@@ -118,12 +185,32 @@ fastset_bitvec_hold(fastset_bitvec_t *vec)
 {
 	if (vec != NULL) {
 		assert(vec->refcount);
+		assert(!fastset_bitvec_is_embedded(vec));
 		vec->refcount ++;
 	}
 
 	return vec;
 }
 
+/*
+ * Copy-on-write support: return a vector that the caller may modify.
+ * If the vector is shared, this drops the caller's reference and
+ * returns a private copy.
+ */
+fastset_bitvec_t *
+fastset_bitvec_unshare(fastset_bitvec_t *vec)
+{
+	fastset_bitvec_t *copy;
+
+	assert(vec->refcount);
+	if (vec->refcount == 1)
+		return vec;
+
+	copy = fastset_bitvec_copy(vec);
+	fastset_bitvec_release(vec);
+	return copy;
+}
+
 void
 fastset_bitvec_release(fastset_bitvec_t *vec)
 {
@@ -132,6 +219,79 @@ fastset_bitvec_release(fastset_bitvec_t *vec)
 		fastset_bitvec_free(vec);
 }
 
+/*
+ * Change the size of the word array to nalloc words, which must hold
+ * the current contents. Uses the inline storage whenever it is large
+ * enough.
+ */
+static void
+fastset_bitvec_set_capacity(fastset_bitvec_t *vec, unsigned int nalloc)
+{
+	fastset_bitvec_word_t *words;
+
+	assert(nalloc >= vec->nwords);
+
+	if (nalloc <= vec->ninline) {
+		words = vec->inline_words;
+		nalloc = vec->ninline;
+	} else {
+		words = fastset_bitvec_pool_get_words(vec->pool, nalloc);
+	}
+
+	if (words != vec->words) {
+		if (vec->nwords)
+			memcpy(words, vec->words, vec->nwords * sizeof(words[0]));
+		if (vec->words != vec->inline_words)
+			fastset_bitvec_pool_put_words(vec->pool, vec->words, vec->nalloc);
+		vec->words = words;
+	}
+	vec->nalloc = nalloc;
+}
+
+/*
+ * Make room for max_index bits without changing the size of the vector
+ */
+void
+fastset_bitvec_reserve(fastset_bitvec_t *vec, unsigned int max_index)
+{
+	unsigned int nwords = fastset_bitvec_bits_to_size(max_index);
+
+	if (vec->compressed || nwords <= vec->nalloc)
+		return;
+
+	fastset_bitvec_set_capacity(vec, nwords);
+}
+
+/*
+ * Trim the vector to its highest bit, and release unused memory
+ */
+void
+fastset_bitvec_shrink_to_fit(fastset_bitvec_t *vec)
+{
+	unsigned int nwords = vec->nwords;
+	int cardinality = vec->cardinality;
+
+	if (vec->compressed) {
+		fastset_bitvec_chunked_shrink(vec);
+		return;
+	}
+
+	while (nwords && vec->words[nwords - 1] == 0)
+		nwords--;
+
+	if (nwords == 0) {
+		fastset_bitvec_resize(vec, 0);
+		return;
+	}
+
+	/* This does not change any bits, so the count stays valid */
+	fastset_bitvec_resize(vec, (nwords - 1) * FASTVEC_WORD_SIZE + 64 - __builtin_clzll(vec->words[nwords - 1]));
+	vec->cardinality = cardinality;
+
+	if (vec->nalloc > vec->nwords)
+		fastset_bitvec_set_capacity(vec, vec->nwords);
+}
+
 void
 fastset_bitvec_resize(fastset_bitvec_t *vec, unsigned int max_index)
 {
@@ -141,12 +301,15 @@ fastset_bitvec_resize(fastset_bitvec_t *vec, unsigned int max_index)
 	if (max_index == vec->max_index)
 		return;
 
+	if (vec->compressed) {
+		fastset_bitvec_chunked_resize(vec, max_index);
+		return;
+	}
+
 	if (max_index == 0) {
-		if (vec->words) {
-			free(vec->words);
-			vec->words = NULL;
-		}
-		vec->nalloc = vec->nwords = vec->max_index = 0;
+		fastset_bitvec_free_words(vec);
+		vec->max_index = 0;
+		vec->cardinality = 0;
 		return;
 	} else
 	if (max_index <= vec->max_index) {
@@ -156,13 +319,14 @@ fastset_bitvec_resize(fastset_bitvec_t *vec, unsigned int max_index)
 		 * subsequent words - but we need to do that whenever
 		 * someone decides to grow the vector again.
 		 */
+		fastset_bitvec_invalidate_count(vec);
 	} else {
 		unsigned int new_nwords = fastset_bitvec_bits_to_size(max_index);
 
-		if (new_nwords > vec->nalloc) {
-			vec->words = realloc(vec->words, new_nwords * sizeof(vec->words[0]));
-			vec->nalloc = new_nwords;
-		}
+		/* Grow geometrically, so that setting bits in ascending
+		 * order does not reallocate for every word */
+		if (new_nwords > vec->nalloc)
+			fastset_bitvec_set_capacity(vec, MAX(new_nwords, 2 * vec->nalloc));
 		while (vec->nwords < new_nwords)
 			vec->words[vec->nwords++] = 0;
 	}
@@ -191,13 +355,25 @@ fastset_bitvec_set(fastset_bitvec_t *vec, unsigned int i)
 	fastset_bitvec_word_t mask;
 	bool rv;
 
-	if (i >= vec->max_index)
+	if (i >= vec->max_index) {
+		/* Growing a sparse vector into a large domain - switch to
+		 * the compressed representation before allocating words */
+		if (!vec->compressed && vec->cardinality >= 0
+		 && fastset_bitvec_want_compressed(i + 1, vec->cardinality + 1, false))
+			fastset_bitvec_compress(vec);
+
 		fastset_bitvec_resize(vec, i + 1);
+	}
+
+	if (vec->compressed)
+		return fastset_bitvec_chunked_set(vec, i);
 
 	fastset_bitvec_bit_to_index_unchecked(vec, i, &word_index, &mask);
 	rv = !!(vec->words[word_index] & mask);
 //	printf("%s: index %u -> word %u mask 0x%Lx\n", __func__, i, word_index, (unsigned long long) mask);
 	vec->words[word_index] |= mask;
+	if (!rv && vec->cardinality >= 0)
+		vec->cardinality++;
 	return rv;
 }
 
@@ -211,9 +387,14 @@ fastset_bitvec_clear(fastset_bitvec_t *vec, unsigned int i)
 	if (i >= vec->max_index)
 		return false;
 
+	if (vec->compressed)
+		return fastset_bitvec_chunked_clear(vec, i);
+
 	fastset_bitvec_bit_to_index(vec, i, &word_index, &mask);
 	rv = !!(vec->words[word_index] & mask);
 	vec->words[word_index] &= ~mask;
+	if (rv && vec->cardinality > 0)
+		vec->cardinality--;
 	return rv;
 }
 
@@ -226,6 +407,9 @@ fastset_bitvec_test(const fastset_bitvec_t *vec, unsigned int i)
 	if (i >= vec->max_index)
 		return false;
 
+	if (vec->compressed)
+		return fastset_bitvec_chunked_test(vec, i);
+
 	fastset_bitvec_bit_to_index(vec, i, &word_index, &mask);
 	return !!(vec->words[word_index] & mask);
 }
@@ -233,18 +417,11 @@ fastset_bitvec_test(const fastset_bitvec_t *vec, unsigned int i)
 static inline int
 __find_next_bit_in_word(unsigned int word_index, fastset_bitvec_word_t word)
 {
-	unsigned int bit_index;
-
 //	printf("%s: word_index=%u word=0x%llx\n", __func__, word_index, (unsigned long long) word);
 	if (!word)
 		return -1;
 
-	bit_index = word_index * FASTVEC_WORD_SIZE;
-	while (!(word & 1)) {
-		bit_index += 1;
-		word >>= 1;
-	}
-	return bit_index;
+	return word_index * FASTVEC_WORD_SIZE + __builtin_ctzll(word);
 }
 
 int
@@ -256,6 +433,9 @@ fastset_bitvec_find_next_bit(const fastset_bitvec_t *vec, unsigned int from_inde
 	if (from_index >= vec->max_index)
 		return -1;
 
+	if (vec->compressed)
+		return fastset_bitvec_chunked_find_next_bit(vec, from_index);
+
 	fastset_bitvec_bit_to_index(vec, from_index, &word_index, &mask);
 
 	mask = ~(mask - 1);
@@ -272,48 +452,130 @@ fastset_bitvec_find_next_bit(const fastset_bitvec_t *vec, unsigned int from_inde
 	return -1;
 }
 
+/*
+ * Decode the indexes of all bits set in words[], starting at bit
+ * from_index, into out[]. base is added to each index. At most max
+ * indexes are stored; the return value is the number stored. Callers
+ * that run out of room resume at the last index + 1.
+ */
 unsigned int
-fastset_bitvec_count_ones(const fastset_bitvec_t *vec)
+fastset_bitvec_words_extract(const fastset_bitvec_word_t *words, unsigned int nwords, unsigned int from_index,
+			uint32_t base, uint32_t *out, unsigned int max)
 {
-	unsigned int result = 0;
-	unsigned int word_index;
-	fastset_bitvec_word_t mask, word;
-
-	if (vec->max_index == 0)
-		return 0;
+	unsigned int word_index = from_index / FASTVEC_WORD_SIZE;
+	fastset_bitvec_word_t word;
+	unsigned int n = 0;
 
-	if (!fastset_bitvec_bit_to_index(vec, vec->max_index - 1, &word_index, &mask))
+	if (word_index >= nwords)
 		return 0;
 
-	mask = (mask - 1) | mask;
-
-//	printf("word %u = 0x%Lx mask 0x%Lx\n", word_index, (unsigned long long) vec->words[word_index],  (unsigned long long) mask);
-	word = vec->words[word_index] & mask;
-	while (1) {
-		while (word) {
-			result += bits_per_octet[word & 0xFF];
-			result += bits_per_octet[(word >> 8) & 0xFF];
-			result += bits_per_octet[(word >> 16) & 0xFF];
-			result += bits_per_octet[(word >> 24) & 0xFF];
-			word >>= 32;
+	word = words[word_index] & (~(fastset_bitvec_word_t) 0 << (from_index % FASTVEC_WORD_SIZE));
+	while (true) {
+		uint32_t word_base = base + word_index * FASTVEC_WORD_SIZE;
+
+		if (max - n >= FASTVEC_WORD_SIZE) {
+			/* Room for the whole word; no need to check for overflow */
+			while (word) {
+				out[n++] = word_base + __builtin_ctzll(word);
+				word &= word - 1;
+			}
+		} else {
+			while (word) {
+				if (n == max)
+					return n;
+				out[n++] = word_base + __builtin_ctzll(word);
+				word &= word - 1;
+			}
 		}
 
-		if (word_index == 0)
+		if (++word_index >= nwords)
 			break;
-		word = vec->words[--word_index];
+		word = words[word_index];
 	}
 
+	return n;
+}
+
+unsigned int
+fastset_bitvec_extract(const fastset_bitvec_t *vec, unsigned int from_index, uint32_t *out, unsigned int max)
+{
+	if (from_index >= vec->max_index || max == 0)
+		return 0;
+
+	if (vec->compressed)
+		return fastset_bitvec_chunked_extract(vec, from_index, out, max);
+
+	return fastset_bitvec_words_extract(vec->words, vec->nwords, from_index, 0, out, max);
+}
+
+unsigned int
+fastset_bitvec_count_ones(const fastset_bitvec_t *vec)
+{
+	unsigned int result;
+
+	if (vec->cardinality >= 0)
+		return vec->cardinality;
+
+	/* Bits beyond max_index are always clear, so we can just count
+	 * all words. */
+	result = fastset_bitvec_kernels->popcount(vec->words, vec->nwords);
+
+	/* The cached count is not part of the value of the vector */
+	((fastset_bitvec_t *) vec)->cardinality = result;
 	return result;
 }
 
+/*
+ * Fused operate-and-count functions. These compute the cardinality of
+ * the result of a set operation without materializing the result.
+ */
+unsigned int
+fastset_bitvec_intersection_count(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
+{
+	unsigned int nwords = MIN(arg1->nwords, arg2->nwords);
+
+	if (arg1->compressed || arg2->compressed)
+		return fastset_bitvec_chunked_intersection_count(arg1, arg2);
+
+	return fastset_bitvec_kernels->popcount_and(arg1->words, arg2->words, nwords);
+}
+
+unsigned int
+fastset_bitvec_union_count(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
+{
+	const fastset_bitvec_t *longer = arg1, *shorter = arg2;
+
+	if ((arg1->cardinality >= 0 && arg2->cardinality >= 0) || arg1->compressed || arg2->compressed)
+		return fastset_bitvec_count_ones(arg1) + fastset_bitvec_count_ones(arg2)
+			- fastset_bitvec_intersection_count(arg1, arg2);
+
+	if (arg1->nwords < arg2->nwords) {
+		longer = arg2;
+		shorter = arg1;
+	}
+
+	return fastset_bitvec_kernels->popcount_or(longer->words, shorter->words, shorter->nwords)
+		+ fastset_bitvec_kernels->popcount(longer->words + shorter->nwords, longer->nwords - shorter->nwords);
+}
+
+unsigned int
+fastset_bitvec_difference_count(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
+{
+	unsigned int nwords;
+
+	if (arg1->cardinality >= 0 || arg2->compressed)
+		return fastset_bitvec_count_ones(arg1) - fastset_bitvec_intersection_count(arg1, arg2);
+
+	nwords = MIN(arg1->nwords, arg2->nwords);
+	return fastset_bitvec_kernels->popcount_andnot(arg1->words, arg2->words, nwords)
+		+ fastset_bitvec_kernels->popcount(arg1->words + nwords, arg1->nwords - nwords);
+}
+
 static inline void
 __fastset_bitvec_union(fastset_bitvec_t *res, const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2, unsigned int nwords)
 {
-	unsigned int n;
-
 	assert(nwords <= res->nwords);
-	for (n = 0; n < nwords; ++n)
-		res->words[n] = arg1->words[n] | arg2->words[n];
+	fastset_bitvec_kernels->op_or(res->words, arg1->words, arg2->words, nwords);
 }
 
 static inline void
@@ -332,30 +594,100 @@ fastset_bitvec_copy(const fastset_bitvec_t *arg)
 {
 	fastset_bitvec_t *res;
 
-	res = fastset_bitvec_new(arg->max_index);
+	if (arg->compressed)
+		return fastset_bitvec_chunked_copy(arg);
+
+	res = fastset_bitvec_new_pooled(arg->pool, arg->max_index);
 	__fastset_bitvec_copy(res, arg, 0, res->nwords);
+	res->cardinality = arg->cardinality;
 	return res;
 }
 
+/*
+ * Replace the contents of res with those of tmp, and free tmp
+ */
+static void
+fastset_bitvec_replace(fastset_bitvec_t *res, fastset_bitvec_t *tmp)
+{
+	unsigned int refcount = res->refcount;
+	fastset_bitvec_pool_t *pool = res->pool;
+	fastset_bitvec_word_t *inline_words = res->inline_words;
+	unsigned int ninline = res->ninline;
+
+	assert(tmp->refcount == 1);
+	assert(!fastset_bitvec_is_embedded(tmp));
+
+	fastset_bitvec_reset(res);
+
+	*res = *tmp;
+	res->refcount = refcount;
+	res->pool = pool;
+	res->inline_words = inline_words;
+	res->ninline = ninline;
+
+	fastset_bitvec_pool_put_header(tmp->pool, tmp);
+}
+
+/*
+ * Set res to a copy of arg
+ */
+void
+fastset_bitvec_assign(fastset_bitvec_t *res, const fastset_bitvec_t *arg)
+{
+	fastset_bitvec_reset(res);
+
+	if (arg->compressed) {
+		fastset_bitvec_replace(res, fastset_bitvec_chunked_copy(arg));
+		return;
+	}
+
+	fastset_bitvec_resize(res, arg->max_index);
+	__fastset_bitvec_copy(res, arg, 0, res->nwords);
+	res->cardinality = arg->cardinality;
+}
+
+/*
+ * In-place update where at least one of the vectors is compressed
+ */
+static void
+fastset_bitvec_chunked_update(fastset_bitvec_t *res, const fastset_bitvec_t *arg, int op)
+{
+	fastset_bitvec_replace(res, fastset_bitvec_chunked_binop(res, arg, op));
+}
+
 void
 fastset_bitvec_update_union(fastset_bitvec_t *res, const fastset_bitvec_t *arg)
 {
 	unsigned int max_index;
 
+	if (res->compressed || arg->compressed) {
+		fastset_bitvec_chunked_update(res, arg, FASTSET_OP_OR);
+		return;
+	}
+
 	max_index = MAX(res->max_index, arg->max_index);
 	fastset_bitvec_resize(res, max_index);
 
 	__fastset_bitvec_union(res, res, arg, arg->nwords);
+	fastset_bitvec_invalidate_count(res);
 }
 
-fastset_bitvec_t *
-fastset_bitvec_union(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
+/*
+ * The _into functions store the result of an operation in res, replacing
+ * its previous contents. res must not be one of the arguments.
+ */
+void
+fastset_bitvec_union_into(fastset_bitvec_t *res, const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
 {
-	unsigned int max_index;
-	fastset_bitvec_t *res;
+	assert(res != arg1 && res != arg2);
+
+	fastset_bitvec_reset(res);
+	if (arg1->compressed || arg2->compressed) {
+		fastset_bitvec_replace(res, fastset_bitvec_chunked_binop(arg1, arg2, FASTSET_OP_OR));
+		return;
+	}
 
-	max_index = MAX(arg1->max_index, arg2->max_index);
-	res = fastset_bitvec_new(max_index);
+	fastset_bitvec_resize(res, MAX(arg1->max_index, arg2->max_index));
 
 	if (arg1->nwords < arg2->nwords) {
 		__fastset_bitvec_union(res, arg1, arg2, arg1->nwords);
@@ -365,34 +697,69 @@ fastset_bitvec_union(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
 		__fastset_bitvec_copy(res, arg1, arg2->nwords, arg1->nwords);
 	}
 
+	fastset_bitvec_invalidate_count(res);
+}
+
+fastset_bitvec_t *
+fastset_bitvec_union(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
+{
+	fastset_bitvec_t *res;
+
+	if (arg1->compressed || arg2->compressed)
+		return fastset_bitvec_chunked_binop(arg1, arg2, FASTSET_OP_OR);
+
+	res = fastset_bitvec_new(0);
+	fastset_bitvec_union_into(res, arg1, arg2);
 	return res;
 }
 
 static inline void
 __fastset_bitvec_intersection(fastset_bitvec_t *res, const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
 {
-	unsigned int n, nbits;
+	unsigned int nbits;
 
 	nbits = MIN(arg1->max_index, arg2->max_index);
 //	printf("%s: resize from %u, %u -> %u\n", __func__, arg1->max_index, arg2->max_index, nbits);
 	fastset_bitvec_resize(res, nbits);
 //	printf("  max_index=%u nwords=%u\n", res->max_index, res->nwords);
 
-	for (n = 0; n < res->nwords; ++n)
-		res->words[n] = arg1->words[n] & arg2->words[n];
+	fastset_bitvec_kernels->op_and(res->words, arg1->words, arg2->words, res->nwords);
+	fastset_bitvec_invalidate_count(res);
 }
 
 void
 fastset_bitvec_update_intersection(fastset_bitvec_t *res, const fastset_bitvec_t *arg)
 {
+	if (res->compressed || arg->compressed) {
+		fastset_bitvec_chunked_update(res, arg, FASTSET_OP_AND);
+		return;
+	}
+
 	__fastset_bitvec_intersection(res, res, arg);
 }
 
+void
+fastset_bitvec_intersection_into(fastset_bitvec_t *res, const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
+{
+	assert(res != arg1 && res != arg2);
+
+	fastset_bitvec_reset(res);
+	if (arg1->compressed || arg2->compressed) {
+		fastset_bitvec_replace(res, fastset_bitvec_chunked_binop(arg1, arg2, FASTSET_OP_AND));
+		return;
+	}
+
+	__fastset_bitvec_intersection(res, arg1, arg2);
+}
+
 fastset_bitvec_t *
 fastset_bitvec_intersection(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
 {
 	fastset_bitvec_t *res;
 
+	if (arg1->compressed || arg2->compressed)
+		return fastset_bitvec_chunked_binop(arg1, arg2, FASTSET_OP_AND);
+
 	res = fastset_bitvec_new(0);
 
 	__fastset_bitvec_intersection(res, arg1, arg2);
@@ -400,27 +767,81 @@ fastset_bitvec_intersection(const fastset_bitvec_t *arg1, const fastset_bitvec_t
 	return res;
 }
 
+void
+fastset_bitvec_difference_into(fastset_bitvec_t *res, const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
+{
+	unsigned int nwords;
+
+	assert(res != arg1 && res != arg2);
+
+	fastset_bitvec_reset(res);
+	if (arg1->compressed || arg2->compressed) {
+		fastset_bitvec_replace(res, fastset_bitvec_chunked_binop(arg1, arg2, FASTSET_OP_ANDNOT));
+		return;
+	}
+
+	fastset_bitvec_resize(res, arg1->max_index);
+
+	nwords = MIN(arg1->nwords, arg2->nwords);
+	fastset_bitvec_kernels->op_andnot(res->words, arg1->words, arg2->words, nwords);
+	__fastset_bitvec_copy(res, arg1, nwords, arg1->nwords);
+	fastset_bitvec_invalidate_count(res);
+}
+
 fastset_bitvec_t *
 fastset_bitvec_difference(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
 {
 	fastset_bitvec_t *res;
 
-	res = fastset_bitvec_copy(arg1);
-	fastset_bitvec_update_difference(res, arg2);
+	if (arg1->compressed || arg2->compressed)
+		return fastset_bitvec_chunked_binop(arg1, arg2, FASTSET_OP_ANDNOT);
+
+	res = fastset_bitvec_new(0);
+	fastset_bitvec_difference_into(res, arg1, arg2);
 	return res;
 }
 
 void
 fastset_bitvec_update_difference(fastset_bitvec_t *res, const fastset_bitvec_t *arg)
 {
-	unsigned int n, nbits, count;
+	unsigned int nbits, count;
+
+	if (res->compressed || arg->compressed) {
+		fastset_bitvec_chunked_update(res, arg, FASTSET_OP_ANDNOT);
+		return;
+	}
 
 	nbits = MIN(res->max_index, arg->max_index);
 	if (nbits > 0) {
 		count = fastset_bitvec_bits_to_size(nbits - 1);
-		for (n = 0; n < count; ++n)
-			res->words[n] &= ~(arg->words[n]);
+		fastset_bitvec_kernels->op_andnot(res->words, res->words, arg->words, count);
+		fastset_bitvec_invalidate_count(res);
+	}
+}
+
+void
+fastset_bitvec_symmetric_difference_into(fastset_bitvec_t *res, const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
+{
+	const fastset_bitvec_t *longer = arg1, *shorter = arg2;
+
+	assert(res != arg1 && res != arg2);
+
+	fastset_bitvec_reset(res);
+	if (arg1->compressed || arg2->compressed) {
+		fastset_bitvec_replace(res, fastset_bitvec_chunked_binop(arg1, arg2, FASTSET_OP_XOR));
+		return;
+	}
+
+	if (arg1->nwords < arg2->nwords) {
+		longer = arg2;
+		shorter = arg1;
 	}
+
+	fastset_bitvec_resize(res, MAX(arg1->max_index, arg2->max_index));
+
+	fastset_bitvec_kernels->op_xor(res->words, longer->words, shorter->words, shorter->nwords);
+	__fastset_bitvec_copy(res, longer, shorter->nwords, longer->nwords);
+	fastset_bitvec_invalidate_count(res);
 }
 
 fastset_bitvec_t *
@@ -428,53 +849,415 @@ fastset_bitvec_symmetric_difference(const fastset_bitvec_t *arg1, const fastset_
 {
 	fastset_bitvec_t *res;
 
-	res = fastset_bitvec_copy(arg1);
-	fastset_bitvec_update_symmetric_difference(res, arg2);
+	if (arg1->compressed || arg2->compressed)
+		return fastset_bitvec_chunked_binop(arg1, arg2, FASTSET_OP_XOR);
 
+	res = fastset_bitvec_new(0);
+	fastset_bitvec_symmetric_difference_into(res, arg1, arg2);
 	return res;
 }
 
 void
 fastset_bitvec_update_symmetric_difference(fastset_bitvec_t *res, const fastset_bitvec_t *arg)
 {
-	unsigned int n, max_index;
+	unsigned int max_index;
+
+	if (res->compressed || arg->compressed) {
+		fastset_bitvec_chunked_update(res, arg, FASTSET_OP_XOR);
+		return;
+	}
 
 	max_index = MAX(res->max_index, arg->max_index);
 	fastset_bitvec_resize(res, max_index);
 
-	for (n = 0; n < arg->nwords; ++n)
-		res->words[n] ^= arg->words[n];
+	fastset_bitvec_kernels->op_xor(res->words, res->words, arg->words, arg->nwords);
+	fastset_bitvec_invalidate_count(res);
 }
 
-bool
-fastset_bitvec_test_subset(const fastset_bitvec_t *subset, const fastset_bitvec_t *superset)
-{
-	unsigned int n, nwords;
-	fastset_bitvec_word_t test = 0;
-
-	nwords = MIN(subset->nwords, superset->nwords);
+/*
+ * Combining more than two vectors. Dense vectors are processed in a single
+ * sweep, one block of words at a time, so that the block stays in cache
+ * while all arguments are applied to it.
+ */
+#define FASTSET_COMBINE_BLOCK	64
 
-	for (n = 0; n < nwords; ++n)
-		test |= (subset->words[n] & ~(superset->words[n]));
+static void
+fastset_bitvec_update_op(fastset_bitvec_t *res, const fastset_bitvec_t *arg, int op)
+{
+	switch (op) {
+	case FASTSET_OP_OR:
+		fastset_bitvec_update_union(res, arg);
+		break;
+	case FASTSET_OP_AND:
+		fastset_bitvec_update_intersection(res, arg);
+		break;
+	case FASTSET_OP_ANDNOT:
+		fastset_bitvec_update_difference(res, arg);
+		break;
+	case FASTSET_OP_XOR:
+		fastset_bitvec_update_symmetric_difference(res, arg);
+		break;
+	}
+}
+
+static int
+fastset_bitvec_compare_size(const void *a, const void *b)
+{
+	const fastset_bitvec_t *vec1 = *(const fastset_bitvec_t **) a;
+	const fastset_bitvec_t *vec2 = *(const fastset_bitvec_t **) b;
+
+	if (vec1->max_index != vec2->max_index)
+		return vec1->max_index < vec2->max_index? -1 : 1;
+
+	/* Among vectors of equal size, prefer those known to be sparse */
+	if (vec1->cardinality >= 0 && vec2->cardinality >= 0 && vec1->cardinality != vec2->cardinality)
+		return vec1->cardinality < vec2->cardinality? -1 : 1;
+	return 0;
+}
+
+/* Number of words of vec within the block of n words starting at base */
+static inline unsigned int
+fastset_bitvec_block_words(const fastset_bitvec_t *vec, unsigned int base, unsigned int n)
+{
+	if (base >= vec->nwords)
+		return 0;
+	return MIN(n, vec->nwords - base);
+}
+
+/*
+ * res = args[0] OP args[1] OP ... OP args[nargs-1], where OP is one of
+ * union, intersection and difference. For intersections, args is
+ * reordered smallest first. res must not be one of the arguments.
+ */
+void
+fastset_bitvec_combine_into(fastset_bitvec_t *res, const fastset_bitvec_t **args, unsigned int nargs, int op)
+{
+	const fastset_bitvec_t *first;
+	unsigned int max_index, base, k;
+
+	assert(nargs > 0);
+	assert(op == FASTSET_OP_OR || op == FASTSET_OP_AND || op == FASTSET_OP_ANDNOT);
+
+	if (op == FASTSET_OP_AND)
+		qsort(args, nargs, sizeof(args[0]), fastset_bitvec_compare_size);
+
+	for (k = 0; k < nargs; ++k) {
+		if (args[k]->compressed)
+			break;
+	}
+
+	if (k < nargs) {
+		/* Compressed vectors are combined pairwise */
+		fastset_bitvec_assign(res, args[0]);
+		for (k = 1; k < nargs; ++k)
+			fastset_bitvec_update_op(res, args[k], op);
+		return;
+	}
+
+	first = args[0];
+	max_index = first->max_index;
+	if (op == FASTSET_OP_OR) {
+		for (k = 1; k < nargs; ++k)
+			max_index = MAX(max_index, args[k]->max_index);
+	}
+
+	fastset_bitvec_reset(res);
+	fastset_bitvec_resize(res, max_index);
+
+	for (base = 0; base < res->nwords; base += FASTSET_COMBINE_BLOCK) {
+		unsigned int n = MIN(FASTSET_COMBINE_BLOCK, res->nwords - base);
+		fastset_bitvec_word_t *block = res->words + base;
+
+		if (op == FASTSET_OP_OR) {
+			/* resize left the block zeroed */
+			for (k = 0; k < nargs; ++k) {
+				unsigned int m = fastset_bitvec_block_words(args[k], base, n);
+
+				if (m)
+					fastset_bitvec_kernels->op_or(block, block, args[k]->words + base, m);
+			}
+			continue;
+		}
+
+		__fastset_bitvec_copy(res, first, base, base + fastset_bitvec_block_words(first, base, n));
+
+		/* Stop applying arguments once the block is empty */
+		for (k = 1; k < nargs && fastset_bitvec_kernels->test_and(block, block, n); ++k) {
+			unsigned int m = fastset_bitvec_block_words(args[k], base, n);
+
+			if (op == FASTSET_OP_AND) {
+				fastset_bitvec_kernels->op_and(block, block, args[k]->words + base, m);
+				memset(block + m, 0, (n - m) * sizeof(block[0]));
+			} else {
+				fastset_bitvec_kernels->op_andnot(block, block, args[k]->words + base, m);
+			}
+		}
+	}
+
+	fastset_bitvec_invalidate_count(res);
+}
+
+/*
+ * Evaluation of expression programs. Dense operands are evaluated one block
+ * of words at a time, like fastset_bitvec_combine_into, with one block
+ * buffer per stack slot. Slot 0 may be the result vector itself.
+ */
+static inline fastset_bitvec_word_t *
+fastset_bitvec_program_slot(fastset_bitvec_word_t *slot0, fastset_bitvec_word_t *scratch, unsigned int stride, unsigned int k)
+{
+	return k? scratch + (k - 1) * stride : slot0;
+}
+
+static void
+fastset_bitvec_program_apply(fastset_bitvec_word_t *dst, const fastset_bitvec_word_t *src, unsigned int m, unsigned int n, int op)
+{
+	switch (op) {
+	case FASTSET_OP_OR:
+		fastset_bitvec_kernels->op_or(dst, dst, src, m);
+		break;
+	case FASTSET_OP_AND:
+		fastset_bitvec_kernels->op_and(dst, dst, src, m);
+		memset(dst + m, 0, (n - m) * sizeof(dst[0]));
+		break;
+	case FASTSET_OP_ANDNOT:
+		fastset_bitvec_kernels->op_andnot(dst, dst, src, m);
+		break;
+	case FASTSET_OP_XOR:
+		fastset_bitvec_kernels->op_xor(dst, dst, src, m);
+		break;
+	}
+}
+
+static void
+fastset_bitvec_program_run(const fastset_bitvec_program_t *prog, const fastset_bitvec_t **vecs,
+		fastset_bitvec_word_t *slot0, fastset_bitvec_word_t *scratch, unsigned int stride,
+		unsigned int base, unsigned int n)
+{
+	unsigned int pc, sp = 0;
+
+	for (pc = 0; pc < prog->ninsns; ++pc) {
+		const fastset_bitvec_insn_t *insn = &prog->insns[pc];
+		const fastset_bitvec_t *vec = vecs[insn->arg];
+		fastset_bitvec_word_t *dst;
+		unsigned int m;
+
+		switch (insn->opcode) {
+		case FASTSET_INSN_LOAD:
+			dst = fastset_bitvec_program_slot(slot0, scratch, stride, sp++);
+			m = fastset_bitvec_block_words(vec, base, n);
+			memcpy(dst, vec->words + base, m * sizeof(dst[0]));
+			memset(dst + m, 0, (n - m) * sizeof(dst[0]));
+			break;
+
+		case FASTSET_INSN_APPLY:
+			dst = fastset_bitvec_program_slot(slot0, scratch, stride, sp - 1);
+			m = fastset_bitvec_block_words(vec, base, n);
+			fastset_bitvec_program_apply(dst, vec->words + base, m, n, insn->op);
+			break;
+
+		case FASTSET_INSN_COMBINE:
+			--sp;
+			dst = fastset_bitvec_program_slot(slot0, scratch, stride, sp - 1);
+			fastset_bitvec_program_apply(dst, fastset_bitvec_program_slot(slot0, scratch, stride, sp), n, n, insn->op);
+			break;
+		}
+	}
+
+	assert(sp == 1);
+}
+
+static unsigned int
+fastset_bitvec_program_max_index(const fastset_bitvec_program_t *prog, const fastset_bitvec_t **vecs)
+{
+	unsigned int stack[FASTSET_PROGRAM_MAX_DEPTH];
+	unsigned int pc, sp = 0;
+
+	for (pc = 0; pc < prog->ninsns; ++pc) {
+		const fastset_bitvec_insn_t *insn = &prog->insns[pc];
+		unsigned int arg;
+
+		if (insn->opcode == FASTSET_INSN_LOAD) {
+			stack[sp++] = vecs[insn->arg]->max_index;
+			continue;
+		}
+
+		if (insn->opcode == FASTSET_INSN_APPLY)
+			arg = vecs[insn->arg]->max_index;
+		else
+			arg = stack[--sp];
+
+		if (insn->op == FASTSET_OP_AND)
+			stack[sp - 1] = MIN(stack[sp - 1], arg);
+		else if (insn->op != FASTSET_OP_ANDNOT)
+			stack[sp - 1] = MAX(stack[sp - 1], arg);
+	}
+
+	return stack[0];
+}
+
+static bool
+fastset_bitvec_program_is_dense(const fastset_bitvec_program_t *prog, const fastset_bitvec_t **vecs)
+{
+	unsigned int pc;
+
+	for (pc = 0; pc < prog->ninsns; ++pc) {
+		const fastset_bitvec_insn_t *insn = &prog->insns[pc];
+
+		if (insn->opcode != FASTSET_INSN_COMBINE && vecs[insn->arg]->compressed)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Programs with compressed operands are evaluated one operation at a time,
+ * using a stack of temporary vectors
+ */
+static void
+fastset_bitvec_program_eval_chunked(fastset_bitvec_t *res, const fastset_bitvec_program_t *prog, const fastset_bitvec_t **vecs)
+{
+	fastset_bitvec_t *stack[FASTSET_PROGRAM_MAX_DEPTH];
+	unsigned int pc, sp = 0;
+
+	for (pc = 0; pc < prog->ninsns; ++pc) {
+		const fastset_bitvec_insn_t *insn = &prog->insns[pc];
+
+		switch (insn->opcode) {
+		case FASTSET_INSN_LOAD:
+			stack[sp++] = fastset_bitvec_copy(vecs[insn->arg]);
+			break;
+
+		case FASTSET_INSN_APPLY:
+			fastset_bitvec_update_op(stack[sp - 1], vecs[insn->arg], insn->op);
+			break;
+
+		case FASTSET_INSN_COMBINE:
+			--sp;
+			fastset_bitvec_update_op(stack[sp - 1], stack[sp], insn->op);
+			fastset_bitvec_release(stack[sp]);
+			break;
+		}
+	}
+
+	assert(sp == 1);
+	fastset_bitvec_assign(res, stack[0]);
+	fastset_bitvec_release(stack[0]);
+}
+
+void
+fastset_bitvec_program_eval_into(fastset_bitvec_t *res, const fastset_bitvec_program_t *prog, const fastset_bitvec_t **vecs)
+{
+	fastset_bitvec_word_t *scratch = NULL;
+	unsigned int base;
+
+	assert(prog->depth <= FASTSET_PROGRAM_MAX_DEPTH);
 
-	for (; n < subset->nwords; ++n)
-		test |= subset->words[n];
+	if (!fastset_bitvec_program_is_dense(prog, vecs)) {
+		fastset_bitvec_program_eval_chunked(res, prog, vecs);
+		return;
+	}
+
+	fastset_bitvec_reset(res);
+	fastset_bitvec_resize(res, fastset_bitvec_program_max_index(prog, vecs));
+
+	if (prog->depth > 1)
+		scratch = malloc((prog->depth - 1) * FASTSET_COMBINE_BLOCK * sizeof(scratch[0]));
+
+	for (base = 0; base < res->nwords; base += FASTSET_COMBINE_BLOCK) {
+		unsigned int n = MIN(FASTSET_COMBINE_BLOCK, res->nwords - base);
+
+		fastset_bitvec_program_run(prog, vecs, res->words + base, scratch, FASTSET_COMBINE_BLOCK, base, n);
+	}
+
+	free(scratch);
+	fastset_bitvec_invalidate_count(res);
+}
+
+unsigned int
+fastset_bitvec_program_count(const fastset_bitvec_program_t *prog, const fastset_bitvec_t **vecs)
+{
+	fastset_bitvec_word_t block[FASTSET_COMBINE_BLOCK], *scratch = NULL;
+	unsigned int nwords, base, count = 0;
+	fastset_bitvec_t *tmp;
+
+	if (!fastset_bitvec_program_is_dense(prog, vecs)) {
+		tmp = fastset_bitvec_new_pooled(vecs[0]->pool, 0);
+		fastset_bitvec_program_eval_chunked(tmp, prog, vecs);
+		count = fastset_bitvec_count_ones(tmp);
+		fastset_bitvec_release(tmp);
+		return count;
+	}
+
+	nwords = fastset_bitvec_bits_to_size(fastset_bitvec_program_max_index(prog, vecs));
+
+	if (prog->depth > 1)
+		scratch = malloc((prog->depth - 1) * FASTSET_COMBINE_BLOCK * sizeof(scratch[0]));
+
+	/* Count the result block by block, without storing it */
+	for (base = 0; base < nwords; base += FASTSET_COMBINE_BLOCK) {
+		unsigned int n = MIN(FASTSET_COMBINE_BLOCK, nwords - base);
+
+		fastset_bitvec_program_run(prog, vecs, block, scratch, FASTSET_COMBINE_BLOCK, base, n);
+		count += fastset_bitvec_kernels->popcount(block, n);
+	}
 
-	return test == 0;
+	free(scratch);
+	return count;
 }
 
 bool
-fastset_bitvec_test_disjoint(const fastset_bitvec_t *subset, const fastset_bitvec_t *superset)
+fastset_bitvec_program_test_bit(const fastset_bitvec_program_t *prog, const fastset_bitvec_t **vecs, unsigned int index)
+{
+	fastset_bitvec_word_t stack[FASTSET_PROGRAM_MAX_DEPTH];
+	fastset_bitvec_t *tmp;
+	bool result;
+
+	if (!fastset_bitvec_program_is_dense(prog, vecs)) {
+		tmp = fastset_bitvec_new_pooled(vecs[0]->pool, 0);
+		fastset_bitvec_program_eval_chunked(tmp, prog, vecs);
+		result = fastset_bitvec_test_bit(tmp, index);
+		fastset_bitvec_release(tmp);
+		return result;
+	}
+
+	/* Evaluate just the word containing the bit */
+	fastset_bitvec_program_run(prog, vecs, stack, stack + 1, 1, index / FASTVEC_WORD_SIZE, 1);
+	return !!(stack[0] & ((fastset_bitvec_word_t) 1 << (index % FASTVEC_WORD_SIZE)));
+}
+
+bool
+fastset_bitvec_test_subset(const fastset_bitvec_t *subset, const fastset_bitvec_t *superset)
 {
 	unsigned int n, nwords;
-	fastset_bitvec_word_t test = 0;
+
+	/* For compressed vectors, it's easier to count */
+	if (subset->compressed || superset->compressed)
+		return fastset_bitvec_intersection_count(subset, superset) == fastset_bitvec_count_ones(subset);
 
 	nwords = MIN(subset->nwords, superset->nwords);
 
-	for (n = 0; n < nwords; ++n)
-		test |= (subset->words[n] & superset->words[n]);
+	if (fastset_bitvec_kernels->test_andnot(subset->words, superset->words, nwords))
+		return false;
+
+	for (n = nwords; n < subset->nwords; ++n) {
+		if (subset->words[n])
+			return false;
+	}
+
+	return true;
+}
+
+bool
+fastset_bitvec_test_disjoint(const fastset_bitvec_t *subset, const fastset_bitvec_t *superset)
+{
+	unsigned int nwords;
+
+	if (subset->compressed || superset->compressed)
+		return fastset_bitvec_intersection_count(subset, superset) == 0;
 
-	return test == 0;
+	nwords = MIN(subset->nwords, superset->nwords);
+
+	return !fastset_bitvec_kernels->test_and(subset->words, superset->words, nwords);
 }
 
 bool
@@ -482,6 +1265,9 @@ fastset_bitvec_test_empty(const fastset_bitvec_t *vec)
 {
 	unsigned int i;
 
+	if (vec->cardinality >= 0)
+		return vec->cardinality == 0;
+
 	for (i = 0; i < vec->nwords; ++i) {
 		if (vec->words[i])
 			return false;
@@ -496,6 +1282,9 @@ fastset_bitvec_test_bit(const fastset_bitvec_t *vec, unsigned int index)
 	unsigned int word_index;
 	fastset_bitvec_word_t mask;
 
+	if (vec->compressed)
+		return fastset_bitvec_chunked_test(vec, index);
+
 	if (!fastset_bitvec_bit_to_index(vec, index, &word_index, &mask))
 		return false;
 	return !!(vec->words[word_index] & mask);
@@ -520,17 +1309,206 @@ fastset_bitvec_transform_new(unsigned int max_index)
 	return trans;
 }
 
+static void
+fastset_bitvec_transform_uncompile(fastset_bitvec_transform_t *trans)
+{
+	fastset_bitvec_transform_table_t *compiled;
+
+	if ((compiled = trans->compiled) != NULL) {
+		free(compiled->positions);
+		free(compiled->tables);
+		free(compiled);
+		trans->compiled = NULL;
+	}
+}
+
 void
 fastset_bitvec_transform_add(fastset_bitvec_transform_t *trans, unsigned int arg_index, int res_index)
 {
 	assert(arg_index < trans->max_index);
 
-	trans->mapping[arg_index] = res_index;
+	if (trans->mapping[arg_index] != res_index) {
+		fastset_bitvec_transform_uncompile(trans);
+		trans->mapping[arg_index] = res_index;
+	}
+}
+
+/*
+ * Describe where the bits of input byte pos go, as the offsets of the
+ * output bits within *word_p (0xff for unmapped bits). Returns false if
+ * they do not all fall into the same output word.
+ */
+static bool
+fastset_bitvec_transform_byte_layout(const fastset_bitvec_transform_t *trans, unsigned int pos,
+			unsigned int *word_p, uint64_t *layout_p)
+{
+	uint64_t layout = ~(uint64_t) 0;
+	unsigned int bit, word = 0;
+	bool have_word = false;
+
+	for (bit = 0; bit < 8 && pos * 8 + bit < trans->max_index; ++bit) {
+		int res_index = trans->mapping[pos * 8 + bit];
+
+		if (res_index < 0)
+			continue;
+
+		if (!have_word) {
+			word = res_index / FASTVEC_WORD_SIZE;
+			have_word = true;
+		} else if (res_index / FASTVEC_WORD_SIZE != word) {
+			return false;
+		}
+
+		layout &= ~((uint64_t) 0xff << (8 * bit));
+		layout |= (uint64_t) (res_index % FASTVEC_WORD_SIZE) << (8 * bit);
+	}
+
+	*word_p = word;
+	*layout_p = layout;
+	return true;
+}
+
+/*
+ * Build the byte tables for a transform. We need this once per transform,
+ * but then apply it to lots of sets.
+ */
+void
+fastset_bitvec_transform_compile(fastset_bitvec_transform_t *trans)
+{
+	fastset_bitvec_transform_table_t *compiled;
+	unsigned int hash_size = 2 * FASTSET_TRANSFORM_MAX_TABLES;
+	uint64_t *hash_keys;
+	int *hash_tables;
+	unsigned int pos, i, ntabled = 0;
+
+	if (trans->compiled)
+		return;
+
+	compiled = calloc(1, sizeof(*compiled));
+	compiled->npositions = (trans->max_index + 7) / 8;
+	compiled->positions = calloc(compiled->npositions, sizeof(compiled->positions[0]));
+	compiled->tables = NULL;
+
+	for (i = 0; i < trans->max_index; ++i) {
+		if (trans->mapping[i] >= 0 && (unsigned int) trans->mapping[i] >= compiled->res_max_index)
+			compiled->res_max_index = trans->mapping[i] + 1;
+	}
+
+	/* Bytes with the same layout share a table; find them by hashing */
+	hash_keys = malloc(hash_size * sizeof(hash_keys[0]));
+	hash_tables = malloc(hash_size * sizeof(hash_tables[0]));
+	for (i = 0; i < hash_size; ++i)
+		hash_tables[i] = -1;
+
+	for (pos = 0; pos < compiled->npositions; ++pos) {
+		fastset_transform_byte_t *byte = &compiled->positions[pos];
+		fastset_bitvec_word_t *table;
+		uint64_t layout;
+		unsigned int slot, value;
+
+		byte->table = -1;
+		if (!fastset_bitvec_transform_byte_layout(trans, pos, &byte->word, &layout))
+			continue;
+
+		slot = ((layout * 0x9e3779b97f4a7c15ULL) >> 32) % hash_size;
+		while (hash_tables[slot] >= 0 && hash_keys[slot] != layout)
+			slot = (slot + 1) % hash_size;
+
+		if (hash_tables[slot] >= 0) {
+			byte->table = hash_tables[slot];
+			ntabled++;
+			continue;
+		}
+
+		/* Out of tables; map the rest bit by bit */
+		if (compiled->ntables >= FASTSET_TRANSFORM_MAX_TABLES)
+			continue;
+
+		if (compiled->ntables % 64 == 0)
+			compiled->tables = realloc(compiled->tables, (compiled->ntables + 64) * sizeof(compiled->tables[0]));
+		if (compiled->tables == NULL)
+			abort();
+
+		hash_keys[slot] = layout;
+		hash_tables[slot] = byte->table = compiled->ntables++;
+		ntabled++;
+
+		/* Each entry adds the lowest bit of the value to an entry computed earlier */
+		table = compiled->tables[byte->table];
+		table[0] = 0;
+		for (value = 1; value < 256; ++value) {
+			unsigned int bit = __builtin_ctz(value);
+			unsigned int offset = (layout >> (8 * bit)) & 0xff;
+
+			table[value] = table[value & (value - 1)];
+			if (offset != 0xff)
+				table[value] |= (fastset_bitvec_word_t) 1 << offset;
+		}
+	}
+
+	free(hash_keys);
+	free(hash_tables);
+
+	compiled->use_tables = (ntabled >= compiled->npositions / 2);
+	trans->compiled = compiled;
+}
+
+/*
+ * Return the transform that applies inner first, and then outer
+ */
+fastset_bitvec_transform_t *
+fastset_bitvec_transform_compose(const fastset_bitvec_transform_t *outer, const fastset_bitvec_transform_t *inner)
+{
+	fastset_bitvec_transform_t *trans;
+	unsigned int i;
+
+	trans = fastset_bitvec_transform_new(inner->max_index);
+	for (i = 0; i < inner->max_index; ++i) {
+		int mid_index = inner->mapping[i];
+
+		if (mid_index >= 0 && (unsigned int) mid_index < outer->max_index)
+			trans->mapping[i] = outer->mapping[mid_index];
+	}
+
+	return trans;
+}
+
+/*
+ * Return the inverse of a transform, or NULL if it maps two inputs to
+ * the same output
+ */
+fastset_bitvec_transform_t *
+fastset_bitvec_transform_invert(const fastset_bitvec_transform_t *trans)
+{
+	fastset_bitvec_transform_t *inverse;
+	unsigned int i, max_index = 0;
+
+	for (i = 0; i < trans->max_index; ++i) {
+		if (trans->mapping[i] >= 0 && (unsigned int) trans->mapping[i] >= max_index)
+			max_index = trans->mapping[i] + 1;
+	}
+
+	inverse = fastset_bitvec_transform_new(max_index);
+	for (i = 0; i < trans->max_index; ++i) {
+		int res_index = trans->mapping[i];
+
+		if (res_index < 0)
+			continue;
+
+		if (inverse->mapping[res_index] >= 0) {
+			fastset_bitvec_transform_free(inverse);
+			return NULL;
+		}
+		inverse->mapping[res_index] = i;
+	}
+
+	return inverse;
 }
 
 void
 fastset_bitvec_transform_free(fastset_bitvec_transform_t *trans)
 {
+	fastset_bitvec_transform_uncompile(trans);
 	free(trans->mapping);
 	trans->mapping = NULL;
 	trans->max_index = 0;
@@ -541,33 +1519,155 @@ fastset_bitvec_transform_free(fastset_bitvec_transform_t *trans)
 fastset_bitvec_t *
 fastset_bitvec_transform(const fastset_bitvec_t *vec, const fastset_bitvec_transform_t *trans)
 {
-	unsigned int max_index = MIN(vec->max_index, trans->max_index);
 	fastset_bitvec_t *res;
-	unsigned int from_index = 0;
 
-	res = fastset_bitvec_new(max_index);
-	while (true) {
-		int arg_bit, res_bit;
+	res = fastset_bitvec_new(0);
+	fastset_bitvec_transform_into(res, vec, trans);
+	return res;
+}
 
-		/* Find the next bit in the argument bitvec */
-		arg_bit = fastset_bitvec_find_next_bit(vec, from_index);
-		if (arg_bit < 0)
-			break;
+static inline void
+fastset_bitvec_transform_scatter(fastset_bitvec_word_t *out, fastset_bitvec_word_t word, unsigned int base,
+			const fastset_bitvec_transform_t *trans)
+{
+	while (word) {
+		unsigned int arg_bit = base + __builtin_ctzll(word);
+		int res_bit;
+
+		word &= word - 1;
+		if (arg_bit < trans->max_index && (res_bit = trans->mapping[arg_bit]) >= 0)
+			out[res_bit / FASTVEC_WORD_SIZE] |= (fastset_bitvec_word_t) 1 << (res_bit % FASTVEC_WORD_SIZE);
+	}
+}
 
-		from_index = arg_bit + 1;
+/*
+ * Apply a compiled transform to a flat bitvec, one byte at a time. The
+ * result has room for all output bits up front, so that we can write
+ * its words directly.
+ */
+static void
+fastset_bitvec_transform_dense(fastset_bitvec_t *res, const fastset_bitvec_t *vec, const fastset_bitvec_transform_t *trans)
+{
+	const fastset_bitvec_transform_table_t *compiled = trans->compiled;
+	unsigned int npositions = MIN(vec->nwords * 8, compiled->npositions);
+	fastset_bitvec_word_t *out;
+	unsigned int w, pos;
 
-		assert((unsigned int) arg_bit < max_index);
+	fastset_bitvec_reset(res);
+	if (compiled->res_max_index == 0)
+		return;
 
-		/* transform using the given mapping. a negative value means
-		 * the mapping is not defined for this bit.
-		 * We choose to ignore this. Alternatively, we could error out.
-		 */
-		res_bit = trans->mapping[arg_bit];
-		if (res_bit >= 0)
-			fastset_bitvec_set(res, res_bit);
+	fastset_bitvec_resize(res, compiled->res_max_index);
+	out = res->words;
+	res->cardinality = -1;
+
+	if (!compiled->use_tables) {
+		for (w = 0; w * 8 < npositions; ++w)
+			fastset_bitvec_transform_scatter(out, vec->words[w], w * FASTVEC_WORD_SIZE, trans);
+		return;
 	}
 
-	return res;
+	for (w = 0; w * 8 < npositions; ++w) {
+		fastset_bitvec_word_t word = vec->words[w];
+
+		for (pos = w * 8; word != 0 && pos < npositions; ++pos, word >>= 8) {
+			const fastset_transform_byte_t *byte;
+			unsigned int value = word & 0xff;
+
+			if (value == 0)
+				continue;
+
+			byte = &compiled->positions[pos];
+			if (byte->table >= 0)
+				out[byte->word] |= compiled->tables[byte->table][value];
+			else
+				fastset_bitvec_transform_scatter(out, value, pos * 8, trans);
+		}
+	}
+}
+
+void
+fastset_bitvec_transform_into(fastset_bitvec_t *res, const fastset_bitvec_t *vec, const fastset_bitvec_transform_t *trans)
+{
+	unsigned int max_index = MIN(vec->max_index, trans->max_index);
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int from_index = 0, count, i, nbits;
+
+	assert(res != vec);
+
+	/* The result has at most as many members as the argument. Flat
+	 * arguments with a dense result go through the compiled tables. */
+	nbits = fastset_bitvec_count_ones(vec);
+	if (trans->compiled && !vec->compressed
+	 && !fastset_bitvec_want_compressed(trans->compiled->res_max_index, nbits, false)) {
+		fastset_bitvec_transform_dense(res, vec, trans);
+		return;
+	}
+
+	/* Sparse results are built in compressed form right away, rather
+	 * than allocating words for the whole domain */
+	fastset_bitvec_reset(res);
+	if (fastset_bitvec_want_compressed(max_index, nbits, false))
+		fastset_bitvec_compress(res);
+	fastset_bitvec_resize(res, max_index);
+
+	/* Decode the argument bitvec in batches */
+	while ((count = fastset_bitvec_extract(vec, from_index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+		for (i = 0; i < count; ++i) {
+			unsigned int arg_bit = indexes[i];
+			int res_bit;
+
+			/* Bits beyond the transform's range are not mapped */
+			if (arg_bit >= max_index)
+				return;
+
+			/* transform using the given mapping. a negative value means
+			 * the mapping is not defined for this bit.
+			 * We choose to ignore this. Alternatively, we could error out.
+			 */
+			res_bit = trans->mapping[arg_bit];
+			if (res_bit >= 0)
+				fastset_bitvec_set(res, res_bit);
+		}
+
+		from_index = indexes[count - 1] + 1;
+	}
+}
+
+/*
+ * Compute the set of inputs that the transform maps into vec
+ */
+void
+fastset_bitvec_preimage_into(fastset_bitvec_t *res, const fastset_bitvec_t *vec, const fastset_bitvec_transform_t *trans)
+{
+	fastset_bitvec_word_t *out;
+	unsigned int i;
+
+	assert(res != vec);
+
+	fastset_bitvec_reset(res);
+	if (trans->max_index == 0)
+		return;
+
+	fastset_bitvec_resize(res, trans->max_index);
+	out = res->words;
+	res->cardinality = -1;
+
+	for (i = 0; i < trans->max_index; ++i) {
+		int res_index = trans->mapping[i];
+		bool hit;
+
+		if (res_index < 0 || (unsigned int) res_index >= vec->max_index)
+			continue;
+
+		if (vec->compressed)
+			hit = fastset_bitvec_chunked_test(vec, res_index);
+		else
+			hit = (vec->words[res_index / FASTVEC_WORD_SIZE] >> (res_index % FASTVEC_WORD_SIZE)) & 1;
+
+		if (hit)
+			out[i / FASTVEC_WORD_SIZE] |= (fastset_bitvec_word_t) 1 << (i % FASTVEC_WORD_SIZE);
+	}
 }
 
 int
@@ -576,6 +1676,16 @@ fastset_bitvec_compare(const fastset_bitvec_t *vec1, const fastset_bitvec_t *vec
 	unsigned int min_word_index;
 	unsigned int pos, state = 0;
 
+	if (vec1->compressed || vec2->compressed) {
+		unsigned int common = fastset_bitvec_intersection_count(vec1, vec2);
+
+		if (common < fastset_bitvec_count_ones(vec1))
+			state |= FASTSET_REL_GREATER_THAN; /* vec1 is NOT a subset of vec2 */
+		if (common < fastset_bitvec_count_ones(vec2))
+			state |= FASTSET_REL_LESS_THAN; /* vec1 is NOT a superset of vec2 */
+		return state;
+	}
+
 	min_word_index = MIN(vec1->nwords, vec2->nwords);
 	for (pos = 0; pos < min_word_index; ++pos) {
 		fastset_bitvec_word_t word1, word2;
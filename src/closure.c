@@ -0,0 +1,323 @@
+/*
+fastsets - reachability and transitive closure
+
+Copyright (C) 2023 SUSE
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * Both algorithms in this file work on square bit matrices, where bit
+ * (r, c) means that r is related to c.
+ *
+ * Reachability from a set of start nodes is a breadth-first search that
+ * handles a whole frontier at a time: the next frontier is the union of
+ * the rows of the current one, minus everything visited before.
+ *
+ * The transitive closure of the whole matrix uses Warshall's algorithm,
+ * processing 8 pivots at a time. Once the pivot rows of a block are
+ * closed among themselves, every other row i gains exactly the union of
+ * those pivot rows it has a bit for. That union is looked up in a table
+ * of all 256 combinations of the pivot rows (the "Four Russians" trick)
+ * when that is cheaper than ORing the rows one by one. Rows are
+ * independent of each other within a block, so they can be split
+ * between several threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "fastsets.h"
+
+#define CLOSURE_BLOCK_BITS	8
+#define CLOSURE_TABLE_SIZE	(1 << CLOSURE_BLOCK_BITS)
+
+static inline unsigned int
+MIN(unsigned int a, unsigned int b)
+{
+	return (a < b)? a : b;
+}
+
+static fastset_bitvec_word_t *
+fastset_closure_alloc_words(unsigned int nwords)
+{
+	/* aligned_alloc wants the size to be a multiple of the alignment */
+	unsigned int nalloc = (nwords + FASTSET_MATRIX_ALIGN_WORDS) & ~(FASTSET_MATRIX_ALIGN_WORDS - 1);
+	fastset_bitvec_word_t *words;
+
+	words = aligned_alloc(FASTSET_MATRIX_ALIGN_WORDS * sizeof(fastset_bitvec_word_t),
+			nalloc * sizeof(fastset_bitvec_word_t));
+	if (words == NULL)
+		abort();
+
+	memset(words, 0, nwords * sizeof(fastset_bitvec_word_t));
+	return words;
+}
+
+/*
+ * Compute the set of all nodes reachable from start in one or more steps
+ */
+void
+fastset_bitvec_matrix_reachable(fastset_bitvec_t *res, const fastset_bitvec_matrix_t *m, const fastset_bitvec_t *start)
+{
+	const fastset_bitvec_kernels_t *kernels = fastset_bitvec_kernels;
+	fastset_bitvec_word_t *frontier, *next;
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int index, count, i, nwords;
+
+	assert(!res->compressed);
+	assert(res != start);
+
+	fastset_bitvec_resize(res, 0);
+	if (m->ncols == 0)
+		return;
+
+	fastset_bitvec_resize(res, m->ncols);
+	nwords = MIN(res->nwords, m->stride);
+
+	frontier = fastset_closure_alloc_words(nwords);
+	next = fastset_closure_alloc_words(nwords);
+
+	/* The first step starts from the members of start */
+	index = 0;
+	while ((count = fastset_bitvec_extract(start, index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+		for (i = 0; i < count && indexes[i] < m->nrows; ++i)
+			kernels->op_or(next, next, fastset_bitvec_matrix_row(m, indexes[i]), nwords);
+		if (i < count)
+			break;
+		index = indexes[count - 1] + 1;
+	}
+
+	while (kernels->test_andnot(next, res->words, nwords)) {
+		kernels->op_andnot(frontier, next, res->words, nwords);
+		kernels->op_or(res->words, res->words, frontier, nwords);
+
+		memset(next, 0, nwords * sizeof(next[0]));
+
+		index = 0;
+		while ((count = fastset_bitvec_words_extract(frontier, nwords, index, 0, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+			for (i = 0; i < count && indexes[i] < m->nrows; ++i)
+				kernels->op_or(next, next, fastset_bitvec_matrix_row(m, indexes[i]), nwords);
+			if (i < count)
+				break;
+			index = indexes[count - 1] + 1;
+		}
+	}
+
+	free(frontier);
+	free(next);
+
+	res->cardinality = -1;
+}
+
+typedef struct fastset_closure_job {
+	fastset_bitvec_matrix_t *m;
+	unsigned int		n;
+	unsigned int		nthreads;
+	pthread_barrier_t	barrier;
+
+	/* Set up by the first thread for the current block */
+	unsigned int		pivot;
+	unsigned int		npivots;
+	bool			skip;
+	bool			use_table;
+	fastset_bitvec_word_t *	table;
+} fastset_closure_job_t;
+
+typedef struct fastset_closure_worker {
+	fastset_closure_job_t *	job;
+	unsigned int		first_row;
+	unsigned int		last_row;
+	pthread_t		thread;
+} fastset_closure_worker_t;
+
+static inline unsigned int
+fastset_closure_pivot_bits(const fastset_closure_job_t *job, const fastset_bitvec_word_t *row)
+{
+	return (row[job->pivot / 64] >> (job->pivot % 64)) & ((1U << job->npivots) - 1);
+}
+
+static inline fastset_bitvec_word_t *
+fastset_closure_table_entry(const fastset_closure_job_t *job, unsigned int bits)
+{
+	return job->table + (size_t) bits * job->m->stride;
+}
+
+static void
+fastset_closure_barrier(fastset_closure_job_t *job)
+{
+	if (job->nthreads > 1)
+		pthread_barrier_wait(&job->barrier);
+}
+
+/*
+ * Close the pivot rows among themselves, and decide how to apply them
+ * to the remaining rows
+ */
+static void
+fastset_closure_prepare_block(fastset_closure_job_t *job)
+{
+	const fastset_bitvec_kernels_t *kernels = fastset_bitvec_kernels;
+	fastset_bitvec_matrix_t *m = job->m;
+	unsigned int j, k, bits, nbits;
+	bool empty = true;
+
+	for (k = job->pivot; k < job->pivot + job->npivots; ++k) {
+		const fastset_bitvec_word_t *pivot_row = fastset_bitvec_matrix_row(m, k);
+
+		for (j = job->pivot; j < job->pivot + job->npivots; ++j) {
+			if (j != k && fastset_bitvec_matrix_test(m, j, k))
+				kernels->op_or(fastset_bitvec_matrix_row(m, j), fastset_bitvec_matrix_row(m, j), pivot_row, m->stride);
+		}
+	}
+
+	for (k = job->pivot; k < job->pivot + job->npivots && empty; ++k)
+		empty = !kernels->popcount(fastset_bitvec_matrix_row(m, k), m->stride);
+
+	job->skip = empty;
+	if (empty)
+		return;
+
+	/* Count how many row ORs applying the pivots one by one would take */
+	for (j = 0, nbits = 0; j < job->n; ++j)
+		nbits += __builtin_popcount(fastset_closure_pivot_bits(job, fastset_bitvec_matrix_row(m, j)));
+
+	job->use_table = (nbits > (1U << job->npivots));
+	if (!job->use_table)
+		return;
+
+	/* Each entry is the union of one less entry and a single pivot row */
+	for (bits = 1; bits < (1U << job->npivots); ++bits) {
+		kernels->op_or(fastset_closure_table_entry(job, bits),
+				fastset_closure_table_entry(job, bits & (bits - 1)),
+				fastset_bitvec_matrix_row(m, job->pivot + __builtin_ctz(bits)),
+				m->stride);
+	}
+}
+
+static void
+fastset_closure_apply_block(fastset_closure_job_t *job, unsigned int first_row, unsigned int last_row)
+{
+	const fastset_bitvec_kernels_t *kernels = fastset_bitvec_kernels;
+	fastset_bitvec_matrix_t *m = job->m;
+	unsigned int i, bits;
+
+	for (i = first_row; i < last_row; ++i) {
+		fastset_bitvec_word_t *row;
+
+		if (i - job->pivot < job->npivots)
+			continue;
+
+		row = fastset_bitvec_matrix_row(m, i);
+		if (!(bits = fastset_closure_pivot_bits(job, row)))
+			continue;
+
+		if (job->use_table) {
+			kernels->op_or(row, row, fastset_closure_table_entry(job, bits), m->stride);
+		} else {
+			while (bits) {
+				kernels->op_or(row, row, fastset_bitvec_matrix_row(m, job->pivot + __builtin_ctz(bits)), m->stride);
+				bits &= bits - 1;
+			}
+		}
+	}
+}
+
+static void
+fastset_closure_run(fastset_closure_worker_t *worker, bool leader)
+{
+	fastset_closure_job_t *job = worker->job;
+	unsigned int pivot;
+
+	for (pivot = 0; pivot < job->n; pivot += CLOSURE_BLOCK_BITS) {
+		if (leader) {
+			job->pivot = pivot;
+			job->npivots = MIN(CLOSURE_BLOCK_BITS, job->n - pivot);
+			fastset_closure_prepare_block(job);
+		}
+		fastset_closure_barrier(job);
+
+		if (!job->skip)
+			fastset_closure_apply_block(job, worker->first_row, worker->last_row);
+		fastset_closure_barrier(job);
+	}
+}
+
+static void *
+fastset_closure_thread(void *arg)
+{
+	fastset_closure_run(arg, false);
+	return NULL;
+}
+
+/*
+ * Replace the matrix by its transitive closure. This does not touch any
+ * python objects, so callers may drop the GIL around it.
+ */
+void
+fastset_bitvec_matrix_closure(fastset_bitvec_matrix_t *m, unsigned int nthreads)
+{
+	fastset_closure_worker_t *workers;
+	fastset_closure_job_t job;
+	unsigned int t, rows_per_thread;
+
+	memset(&job, 0, sizeof(job));
+	job.m = m;
+	job.n = MIN(m->nrows, m->ncols);
+	if (job.n == 0)
+		return;
+
+	/* Not worth spreading fewer than 64 rows per thread */
+	if (nthreads > (job.n + 63) / 64)
+		nthreads = (job.n + 63) / 64;
+	if (nthreads == 0)
+		nthreads = 1;
+	job.nthreads = nthreads;
+
+	job.table = fastset_closure_alloc_words(CLOSURE_TABLE_SIZE * m->stride);
+
+	workers = calloc(nthreads, sizeof(workers[0]));
+	if (workers == NULL)
+		abort();
+
+	rows_per_thread = (job.n + nthreads - 1) / nthreads;
+	for (t = 0; t < nthreads; ++t) {
+		workers[t].job = &job;
+		workers[t].first_row = MIN(t * rows_per_thread, job.n);
+		workers[t].last_row = MIN((t + 1) * rows_per_thread, job.n);
+	}
+
+	if (nthreads > 1) {
+		if (pthread_barrier_init(&job.barrier, NULL, nthreads) != 0)
+			abort();
+
+		for (t = 1; t < nthreads; ++t) {
+			if (pthread_create(&workers[t].thread, NULL, fastset_closure_thread, &workers[t]) != 0)
+				abort();
+		}
+	}
+
+	fastset_closure_run(&workers[0], true);
+
+	if (nthreads > 1) {
+		for (t = 1; t < nthreads; ++t)
+			pthread_join(workers[t].thread, NULL);
+		pthread_barrier_destroy(&job.barrier);
+	}
+
+	free(workers);
+	free(job.table);
+}
@@ -0,0 +1,1253 @@
+/*
+fastsets - compressed bitvec representation
+
+Copyright (C) 2023 SUSE
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * Sparse sets over large domains are wasteful when stored as a flat
+ * word array. In compressed form, a bitvec is split into chunks of 64K
+ * bits, and each chunk is stored in whichever container is the most
+ * compact for it (in the spirit of Roaring bitmaps):
+ *
+ *  - a sorted array of 16bit offsets, for up to FASTSET_ARRAY_MAX members
+ *  - a plain bitmap of FASTSET_CHUNK_WORDS words
+ *  - a sorted list of runs [start, last]
+ *
+ * Empty chunks are not stored at all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "fastsets.h"
+
+#define CHUNK_MASK	(FASTSET_CHUNK_BITS - 1)
+
+static inline unsigned int
+chunk_of(unsigned int i)
+{
+	return i >> FASTSET_CHUNK_SHIFT;
+}
+
+static inline unsigned int
+offset_of(unsigned int i)
+{
+	return i & CHUNK_MASK;
+}
+
+static inline unsigned int
+chunks_for(unsigned int max_index)
+{
+	return (max_index + FASTSET_CHUNK_BITS - 1) >> FASTSET_CHUNK_SHIFT;
+}
+
+static inline unsigned int
+MIN(unsigned int a, unsigned int b)
+{
+	return (a < b)? a : b;
+}
+
+static inline unsigned int
+MAX(unsigned int a, unsigned int b)
+{
+	return (a > b)? a : b;
+}
+
+/*
+ * Plain bitmap helpers
+ */
+static inline bool
+bitmap_test(const fastset_bitvec_word_t *words, unsigned int off)
+{
+	return !!(words[off / 64] & (1ULL << (off % 64)));
+}
+
+static inline void
+bitmap_set(fastset_bitvec_word_t *words, unsigned int off)
+{
+	words[off / 64] |= (1ULL << (off % 64));
+}
+
+static inline void
+bitmap_clear(fastset_bitvec_word_t *words, unsigned int off)
+{
+	words[off / 64] &= ~(1ULL << (off % 64));
+}
+
+static inline void
+bitmap_flip(fastset_bitvec_word_t *words, unsigned int off)
+{
+	words[off / 64] ^= (1ULL << (off % 64));
+}
+
+static void
+bitmap_set_range(fastset_bitvec_word_t *words, unsigned int start, unsigned int last)
+{
+	unsigned int first_word = start / 64, last_word = last / 64;
+	fastset_bitvec_word_t first_mask, last_mask;
+
+	first_mask = ~0ULL << (start % 64);
+	last_mask = ~0ULL >> (63 - (last % 64));
+
+	if (first_word == last_word) {
+		words[first_word] |= first_mask & last_mask;
+		return;
+	}
+
+	words[first_word++] |= first_mask;
+	while (first_word < last_word)
+		words[first_word++] = ~0ULL;
+	words[last_word] |= last_mask;
+}
+
+/* Find the next bit >= off that is set (or clear, if invert is ~0) */
+static int
+bitmap_next(const fastset_bitvec_word_t *words, unsigned int off, fastset_bitvec_word_t invert)
+{
+	unsigned int word_index = off / 64;
+	fastset_bitvec_word_t word;
+
+	if (off >= FASTSET_CHUNK_BITS)
+		return -1;
+
+	word = (words[word_index] ^ invert) & (~0ULL << (off % 64));
+	while (word == 0) {
+		if (++word_index >= FASTSET_CHUNK_WORDS)
+			return -1;
+		word = words[word_index] ^ invert;
+	}
+
+	return word_index * 64 + __builtin_ctzll(word);
+}
+
+static unsigned int
+bitmap_extract(const fastset_bitvec_word_t *words, uint16_t *values)
+{
+	unsigned int n, count = 0;
+
+	for (n = 0; n < FASTSET_CHUNK_WORDS; ++n) {
+		fastset_bitvec_word_t word = words[n];
+
+		while (word) {
+			values[count++] = n * 64 + __builtin_ctzll(word);
+			word &= word - 1;
+		}
+	}
+	return count;
+}
+
+static unsigned int
+bitmap_count_runs(const fastset_bitvec_word_t *words)
+{
+	fastset_bitvec_word_t carry = 0;
+	unsigned int n, runs = 0;
+
+	/* A run starts at every set bit whose lower neighbor is clear */
+	for (n = 0; n < FASTSET_CHUNK_WORDS; ++n) {
+		fastset_bitvec_word_t word = words[n];
+
+		runs += __builtin_popcountll(word & ~((word << 1) | carry));
+		carry = word >> 63;
+	}
+	return runs;
+}
+
+/*
+ * Sorted uint16 array helpers
+ */
+static unsigned int
+array_lower_bound(const uint16_t *values, unsigned int count, unsigned int off)
+{
+	unsigned int lo = 0, hi = count;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (values[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static unsigned int
+array_union(const uint16_t *a, unsigned int na, const uint16_t *b, unsigned int nb, uint16_t *out)
+{
+	unsigned int i = 0, j = 0, n = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j])
+			out[n++] = a[i++];
+		else if (a[i] > b[j])
+			out[n++] = b[j++];
+		else {
+			out[n++] = a[i++];
+			j++;
+		}
+	}
+	while (i < na)
+		out[n++] = a[i++];
+	while (j < nb)
+		out[n++] = b[j++];
+	return n;
+}
+
+/* out may be NULL, in which case we just count */
+static unsigned int
+array_intersection(const uint16_t *a, unsigned int na, const uint16_t *b, unsigned int nb, uint16_t *out)
+{
+	unsigned int i = 0, j = 0, n = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j])
+			i++;
+		else if (a[i] > b[j])
+			j++;
+		else {
+			if (out)
+				out[n] = a[i];
+			n++, i++, j++;
+		}
+	}
+	return n;
+}
+
+static unsigned int
+array_difference(const uint16_t *a, unsigned int na, const uint16_t *b, unsigned int nb, uint16_t *out)
+{
+	unsigned int i = 0, j = 0, n = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j])
+			out[n++] = a[i++];
+		else if (a[i] > b[j])
+			j++;
+		else
+			i++, j++;
+	}
+	while (i < na)
+		out[n++] = a[i++];
+	return n;
+}
+
+static unsigned int
+array_symmetric_difference(const uint16_t *a, unsigned int na, const uint16_t *b, unsigned int nb, uint16_t *out)
+{
+	unsigned int i = 0, j = 0, n = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j])
+			out[n++] = a[i++];
+		else if (a[i] > b[j])
+			out[n++] = b[j++];
+		else
+			i++, j++;
+	}
+	while (i < na)
+		out[n++] = a[i++];
+	while (j < nb)
+		out[n++] = b[j++];
+	return n;
+}
+
+/*
+ * Containers
+ */
+static fastset_container_t *
+fastset_container_new(unsigned int type, unsigned int nalloc)
+{
+	fastset_container_t *c;
+
+	c = calloc(1, sizeof(*c));
+	c->type = type;
+
+	switch (type) {
+	case FASTSET_CONTAINER_ARRAY:
+		c->nalloc = MAX(nalloc, 4);
+		c->values = malloc(c->nalloc * sizeof(c->values[0]));
+		break;
+	case FASTSET_CONTAINER_BITMAP:
+		c->nalloc = FASTSET_CHUNK_WORDS;
+		c->bitmap = calloc(FASTSET_CHUNK_WORDS, sizeof(c->bitmap[0]));
+		break;
+	case FASTSET_CONTAINER_RUN:
+		c->nalloc = MAX(nalloc, 1);
+		c->runs = malloc(c->nalloc * sizeof(c->runs[0]));
+		break;
+	}
+
+	return c;
+}
+
+static void
+fastset_container_free(fastset_container_t *c)
+{
+	free(c->data);
+	free(c);
+}
+
+/* Trim the allocation of array and run containers to their contents */
+static void
+fastset_container_shrink(fastset_container_t *c)
+{
+	switch (c->type) {
+	case FASTSET_CONTAINER_ARRAY:
+		if (c->nalloc > MAX(c->count, 4)) {
+			c->nalloc = MAX(c->count, 4);
+			c->values = realloc(c->values, c->nalloc * sizeof(c->values[0]));
+		}
+		break;
+	case FASTSET_CONTAINER_RUN:
+		if (c->nalloc > MAX(c->count, 1)) {
+			c->nalloc = MAX(c->count, 1);
+			c->runs = realloc(c->runs, c->nalloc * sizeof(c->runs[0]));
+		}
+		break;
+	}
+}
+
+static size_t
+fastset_container_memory(const fastset_container_t *c)
+{
+	size_t size = sizeof(*c);
+
+	switch (c->type) {
+	case FASTSET_CONTAINER_ARRAY:
+		return size + c->nalloc * sizeof(c->values[0]);
+	case FASTSET_CONTAINER_BITMAP:
+		return size + c->nalloc * sizeof(c->bitmap[0]);
+	case FASTSET_CONTAINER_RUN:
+		return size + c->nalloc * sizeof(c->runs[0]);
+	}
+	return size;
+}
+
+static fastset_container_t *
+fastset_container_copy(const fastset_container_t *c)
+{
+	fastset_container_t *res;
+
+	res = fastset_container_new(c->type, c->count);
+	res->cardinality = c->cardinality;
+	res->count = c->count;
+
+	switch (c->type) {
+	case FASTSET_CONTAINER_ARRAY:
+		memcpy(res->values, c->values, c->count * sizeof(c->values[0]));
+		break;
+	case FASTSET_CONTAINER_BITMAP:
+		memcpy(res->bitmap, c->bitmap, FASTSET_CHUNK_WORDS * sizeof(c->bitmap[0]));
+		break;
+	case FASTSET_CONTAINER_RUN:
+		memcpy(res->runs, c->runs, c->count * sizeof(c->runs[0]));
+		break;
+	}
+	return res;
+}
+
+/* Expand any container into a plain bitmap of FASTSET_CHUNK_WORDS words */
+static void
+fastset_container_to_words(const fastset_container_t *c, fastset_bitvec_word_t *words)
+{
+	unsigned int n;
+
+	if (c->type == FASTSET_CONTAINER_BITMAP) {
+		memcpy(words, c->bitmap, FASTSET_CHUNK_WORDS * sizeof(words[0]));
+		return;
+	}
+
+	memset(words, 0, FASTSET_CHUNK_WORDS * sizeof(words[0]));
+	if (c->type == FASTSET_CONTAINER_ARRAY) {
+		for (n = 0; n < c->count; ++n)
+			bitmap_set(words, c->values[n]);
+	} else {
+		for (n = 0; n < c->count; ++n)
+			bitmap_set_range(words, c->runs[n].start, c->runs[n].last);
+	}
+}
+
+static fastset_container_t *
+fastset_container_from_values(const uint16_t *values, unsigned int count)
+{
+	fastset_container_t *c;
+	unsigned int n;
+
+	if (count == 0)
+		return NULL;
+
+	if (count <= FASTSET_ARRAY_MAX) {
+		c = fastset_container_new(FASTSET_CONTAINER_ARRAY, count);
+		memcpy(c->values, values, count * sizeof(values[0]));
+		c->count = count;
+	} else {
+		c = fastset_container_new(FASTSET_CONTAINER_BITMAP, 0);
+		for (n = 0; n < count; ++n)
+			bitmap_set(c->bitmap, values[n]);
+	}
+
+	c->cardinality = count;
+	return c;
+}
+
+/*
+ * Given a chunk in bitmap form, create the most compact container
+ * for it. Returns NULL if the chunk is empty.
+ */
+static fastset_container_t *
+fastset_container_from_words(const fastset_bitvec_word_t *words)
+{
+	unsigned int cardinality, nruns, best;
+	fastset_container_t *c;
+
+	cardinality = fastset_bitvec_kernels->popcount(words, FASTSET_CHUNK_WORDS);
+	if (cardinality == 0)
+		return NULL;
+
+	nruns = bitmap_count_runs(words);
+
+	best = MIN(cardinality * sizeof(uint16_t), FASTSET_CHUNK_WORDS * sizeof(words[0]));
+	if (nruns * sizeof(fastset_run_t) < best) {
+		unsigned int pos = 0;
+		int start;
+
+		c = fastset_container_new(FASTSET_CONTAINER_RUN, nruns);
+		while ((start = bitmap_next(words, pos, 0)) >= 0) {
+			int end = bitmap_next(words, start, ~0ULL);
+
+			if (end < 0)
+				end = FASTSET_CHUNK_BITS;
+			c->runs[c->count].start = start;
+			c->runs[c->count].last = end - 1;
+			c->count++;
+			pos = end;
+		}
+		assert(c->count == nruns);
+	} else
+	if (cardinality <= FASTSET_ARRAY_MAX) {
+		c = fastset_container_new(FASTSET_CONTAINER_ARRAY, cardinality);
+		c->count = bitmap_extract(words, c->values);
+	} else {
+		c = fastset_container_new(FASTSET_CONTAINER_BITMAP, 0);
+		memcpy(c->bitmap, words, FASTSET_CHUNK_WORDS * sizeof(words[0]));
+	}
+
+	c->cardinality = cardinality;
+	return c;
+}
+
+/* Convert a container to array or bitmap form, in place */
+static void
+fastset_container_convert(fastset_container_t *c, unsigned int type)
+{
+	fastset_bitvec_word_t words[FASTSET_CHUNK_WORDS];
+	fastset_container_t *tmp;
+
+	if (c->type == type)
+		return;
+
+	fastset_container_to_words(c, words);
+	free(c->data);
+
+	if (type == FASTSET_CONTAINER_ARRAY) {
+		assert(c->cardinality <= FASTSET_ARRAY_MAX);
+		tmp = fastset_container_new(FASTSET_CONTAINER_ARRAY, c->cardinality);
+		c->count = bitmap_extract(words, tmp->values);
+	} else {
+		assert(type == FASTSET_CONTAINER_BITMAP);
+		tmp = fastset_container_new(FASTSET_CONTAINER_BITMAP, 0);
+		memcpy(tmp->bitmap, words, sizeof(words));
+		c->count = 0;
+	}
+
+	c->type = tmp->type;
+	c->nalloc = tmp->nalloc;
+	c->data = tmp->data;
+	free(tmp);
+}
+
+static bool
+fastset_container_test(const fastset_container_t *c, unsigned int off)
+{
+	unsigned int pos;
+
+	switch (c->type) {
+	case FASTSET_CONTAINER_ARRAY:
+		pos = array_lower_bound(c->values, c->count, off);
+		return pos < c->count && c->values[pos] == off;
+
+	case FASTSET_CONTAINER_BITMAP:
+		return bitmap_test(c->bitmap, off);
+
+	case FASTSET_CONTAINER_RUN:
+		{
+			unsigned int lo = 0, hi = c->count;
+
+			/* find the first run with last >= off */
+			while (lo < hi) {
+				unsigned int mid = (lo + hi) / 2;
+
+				if (c->runs[mid].last < off)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return lo < c->count && c->runs[lo].start <= off;
+		}
+	}
+
+	return false;
+}
+
+/* Returns true if the bit was already set */
+static bool
+fastset_container_add(fastset_container_t *c, unsigned int off)
+{
+	unsigned int pos;
+
+	if (c->type == FASTSET_CONTAINER_RUN) {
+		if (fastset_container_test(c, off))
+			return true;
+		fastset_container_convert(c, (c->cardinality < FASTSET_ARRAY_MAX)?
+				FASTSET_CONTAINER_ARRAY : FASTSET_CONTAINER_BITMAP);
+	}
+
+	if (c->type == FASTSET_CONTAINER_ARRAY) {
+		pos = array_lower_bound(c->values, c->count, off);
+		if (pos < c->count && c->values[pos] == off)
+			return true;
+
+		if (c->count < FASTSET_ARRAY_MAX) {
+			if (c->count >= c->nalloc) {
+				c->nalloc = MIN(2 * c->nalloc, FASTSET_ARRAY_MAX);
+				c->values = realloc(c->values, c->nalloc * sizeof(c->values[0]));
+			}
+			memmove(c->values + pos + 1, c->values + pos, (c->count - pos) * sizeof(c->values[0]));
+			c->values[pos] = off;
+			c->count++;
+			c->cardinality++;
+			return false;
+		}
+
+		fastset_container_convert(c, FASTSET_CONTAINER_BITMAP);
+	}
+
+	if (bitmap_test(c->bitmap, off))
+		return true;
+
+	bitmap_set(c->bitmap, off);
+	c->cardinality++;
+	return false;
+}
+
+/* Returns true if the bit was set */
+static bool
+fastset_container_remove(fastset_container_t *c, unsigned int off)
+{
+	unsigned int pos;
+
+	if (!fastset_container_test(c, off))
+		return false;
+
+	if (c->type == FASTSET_CONTAINER_RUN)
+		fastset_container_convert(c, (c->cardinality <= FASTSET_ARRAY_MAX)?
+				FASTSET_CONTAINER_ARRAY : FASTSET_CONTAINER_BITMAP);
+
+	if (c->type == FASTSET_CONTAINER_ARRAY) {
+		pos = array_lower_bound(c->values, c->count, off);
+		memmove(c->values + pos, c->values + pos + 1, (c->count - pos - 1) * sizeof(c->values[0]));
+		c->count--;
+		c->cardinality--;
+		return true;
+	}
+
+	bitmap_clear(c->bitmap, off);
+	c->cardinality--;
+
+	/* Convert back to an array only once we're well below the limit,
+	 * so that a set oscillating around the limit does not keep
+	 * converting back and forth. */
+	if (c->cardinality < FASTSET_ARRAY_MAX / 2)
+		fastset_container_convert(c, FASTSET_CONTAINER_ARRAY);
+	return true;
+}
+
+static int
+fastset_container_next(const fastset_container_t *c, unsigned int off)
+{
+	unsigned int pos;
+
+	switch (c->type) {
+	case FASTSET_CONTAINER_ARRAY:
+		pos = array_lower_bound(c->values, c->count, off);
+		if (pos < c->count)
+			return c->values[pos];
+		return -1;
+
+	case FASTSET_CONTAINER_BITMAP:
+		return bitmap_next(c->bitmap, off, 0);
+
+	case FASTSET_CONTAINER_RUN:
+		for (pos = 0; pos < c->count; ++pos) {
+			if (c->runs[pos].last >= off)
+				return MAX(c->runs[pos].start, off);
+		}
+		return -1;
+	}
+
+	return -1;
+}
+
+/*
+ * A read-only view of one chunk of a bitvec, in either representation.
+ * Runs, and partial chunks at the end of a dense vector, are expanded
+ * into a caller supplied scratch bitmap.
+ */
+enum {
+	VIEW_EMPTY,
+	VIEW_ARRAY,
+	VIEW_BITMAP,
+};
+
+typedef struct {
+	unsigned int		type;
+	unsigned int		count;
+	const uint16_t *	values;
+	const fastset_bitvec_word_t *bitmap;
+} fastset_chunk_view_t;
+
+static void
+fastset_chunk_view(const fastset_bitvec_t *vec, unsigned int k, fastset_bitvec_word_t *scratch, fastset_chunk_view_t *view)
+{
+	memset(view, 0, sizeof(*view));
+
+	if (vec->compressed) {
+		const fastset_container_t *c;
+
+		if (k >= vec->nchunks || (c = vec->chunks[k]) == NULL) {
+			view->type = VIEW_EMPTY;
+		} else
+		if (c->type == FASTSET_CONTAINER_ARRAY) {
+			view->type = VIEW_ARRAY;
+			view->values = c->values;
+			view->count = c->count;
+		} else
+		if (c->type == FASTSET_CONTAINER_BITMAP) {
+			view->type = VIEW_BITMAP;
+			view->bitmap = c->bitmap;
+		} else {
+			fastset_container_to_words(c, scratch);
+			view->type = VIEW_BITMAP;
+			view->bitmap = scratch;
+		}
+	} else {
+		unsigned int base = k * FASTSET_CHUNK_WORDS, avail;
+
+		if (base >= vec->nwords) {
+			view->type = VIEW_EMPTY;
+			return;
+		}
+
+		view->type = VIEW_BITMAP;
+		avail = vec->nwords - base;
+		if (avail >= FASTSET_CHUNK_WORDS) {
+			view->bitmap = vec->words + base;
+		} else {
+			memcpy(scratch, vec->words + base, avail * sizeof(scratch[0]));
+			memset(scratch + avail, 0, (FASTSET_CHUNK_WORDS - avail) * sizeof(scratch[0]));
+			view->bitmap = scratch;
+		}
+	}
+}
+
+static void
+fastset_chunk_view_to_words(const fastset_chunk_view_t *view, fastset_bitvec_word_t *words)
+{
+	unsigned int n;
+
+	if (view->type == VIEW_BITMAP) {
+		if (view->bitmap != words)
+			memcpy(words, view->bitmap, FASTSET_CHUNK_WORDS * sizeof(words[0]));
+		return;
+	}
+
+	memset(words, 0, FASTSET_CHUNK_WORDS * sizeof(words[0]));
+	for (n = 0; n < view->count; ++n)
+		bitmap_set(words, view->values[n]);
+}
+
+static fastset_container_t *
+fastset_chunk_view_copy(const fastset_chunk_view_t *view)
+{
+	switch (view->type) {
+	case VIEW_ARRAY:
+		return fastset_container_from_values(view->values, view->count);
+	case VIEW_BITMAP:
+		return fastset_container_from_words(view->bitmap);
+	}
+	return NULL;
+}
+
+static unsigned int
+fastset_chunk_view_filter(const fastset_chunk_view_t *array, const fastset_bitvec_word_t *bitmap, bool keep, uint16_t *out)
+{
+	unsigned int n, count = 0;
+
+	for (n = 0; n < array->count; ++n) {
+		unsigned int off = array->values[n];
+
+		if (bitmap_test(bitmap, off) == keep) {
+			if (out)
+				out[count] = off;
+			count++;
+		}
+	}
+	return count;
+}
+
+/*
+ * Combine one chunk of two bitvecs
+ */
+static fastset_container_t *
+fastset_chunk_binop(int op, const fastset_chunk_view_t *a, const fastset_chunk_view_t *b, fastset_bitvec_word_t *scratch)
+{
+	uint16_t values[2 * FASTSET_ARRAY_MAX];
+	const fastset_bitvec_kernels_t *kernels = fastset_bitvec_kernels;
+	unsigned int count, n;
+
+	if (a->type == VIEW_EMPTY || b->type == VIEW_EMPTY) {
+		switch (op) {
+		case FASTSET_OP_AND:
+			return NULL;
+		case FASTSET_OP_ANDNOT:
+			return fastset_chunk_view_copy(a);
+		default:
+			return fastset_chunk_view_copy(a->type == VIEW_EMPTY? b : a);
+		}
+	}
+
+	if (a->type == VIEW_ARRAY && b->type == VIEW_ARRAY) {
+		switch (op) {
+		case FASTSET_OP_OR:
+			count = array_union(a->values, a->count, b->values, b->count, values);
+			break;
+		case FASTSET_OP_AND:
+			count = array_intersection(a->values, a->count, b->values, b->count, values);
+			break;
+		case FASTSET_OP_ANDNOT:
+			count = array_difference(a->values, a->count, b->values, b->count, values);
+			break;
+		default:
+			count = array_symmetric_difference(a->values, a->count, b->values, b->count, values);
+			break;
+		}
+		return fastset_container_from_values(values, count);
+	}
+
+	/* From here on, at least one of the two is a bitmap */
+	if (op == FASTSET_OP_AND && a->type == VIEW_ARRAY) {
+		count = fastset_chunk_view_filter(a, b->bitmap, true, values);
+		return fastset_container_from_values(values, count);
+	}
+	if (op == FASTSET_OP_AND && b->type == VIEW_ARRAY) {
+		count = fastset_chunk_view_filter(b, a->bitmap, true, values);
+		return fastset_container_from_values(values, count);
+	}
+	if (op == FASTSET_OP_ANDNOT && a->type == VIEW_ARRAY) {
+		count = fastset_chunk_view_filter(a, b->bitmap, false, values);
+		return fastset_container_from_values(values, count);
+	}
+
+	fastset_chunk_view_to_words(a, scratch);
+	if (b->type == VIEW_BITMAP) {
+		switch (op) {
+		case FASTSET_OP_OR:
+			kernels->op_or(scratch, scratch, b->bitmap, FASTSET_CHUNK_WORDS);
+			break;
+		case FASTSET_OP_AND:
+			kernels->op_and(scratch, scratch, b->bitmap, FASTSET_CHUNK_WORDS);
+			break;
+		case FASTSET_OP_ANDNOT:
+			kernels->op_andnot(scratch, scratch, b->bitmap, FASTSET_CHUNK_WORDS);
+			break;
+		default:
+			kernels->op_xor(scratch, scratch, b->bitmap, FASTSET_CHUNK_WORDS);
+			break;
+		}
+	} else {
+		for (n = 0; n < b->count; ++n) {
+			switch (op) {
+			case FASTSET_OP_OR:
+				bitmap_set(scratch, b->values[n]);
+				break;
+			case FASTSET_OP_ANDNOT:
+				bitmap_clear(scratch, b->values[n]);
+				break;
+			default:
+				bitmap_flip(scratch, b->values[n]);
+				break;
+			}
+		}
+	}
+
+	return fastset_container_from_words(scratch);
+}
+
+static unsigned int
+fastset_chunk_intersection_count(const fastset_chunk_view_t *a, const fastset_chunk_view_t *b)
+{
+	if (a->type == VIEW_EMPTY || b->type == VIEW_EMPTY)
+		return 0;
+
+	if (a->type == VIEW_ARRAY && b->type == VIEW_ARRAY)
+		return array_intersection(a->values, a->count, b->values, b->count, NULL);
+	if (a->type == VIEW_ARRAY)
+		return fastset_chunk_view_filter(a, b->bitmap, true, NULL);
+	if (b->type == VIEW_ARRAY)
+		return fastset_chunk_view_filter(b, a->bitmap, true, NULL);
+
+	return fastset_bitvec_kernels->popcount_and(a->bitmap, b->bitmap, FASTSET_CHUNK_WORDS);
+}
+
+/*
+ * Vector level functions
+ */
+static fastset_bitvec_t *
+fastset_bitvec_chunked_new(fastset_bitvec_pool_t *pool, unsigned int max_index)
+{
+	fastset_bitvec_t *vec;
+
+	vec = fastset_bitvec_new_pooled(pool, 0);
+	vec->compressed = true;
+	vec->max_index = max_index;
+	vec->nchunks = chunks_for(max_index);
+	vec->chunks = calloc(MAX(vec->nchunks, 1), sizeof(vec->chunks[0]));
+	vec->cardinality = 0;
+	return vec;
+}
+
+static void
+fastset_bitvec_chunked_free_chunks(fastset_bitvec_t *vec, unsigned int from)
+{
+	unsigned int k;
+
+	for (k = from; k < vec->nchunks; ++k) {
+		if (vec->chunks[k]) {
+			fastset_container_free(vec->chunks[k]);
+			vec->chunks[k] = NULL;
+		}
+	}
+}
+
+/*
+ * Release all storage of a compressed bitvec and return it to the
+ * (empty) dense representation.
+ */
+void
+fastset_bitvec_chunked_destroy(fastset_bitvec_t *vec)
+{
+	assert(vec->compressed);
+
+	fastset_bitvec_chunked_free_chunks(vec, 0);
+	free(vec->chunks);
+	vec->chunks = NULL;
+	vec->nchunks = 0;
+	vec->compressed = false;
+	vec->max_index = 0;
+	vec->cardinality = 0;
+}
+
+size_t
+fastset_bitvec_memory(const fastset_bitvec_t *vec)
+{
+	size_t size = sizeof(*vec);
+	unsigned int k;
+
+	/* Embedded vectors and their inline words are part of the set object */
+	if (fastset_bitvec_is_embedded(vec))
+		size = 0;
+
+	if (!vec->compressed) {
+		if (vec->words == vec->inline_words)
+			return size;
+		return size + vec->nalloc * sizeof(vec->words[0]);
+	}
+
+	size += vec->nchunks * sizeof(vec->chunks[0]);
+	for (k = 0; k < vec->nchunks; ++k) {
+		if (vec->chunks[k])
+			size += fastset_container_memory(vec->chunks[k]);
+	}
+	return size;
+}
+
+void
+fastset_bitvec_compress(fastset_bitvec_t *vec)
+{
+	fastset_bitvec_word_t scratch[FASTSET_CHUNK_WORDS];
+	unsigned int k, cardinality = 0;
+	fastset_container_t **chunks;
+	unsigned int nchunks;
+
+	if (vec->compressed)
+		return;
+
+	nchunks = chunks_for(vec->max_index);
+	chunks = calloc(MAX(nchunks, 1), sizeof(chunks[0]));
+
+	for (k = 0; k < nchunks; ++k) {
+		fastset_chunk_view_t view;
+
+		fastset_chunk_view(vec, k, scratch, &view);
+		if (view.type != VIEW_EMPTY && (chunks[k] = fastset_container_from_words(view.bitmap)) != NULL)
+			cardinality += chunks[k]->cardinality;
+	}
+
+	fastset_bitvec_free_words(vec);
+
+	vec->compressed = true;
+	vec->chunks = chunks;
+	vec->nchunks = nchunks;
+	vec->cardinality = cardinality;
+}
+
+void
+fastset_bitvec_decompress(fastset_bitvec_t *vec)
+{
+	fastset_bitvec_word_t scratch[FASTSET_CHUNK_WORDS];
+	unsigned int max_index, nwords, k;
+	fastset_bitvec_word_t *words = NULL;
+	int cardinality;
+
+	if (!vec->compressed)
+		return;
+
+	max_index = vec->max_index;
+	nwords = max_index? max_index / 64 + 1 : 0;
+	if (nwords) {
+		words = fastset_bitvec_pool_get_words(vec->pool, nwords);
+		memset(words, 0, nwords * sizeof(words[0]));
+	}
+
+	for (k = 0; k < vec->nchunks; ++k) {
+		const fastset_container_t *c = vec->chunks[k];
+		unsigned int base = k * FASTSET_CHUNK_WORDS;
+
+		if (c == NULL)
+			continue;
+
+		if (base + FASTSET_CHUNK_WORDS <= nwords) {
+			fastset_container_to_words(c, words + base);
+		} else {
+			fastset_container_to_words(c, scratch);
+			memcpy(words + base, scratch, (nwords - base) * sizeof(words[0]));
+		}
+	}
+
+	cardinality = vec->cardinality;
+	fastset_bitvec_chunked_destroy(vec);
+
+	vec->words = words;
+	vec->nwords = vec->nalloc = nwords;
+	vec->max_index = max_index;
+	vec->cardinality = cardinality;
+}
+
+/*
+ * Decide whether a bitvec with the given size and number of members
+ * is better off in compressed form. Vectors that fit into a single
+ * chunk are always kept dense.
+ */
+bool
+fastset_bitvec_want_compressed(unsigned int max_index, unsigned int cardinality, bool compressed)
+{
+	unsigned int nwords = max_index / 64 + 1;
+
+	if (max_index <= FASTSET_CHUNK_BITS)
+		return false;
+
+	/* Array containers take 2 bytes per member, the dense form 8 bytes per
+	 * word. Compress once that saves at least half the memory, and use
+	 * some hysteresis when going back. */
+	if (compressed)
+		return cardinality < 4 * nwords;
+	return cardinality < 2 * nwords;
+}
+
+/*
+ * Switch to the better representation. We only look at vectors whose
+ * cardinality is known; counting the bits just for this would cost us
+ * a full pass over the vector.
+ */
+void
+fastset_bitvec_optimize(fastset_bitvec_t *vec)
+{
+	bool want;
+
+	/* Don't touch vectors that are shared copy-on-write */
+	if (vec->cardinality < 0 || vec->refcount > 1)
+		return;
+
+	want = fastset_bitvec_want_compressed(vec->max_index, vec->cardinality, vec->compressed);
+	if (want && !vec->compressed)
+		fastset_bitvec_compress(vec);
+	else if (!want && vec->compressed)
+		fastset_bitvec_decompress(vec);
+}
+
+fastset_bitvec_t *
+fastset_bitvec_chunked_copy(const fastset_bitvec_t *arg)
+{
+	fastset_bitvec_t *res;
+	unsigned int k;
+
+	res = fastset_bitvec_chunked_new(arg->pool, arg->max_index);
+	for (k = 0; k < arg->nchunks; ++k) {
+		if (arg->chunks[k])
+			res->chunks[k] = fastset_container_copy(arg->chunks[k]);
+	}
+	res->cardinality = arg->cardinality;
+	return res;
+}
+
+void
+fastset_bitvec_chunked_resize(fastset_bitvec_t *vec, unsigned int max_index)
+{
+	unsigned int nchunks = chunks_for(max_index);
+	unsigned int k;
+
+	if (nchunks > vec->nchunks) {
+		vec->chunks = realloc(vec->chunks, nchunks * sizeof(vec->chunks[0]));
+		for (k = vec->nchunks; k < nchunks; ++k)
+			vec->chunks[k] = NULL;
+	} else if (max_index < vec->max_index) {
+		fastset_container_t *c;
+
+		fastset_bitvec_chunked_free_chunks(vec, nchunks);
+
+		/* Drop any bits beyond max_index from the last chunk */
+		if (nchunks && offset_of(max_index) && (c = vec->chunks[nchunks - 1]) != NULL) {
+			fastset_bitvec_word_t words[FASTSET_CHUNK_WORDS];
+			unsigned int off = offset_of(max_index);
+
+			fastset_container_to_words(c, words);
+			words[off / 64] &= (1ULL << (off % 64)) - 1;
+			memset(words + off / 64 + 1, 0, (FASTSET_CHUNK_WORDS - off / 64 - 1) * sizeof(words[0]));
+
+			fastset_container_free(c);
+			vec->chunks[nchunks - 1] = fastset_container_from_words(words);
+		}
+
+		vec->cardinality = 0;
+		for (k = 0; k < nchunks; ++k) {
+			if (vec->chunks[k])
+				vec->cardinality += vec->chunks[k]->cardinality;
+		}
+	}
+
+	vec->nchunks = nchunks;
+	vec->max_index = max_index;
+}
+
+void
+fastset_bitvec_chunked_shrink(fastset_bitvec_t *vec)
+{
+	unsigned int k;
+
+	for (k = 0; k < vec->nchunks; ++k) {
+		if (vec->chunks[k])
+			fastset_container_shrink(vec->chunks[k]);
+	}
+}
+
+bool
+fastset_bitvec_chunked_test(const fastset_bitvec_t *vec, unsigned int i)
+{
+	const fastset_container_t *c;
+
+	if (i >= vec->max_index || (c = vec->chunks[chunk_of(i)]) == NULL)
+		return false;
+
+	return fastset_container_test(c, offset_of(i));
+}
+
+/* The caller is responsible for resizing the vector if needed */
+bool
+fastset_bitvec_chunked_set(fastset_bitvec_t *vec, unsigned int i)
+{
+	fastset_container_t *c;
+
+	assert(i < vec->max_index);
+	if ((c = vec->chunks[chunk_of(i)]) == NULL)
+		c = vec->chunks[chunk_of(i)] = fastset_container_new(FASTSET_CONTAINER_ARRAY, 0);
+
+	if (fastset_container_add(c, offset_of(i)))
+		return true;
+
+	vec->cardinality++;
+	return false;
+}
+
+bool
+fastset_bitvec_chunked_clear(fastset_bitvec_t *vec, unsigned int i)
+{
+	fastset_container_t *c;
+
+	if (i >= vec->max_index || (c = vec->chunks[chunk_of(i)]) == NULL)
+		return false;
+
+	if (!fastset_container_remove(c, offset_of(i)))
+		return false;
+
+	if (c->cardinality == 0) {
+		fastset_container_free(c);
+		vec->chunks[chunk_of(i)] = NULL;
+	}
+
+	vec->cardinality--;
+	return true;
+}
+
+int
+fastset_bitvec_chunked_find_next_bit(const fastset_bitvec_t *vec, unsigned int from_index)
+{
+	unsigned int k, off;
+
+	if (from_index >= vec->max_index)
+		return -1;
+
+	off = offset_of(from_index);
+	for (k = chunk_of(from_index); k < vec->nchunks; ++k, off = 0) {
+		const fastset_container_t *c = vec->chunks[k];
+		int next;
+
+		if (c && (next = fastset_container_next(c, off)) >= 0)
+			return (k << FASTSET_CHUNK_SHIFT) + next;
+	}
+
+	return -1;
+}
+
+/*
+ * Decode the members of one container, starting at offset off
+ */
+static unsigned int
+fastset_container_extract(const fastset_container_t *c, unsigned int off, uint32_t base, uint32_t *out, unsigned int max)
+{
+	unsigned int pos, n = 0;
+
+	switch (c->type) {
+	case FASTSET_CONTAINER_ARRAY:
+		for (pos = array_lower_bound(c->values, c->count, off); pos < c->count && n < max; ++pos)
+			out[n++] = base + c->values[pos];
+		break;
+
+	case FASTSET_CONTAINER_BITMAP:
+		n = fastset_bitvec_words_extract(c->bitmap, FASTSET_CHUNK_WORDS, off, base, out, max);
+		break;
+
+	case FASTSET_CONTAINER_RUN:
+		for (pos = 0; pos < c->count && n < max; ++pos) {
+			unsigned int i;
+
+			if (c->runs[pos].last < off)
+				continue;
+			for (i = MAX(c->runs[pos].start, off); i <= c->runs[pos].last && n < max; ++i)
+				out[n++] = base + i;
+		}
+		break;
+	}
+
+	return n;
+}
+
+unsigned int
+fastset_bitvec_chunked_extract(const fastset_bitvec_t *vec, unsigned int from_index, uint32_t *out, unsigned int max)
+{
+	unsigned int k, off, n = 0;
+
+	off = offset_of(from_index);
+	for (k = chunk_of(from_index); k < vec->nchunks && n < max; ++k, off = 0) {
+		const fastset_container_t *c = vec->chunks[k];
+
+		if (c)
+			n += fastset_container_extract(c, off, k << FASTSET_CHUNK_SHIFT, out + n, max - n);
+	}
+
+	return n;
+}
+
+/*
+ * Perform a set operation on two bitvecs, at least one of which is
+ * compressed. The result is always compressed; the caller may want to
+ * optimize it afterwards.
+ */
+fastset_bitvec_t *
+fastset_bitvec_chunked_binop(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2, int op)
+{
+	fastset_bitvec_word_t scratch1[FASTSET_CHUNK_WORDS], scratch2[FASTSET_CHUNK_WORDS];
+	fastset_bitvec_word_t scratch[FASTSET_CHUNK_WORDS];
+	unsigned int max_index, k;
+	fastset_bitvec_t *res;
+
+	switch (op) {
+	case FASTSET_OP_AND:
+		max_index = MIN(arg1->max_index, arg2->max_index);
+		break;
+	case FASTSET_OP_ANDNOT:
+		max_index = arg1->max_index;
+		break;
+	default:
+		max_index = MAX(arg1->max_index, arg2->max_index);
+		break;
+	}
+
+	res = fastset_bitvec_chunked_new(arg1->pool, max_index);
+	for (k = 0; k < res->nchunks; ++k) {
+		fastset_chunk_view_t view1, view2;
+		fastset_container_t *c;
+
+		fastset_chunk_view(arg1, k, scratch1, &view1);
+		fastset_chunk_view(arg2, k, scratch2, &view2);
+
+		if ((c = fastset_chunk_binop(op, &view1, &view2, scratch)) != NULL) {
+			res->chunks[k] = c;
+			res->cardinality += c->cardinality;
+		}
+	}
+
+	return res;
+}
+
+unsigned int
+fastset_bitvec_chunked_intersection_count(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2)
+{
+	fastset_bitvec_word_t scratch1[FASTSET_CHUNK_WORDS], scratch2[FASTSET_CHUNK_WORDS];
+	unsigned int k, nchunks, result = 0;
+
+	nchunks = chunks_for(MIN(arg1->max_index, arg2->max_index));
+	for (k = 0; k < nchunks; ++k) {
+		fastset_chunk_view_t view1, view2;
+
+		fastset_chunk_view(arg1, k, scratch1, &view1);
+		fastset_chunk_view(arg2, k, scratch2, &view2);
+		result += fastset_chunk_intersection_count(&view1, &view2);
+	}
+
+	return result;
+}
@@ -27,6 +27,42 @@ static PyObject *	Fastset_newDomain(PyTypeObject *type, PyObject *args, PyObject
 static int		Fastset_initDomain(fastset_Domain *self, PyObject *args, PyObject *kwds);
 static void		Fastset_deallocDomain(fastset_Domain *self);
 static PyObject *	Fastset_getDomainName(fastset_Domain *self, void *closure);
+static PyObject *	FastsetDomain_allocator_stats(fastset_Domain *self, PyObject *args, PyObject *kwds);
+static PyObject *	FastsetDomain_union_all(fastset_Domain *self, PyObject *arg);
+static PyObject *	FastsetDomain_intersection_all(fastset_Domain *self, PyObject *arg);
+static PyObject *	FastsetDomain_universe(fastset_Domain *self, PyObject *unused);
+static PyObject *	FastsetDomain_create_members(fastset_Domain *self, PyObject *args, PyObject *kwds);
+static PyObject *	FastsetDomain_bulk_register(fastset_Domain *self, PyObject *arg);
+static PyObject *	FastsetDomain_remove(fastset_Domain *self, PyObject *arg);
+static PyObject *	FastsetDomain_compact(fastset_Domain *self, PyObject *unused);
+
+static PyMethodDef	fastset_domainMethods[] = {
+      { "allocator_stats", (PyCFunction) FastsetDomain_allocator_stats, METH_VARARGS | METH_KEYWORDS,
+        "return statistics of the domain's bitvec allocator"
+      },
+      { "union_all", (PyCFunction) FastsetDomain_union_all, METH_O,
+        "compute the union of all sets of an iterable"
+      },
+      { "intersection_all", (PyCFunction) FastsetDomain_intersection_all, METH_O,
+        "compute the intersection of all sets of an iterable"
+      },
+      { "universe", (PyCFunction) FastsetDomain_universe, METH_NOARGS,
+        "return the set of all members of the domain"
+      },
+      { "create_members", (PyCFunction) FastsetDomain_create_members, METH_VARARGS | METH_KEYWORDS,
+        "create and register a number of members, without calling their constructor"
+      },
+      { "bulk_register", (PyCFunction) FastsetDomain_bulk_register, METH_O,
+        "register all members of an iterable that are not registered yet"
+      },
+      { "remove", (PyCFunction) FastsetDomain_remove, METH_O,
+        "unregister a member, so that its index can be reused"
+      },
+      { "compact", (PyCFunction) FastsetDomain_compact, METH_NOARGS,
+        "renumber the domain's members densely, and remap all of its sets"
+      },
+      { NULL, }
+};
 
 static PyMemberDef	domain_TypeMembers[] = {
 	{ "set", T_OBJECT_EX, offsetof(fastset_Domain, set_class), READONLY, },
@@ -54,6 +90,10 @@ fastset_DSTAlloc(fastset_Domain *domain, const PyTypeObject *typeTemplate, const
 	newType = &dst->base;
 	*newType = *typeTemplate;
 
+	/* Set objects carry their bitvec words inline */
+	if (typeTemplate == &fastset_SetTypeTemplate)
+		newType->tp_basicsize += domain->inline_words * sizeof(fastset_bitvec_word_t);
+
 	asprintf((char **) &newType->tp_name, "%s.%s", domainName, typeName);
 	asprintf((char **) &newType->tp_doc, "%s class for fastset domain %s", typeName, domainName);
 
@@ -73,7 +113,7 @@ PyTypeObject	fastset_DomainType = {
 	.tp_flags	= Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
 	.tp_doc		= NULL,
 
-//	.tp_methods	= fastset_memberMethods,
+	.tp_methods	= fastset_domainMethods,
 	.tp_init	= (initproc) Fastset_initDomain,
 	.tp_new		= Fastset_newDomain,
 	.tp_dealloc	= (destructor) Fastset_deallocDomain,
@@ -89,11 +129,9 @@ fastset_CreateMemberClass(fastset_Domain *domain)
 }
 
 static const fastset_DomainSpecificType *
-Fastset_DSTGetType(PyObject *obj)
+Fastset_DSTWalkType(PyTypeObject *type)
 {
-	PyTypeObject *type;
-
-	for (type = obj->ob_type; type; type = type->tp_base) {
+	for (; type; type = type->tp_base) {
 		fastset_DomainSpecificType *dst = (fastset_DomainSpecificType *) type;
 
 		if (dst->magic == FASTSET_DST_MAGIC)
@@ -103,6 +141,62 @@ Fastset_DSTGetType(PyObject *obj)
 	return NULL;
 }
 
+/*
+ * Walking the base classes for every member test is expensive, so we
+ * cache the outcome per type. Entries hold a reference to their type,
+ * so that its address cannot be reused by a different type while it
+ * is in the cache. Assigning to __bases__ of a cached type is not
+ * supported.
+ */
+static struct fastset_type_cache_entry {
+	PyTypeObject *	type;
+	const fastset_DomainSpecificType *dst;
+} fastset_typeCache[FASTSET_TYPE_CACHE_SIZE];
+
+const fastset_DomainSpecificType *
+Fastset_DSTFindType(PyTypeObject *type)
+{
+	struct fastset_type_cache_entry *entry;
+	const fastset_DomainSpecificType *dst;
+	PyTypeObject *evicted;
+
+	entry = &fastset_typeCache[((uintptr_t) type / sizeof(PyTypeObject)) % FASTSET_TYPE_CACHE_SIZE];
+	if (entry->type == type)
+		return entry->dst;
+
+	dst = Fastset_DSTWalkType(type);
+
+	/* Update the entry before releasing the old type, which may
+	 * be freed */
+	evicted = entry->type;
+	Py_INCREF(type);
+	entry->type = type;
+	entry->dst = dst;
+	Py_XDECREF(evicted);
+
+	return dst;
+}
+
+static const fastset_DomainSpecificType *
+Fastset_DSTGetType(PyObject *obj)
+{
+	return Fastset_DSTFindType(obj->ob_type);
+}
+
+/*
+ * Same as Fastset_DSTGetDomain, but for a type object. Does not raise
+ * an exception.
+ */
+fastset_Domain *
+Fastset_DSTGetTypeDomain(PyTypeObject *type)
+{
+	const fastset_DomainSpecificType *dst;
+
+	if ((dst = Fastset_DSTFindType(type)) != NULL)
+		return dst->domain;
+	return NULL;
+}
+
 fastset_Domain *
 Fastset_DSTGetDomain(PyObject *obj)
 {
@@ -140,6 +234,10 @@ Fastset_newDomain(PyTypeObject *type, PyObject *args, PyObject *kwds)
 	self->size = 0;
 	self->domain_objects = NULL;
 
+	fastset_bitvec_pool_init(&self->pool);
+	self->live = fastset_bitvec_new_pooled(&self->pool, 0);
+	self->dead = fastset_bitvec_new_pooled(&self->pool, 0);
+
 	return (PyObject *) self;
 }
 
@@ -148,13 +246,20 @@ Fastset_initDomain(fastset_Domain *self, PyObject *args, PyObject *kwds)
 {
 	static char *kwlist[] = {
 		"name",
+		"inline_size",
 		NULL
 	};
 	char *domain_name = NULL;
+	unsigned int inline_size = FASTSET_INLINE_SIZE_DEFAULT;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &domain_name))
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|I", kwlist, &domain_name, &inline_size))
 		return -1;
 
+	/* Sets of domains with up to inline_size members keep their
+	 * bits in the set object itself */
+	if (inline_size)
+		self->inline_words = inline_size / 64 + 1;
+
 	self->name = strdup(domain_name);
 	self->member_class = fastset_DSTAlloc(self, &fastset_MemberTypeTemplate, "member");
 	self->set_class = fastset_DSTAlloc(self, &fastset_SetTypeTemplate, "set");
@@ -170,6 +275,8 @@ Fastset_deallocDomain(fastset_Domain *self)
 		self->name = NULL;
 	}
 
+	Fastset_clearFreeSets(self);
+
 	Py_CLEAR(self->member_class);
 	Py_CLEAR(self->set_class);
 
@@ -185,43 +292,85 @@ Fastset_deallocDomain(fastset_Domain *self)
 		self->count = 0;
 		self->size = 0;
 	}
+
+	free(self->free_slots);
+	self->free_slots = NULL;
+	self->nfree_slots = 0;
+	free(self->slot_generation);
+	self->slot_generation = NULL;
+	self->nalloc = 0;
+
+	if (self->live)
+		fastset_bitvec_drop(&self->live);
+	if (self->dead)
+		fastset_bitvec_drop(&self->dead);
+	fastset_bitvec_pool_destroy(&self->pool);
+}
+
+/*
+ * Universe sets may share the live mask, so unshare it before changing it
+ */
+static inline fastset_bitvec_t *
+FastsetDomain_writableLive(fastset_Domain *self)
+{
+	return self->live = fastset_bitvec_unshare(self->live);
 }
 
+/*
+ * Make room for size members. The array grows geometrically, so that
+ * registering members one by one takes amortized constant time.
+ */
 void
-FastsetDomain_register(fastset_Domain *self, fastset_Member *member)
+FastsetDomain_reserve(fastset_Domain *self, unsigned int size)
 {
-	int slot = -1;
+	unsigned int nalloc;
+	PyObject **new_array;
+	unsigned int *new_slots;
+	unsigned long *new_generation;
 
-	if (self->count < self->size) {
-		unsigned int i;
+	if (size <= self->nalloc)
+		return;
 
-		for (i = 0; i < self->size; ++i) {
-			if (self->domain_objects[i] == NULL) {
-				slot = i;
-				break;
-			}
-		}
-	}
+	nalloc = self->nalloc? 2 * self->nalloc : 16;
+	if (nalloc < size)
+		nalloc = size;
 
-	if (slot < 0) {
-		static const unsigned int chunk_size = 16;
+	new_array = realloc(self->domain_objects, nalloc * sizeof(new_array[0]));
+	if (new_array == NULL)
+		abort();
+	self->domain_objects = new_array;
 
-		/* allocate array space in chunks */
-		if ((self->size % chunk_size) == 0) {
-			unsigned int nalloc = self->size + chunk_size;
-			PyObject **new_array;
+	new_slots = realloc(self->free_slots, nalloc * sizeof(new_slots[0]));
+	if (new_slots == NULL)
+		abort();
+	self->free_slots = new_slots;
 
-			new_array = realloc(self->domain_objects, nalloc * sizeof(new_array[0]));
-			if (new_array == NULL)
-				abort();
-			self->domain_objects = new_array;
-		}
+	new_generation = realloc(self->slot_generation, nalloc * sizeof(new_generation[0]));
+	if (new_generation == NULL)
+		abort();
+	memset(new_generation + self->nalloc, 0, (nalloc - self->nalloc) * sizeof(new_generation[0]));
+	self->slot_generation = new_generation;
+
+	self->nalloc = nalloc;
+	fastset_bitvec_reserve(FastsetDomain_writableLive(self), nalloc);
+}
+
+void
+FastsetDomain_register(fastset_Domain *self, fastset_Member *member)
+{
+	unsigned int slot;
 
+	/* Reuse the slot freed most recently, if any */
+	if (self->nfree_slots) {
+		slot = self->free_slots[--(self->nfree_slots)];
+	} else {
+		FastsetDomain_reserve(self, self->size + 1);
 		slot = self->size++;
 	}
 
 	self->domain_objects[slot] = (PyObject *) member;
 	Py_INCREF(member);
+	fastset_bitvec_set(FastsetDomain_writableLive(self), slot);
 
 	self->count += 1;
 
@@ -239,31 +388,110 @@ FastsetDomain_unregister(fastset_Domain *self, fastset_Member *member)
 	assert(self->domain_objects[member->index] == (PyObject *) member);
 
 	self->domain_objects[member->index] = NULL;
+	fastset_bitvec_clear(FastsetDomain_writableLive(self), member->index);
+	self->free_slots[self->nfree_slots++] = member->index;
+
+	/* Sets still holding the slot's bit clear it when they are next
+	 * used. Once the dead mask grows too large, start over; sets older
+	 * than that scan their own bits instead. */
+	if (self->ndead >= FASTSET_DEAD_MAX) {
+		fastset_bitvec_resize(self->dead, 0);
+		self->dead_since = self->generation;
+		self->ndead = 0;
+	}
+
+	self->generation += 1;
+	self->slot_generation[member->index] = self->generation;
+	if (!fastset_bitvec_set(self->dead, member->index))
+		self->ndead += 1;
+
 	member->index = -1;
 
 	self->count -= 1;
 }
 
-int
-FastsetDomain_Check(PyObject *ob)
+/*
+ * Add an object that keeps data per slot to one of the domain's lists,
+ * so that compact() can renumber it. The lists do not hold references.
+ */
+void
+FastsetDomain_link(fastset_Domain *self, fastset_DomainLink **list, fastset_DomainLink *link)
 {
-	return PyType_IsSubtype(Py_TYPE(ob), &fastset_DomainType);
+	if ((link->next = *list) != NULL)
+		link->next->prev = &link->next;
+	link->prev = list;
+	*list = link;
+
+	link->generation = self->generation;
 }
 
-bool
-FastsetDomain_IsMember(fastset_Domain *self, PyObject *object)
+void
+FastsetDomain_unlink(fastset_DomainLink *link)
 {
-	const fastset_DomainSpecificType *dst;
+	if (link->prev == NULL)
+		return;
 
-	return ((dst = Fastset_DSTGetType(object)) != NULL && &dst->base == self->member_class);
+	if (link->next)
+		link->next->prev = link->prev;
+	*(link->prev) = link->next;
+	link->next = NULL;
+	link->prev = NULL;
 }
 
-bool
-FastsetDomain_IsSet(fastset_Domain *self, PyObject *object)
+static inline void
+FastsetDomain_markSlot(fastset_bitvec_word_t **mask_p, unsigned int nslots, unsigned int index)
 {
-	const fastset_DomainSpecificType *dst;
+	if (*mask_p == NULL && !(*mask_p = calloc((nslots + 63) / 64, sizeof(fastset_bitvec_word_t))))
+		abort();
+	(*mask_p)[index / 64] |= (fastset_bitvec_word_t) 1 << (index % 64);
+}
+
+/*
+ * Objects that keep data per slot drop the data of members unregistered
+ * since they were last used, as their slots may belong to different
+ * members by now. Return a mask of those among the first nslots slots,
+ * or NULL if there are none, and mark the owner of link as scrubbed.
+ * The caller must free the mask.
+ */
+fastset_bitvec_word_t *
+FastsetDomain_changedSlots(fastset_Domain *self, fastset_DomainLink *link, unsigned int nslots)
+{
+	fastset_bitvec_word_t *mask = NULL;
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int index = 0, count, i, limit;
 
-	return ((dst = Fastset_DSTGetType(object)) != NULL && &dst->base == self->set_class);
+	if (link->generation == self->generation)
+		return NULL;
+
+	/* The mask covers all of nslots, but only slots below size change */
+	limit = (nslots < self->size)? nslots : self->size;
+
+	/* If the dead mask goes back far enough, only look at its slots */
+	if (link->generation >= self->dead_since) {
+		while ((count = fastset_bitvec_extract(self->dead, index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+			for (i = 0; i < count && indexes[i] < limit; ++i) {
+				if (FastsetDomain_slotChanged(self, indexes[i], link->generation))
+					FastsetDomain_markSlot(&mask, nslots, indexes[i]);
+			}
+			if (i < count)
+				break;
+			index = indexes[count - 1] + 1;
+		}
+	} else {
+		for (i = 0; i < limit; ++i) {
+			if (FastsetDomain_slotChanged(self, i, link->generation))
+				FastsetDomain_markSlot(&mask, nslots, i);
+		}
+	}
+
+	link->generation = self->generation;
+	return mask;
+}
+
+int
+FastsetDomain_Check(PyObject *ob)
+{
+	return PyType_IsSubtype(Py_TYPE(ob), &fastset_DomainType);
 }
 
 PyObject *
@@ -281,3 +509,262 @@ Fastset_getDomainName(fastset_Domain *self, void *closure)
 {
 	return PyUnicode_FromString(self->name);
 }
+
+static bool
+Fastset_addStat(PyObject *dict, const char *name, unsigned long value)
+{
+	PyObject *obj;
+	int rv;
+
+	if (!(obj = PyLong_FromUnsignedLong(value)))
+		return false;
+	rv = PyDict_SetItemString(dict, name, obj);
+	Py_DECREF(obj);
+	return rv == 0;
+}
+
+/*
+ * Report how well the domain's bitvec allocator recycles memory
+ */
+static PyObject *
+FastsetDomain_allocator_stats(fastset_Domain *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = { NULL };
+	const fastset_bitvec_pool_t *pool = &self->pool;
+	unsigned long cached_words = 0;
+	PyObject *result;
+	unsigned int k;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "", kwlist))
+		return NULL;
+
+	for (k = 0; k < FASTSET_POOL_CLASSES; ++k)
+		cached_words += pool->classes[k].count;
+
+	if (!(result = PyDict_New()))
+		return NULL;
+
+	if (!Fastset_addStat(result, "words_hits", pool->stats.words_hits)
+	 || !Fastset_addStat(result, "words_misses", pool->stats.words_misses)
+	 || !Fastset_addStat(result, "words_released", pool->stats.words_released)
+	 || !Fastset_addStat(result, "words_cached", cached_words)
+	 || !Fastset_addStat(result, "headers_hits", pool->stats.headers_hits)
+	 || !Fastset_addStat(result, "headers_misses", pool->stats.headers_misses)
+	 || !Fastset_addStat(result, "headers_released", pool->stats.headers_released)
+	 || !Fastset_addStat(result, "headers_cached", pool->nfree_headers)
+	 || !Fastset_addStat(result, "cached_bytes", pool->cached_bytes)) {
+		Py_DECREF(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+static PyObject *
+FastsetDomain_union_all(fastset_Domain *self, PyObject *arg)
+{
+	return Fastset_combineAll(self, arg, FASTSET_OP_OR);
+}
+
+static PyObject *
+FastsetDomain_intersection_all(fastset_Domain *self, PyObject *arg)
+{
+	return Fastset_combineAll(self, arg, FASTSET_OP_AND);
+}
+
+static PyObject *
+FastsetDomain_universe(fastset_Domain *self, PyObject *unused)
+{
+	return Fastset_universe(self);
+}
+
+/*
+ * Domain.create_members(count, type = None): create count members of the
+ * domain's member class, or the given subclass of it, and register them.
+ * The members are created by the type's tp_new; their __init__ is not
+ * called.
+ */
+static PyObject *
+FastsetDomain_create_members(fastset_Domain *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {
+		"count",
+		"type",
+		NULL
+	};
+	PyTypeObject *type = NULL;
+	PyObject *noargs, *result;
+	unsigned int count, i;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "I|O!", kwlist, &count, &PyType_Type, &type))
+		return NULL;
+
+	if (type == NULL)
+		type = self->member_class;
+	else if (!PyType_IsSubtype(type, self->member_class)) {
+		PyErr_SetString(PyExc_TypeError, "type is not a member class of this domain");
+		return NULL;
+	}
+
+	if (!(result = PyList_New(count)))
+		return NULL;
+
+	if (!(noargs = PyTuple_New(0))) {
+		Py_DECREF(result);
+		return NULL;
+	}
+
+	FastsetDomain_reserve(self, self->size + count);
+
+	for (i = 0; i < count; ++i) {
+		fastset_Member *member;
+
+		if (!(member = (fastset_Member *) type->tp_new(type, noargs, NULL))) {
+			Py_CLEAR(result);
+			break;
+		}
+
+		Py_INCREF(self);
+		member->domain = self;
+		FastsetDomain_register(self, member);
+
+		PyList_SET_ITEM(result, i, (PyObject *) member);
+	}
+
+	Py_DECREF(noargs);
+	return result;
+}
+
+/*
+ * Domain.bulk_register(iterable): register members that were created
+ * without running the member constructor, eg by cls.__new__(cls)
+ */
+static PyObject *
+FastsetDomain_bulk_register(fastset_Domain *self, PyObject *arg)
+{
+	PyObject *iter, *item;
+	Py_ssize_t hint;
+
+	if ((hint = PyObject_LengthHint(arg, 0)) < 0)
+		return NULL;
+
+	if (!(iter = PyObject_GetIter(arg)))
+		return NULL;
+
+	FastsetDomain_reserve(self, self->size + hint);
+
+	while ((item = PyIter_Next(iter)) != NULL) {
+		fastset_Member *member = (fastset_Member *) item;
+
+		if (!FastsetDomain_IsMember(self, item)) {
+			PyErr_SetString(PyExc_RuntimeError, "argument is not compatible with domain");
+			Py_DECREF(item);
+			break;
+		}
+
+		if (member->domain == NULL) {
+			Py_INCREF(self);
+			member->domain = self;
+		}
+
+		if (member->index < 0)
+			FastsetDomain_register(self, member);
+		Py_DECREF(item);
+	}
+
+	Py_DECREF(iter);
+	if (PyErr_Occurred())
+		return NULL;
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/*
+ * Unregister a member and drop the domain's reference to it. Sets that
+ * contain the member lose it the next time they are used, and its index
+ * is handed to the next member registered.
+ */
+static PyObject *
+FastsetDomain_remove(fastset_Domain *self, PyObject *arg)
+{
+	fastset_Member *member = (fastset_Member *) arg;
+
+	if (!FastsetDomain_IsMember(self, arg)) {
+		PyErr_SetString(PyExc_RuntimeError, "argument is not compatible with domain");
+		return NULL;
+	}
+
+	if (member->index < 0 || FastsetDomain_GetMember(self, member->index) != arg) {
+		PyErr_SetObject(PyExc_KeyError, arg);
+		return NULL;
+	}
+
+	FastsetDomain_unregister(self, member);
+	Py_DECREF(member);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/*
+ * Renumber all members so that they occupy slots 0 to count - 1, keeping
+ * their order, and remap all sets, transforms, relations, set arrays and
+ * set indexes of the domain to match. Returns the number of slots reclaimed.
+ */
+static PyObject *
+FastsetDomain_compact(fastset_Domain *self, PyObject *unused)
+{
+	fastset_bitvec_transform_t *trans;
+	fastset_bitvec_t *live;
+	unsigned int i, slot, reclaimed;
+
+	if ((reclaimed = self->size - self->count) == 0)
+		return PyLong_FromUnsignedLong(0);
+
+	trans = fastset_bitvec_transform_new(self->size);
+	for (i = slot = 0; i < self->size; ++i) {
+		if (self->domain_objects[i] != NULL)
+			fastset_bitvec_transform_add(trans, i, slot++);
+	}
+
+	/* This has to happen first, as scrubbing the sets needs the
+	 * old slot generations */
+	Fastset_remapAll(self, trans);
+	FastsetTransform_remapAll(self, trans);
+	FastsetRelation_remapAll(self, trans);
+	FastsetSetArray_remapAll(self, trans);
+	FastsetSetIndex_remapAll(self, trans);
+
+	/* Slots only ever move down, so we can do this in place */
+	for (i = 0; i < self->size; ++i) {
+		fastset_Member *member = (fastset_Member *) self->domain_objects[i];
+
+		if (member == NULL)
+			continue;
+
+		member->index = trans->mapping[i];
+		self->domain_objects[member->index] = (PyObject *) member;
+	}
+
+	fastset_bitvec_transform_free(trans);
+
+	self->size = self->count;
+	self->nfree_slots = 0;
+
+	live = FastsetDomain_writableLive(self);
+	fastset_bitvec_resize(live, 0);
+	for (i = 0; i < self->size; ++i)
+		fastset_bitvec_set(live, i);
+
+	/* All sets have just been scrubbed */
+	memset(self->slot_generation, 0, self->nalloc * sizeof(self->slot_generation[0]));
+	fastset_bitvec_resize(self->dead, 0);
+	self->dead_since = self->generation;
+	self->ndead = 0;
+
+	/* Invalidate all iterators */
+	self->compactions += 1;
+
+	return PyLong_FromUnsignedLong(reclaimed);
+}
@@ -0,0 +1,450 @@
+/*
+fastsets - lazy set expressions
+
+Copyright (C) 2023 SUSE
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * An expression object is created by set.lazy(). Applying the set operators
+ * to it does not compute anything, but builds a larger expression, which is
+ * compiled to a postfix program over the sets involved. The program is run
+ * when the result is needed, in a single pass over all operands.
+ *
+ * Expressions refer to their sets, not to their contents at the time the
+ * expression was built; every evaluation sees the sets' current members.
+ * A NULL operand stands for the domain's live mask, which is used for
+ * complements.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "fastsets.h"
+
+static void		FastsetExpression_dealloc(fastset_Expression *self);
+static PyObject *	FastsetExpression_materialize(fastset_Expression *self, PyObject *unused);
+static Py_ssize_t	FastsetExpression_length(fastset_Expression *self);
+static int		FastsetExpression_contains(fastset_Expression *self, PyObject *member);
+static int		FastsetExpression_nonempty(fastset_Expression *self);
+static PyObject *	FastsetExpression_getiter(fastset_Expression *self);
+static PyObject *	FastsetExpression_or(PyObject *, PyObject *);
+static PyObject *	FastsetExpression_and(PyObject *, PyObject *);
+static PyObject *	FastsetExpression_subtract(PyObject *, PyObject *);
+static PyObject *	FastsetExpression_xor(PyObject *, PyObject *);
+static PyObject *	FastsetExpression_invert(fastset_Expression *);
+
+static PyMethodDef fastset_expressionMethods[] = {
+      { "materialize", (PyCFunction) FastsetExpression_materialize, METH_NOARGS,
+        "evaluate the expression and return the resulting set"
+      },
+      { NULL }
+};
+
+static PySequenceMethods fastset_expressionSequenceMethods = {
+	.sq_length	= (lenfunc) FastsetExpression_length,
+	.sq_contains	= (objobjproc) FastsetExpression_contains,
+};
+
+static PyNumberMethods fastset_expressionNumberMethods = {
+	.nb_bool	= (inquiry) FastsetExpression_nonempty,
+	.nb_or		= FastsetExpression_or,
+	.nb_and		= FastsetExpression_and,
+	.nb_subtract	= FastsetExpression_subtract,
+	.nb_xor		= FastsetExpression_xor,
+	.nb_invert	= (unaryfunc) FastsetExpression_invert,
+};
+
+PyTypeObject	fastset_ExpressionType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+
+	.tp_name	= "expression",
+	.tp_basicsize	= sizeof(fastset_Expression),
+	.tp_flags	= Py_TPFLAGS_DEFAULT,
+	.tp_doc		= "lazily evaluated set expression",
+
+	.tp_methods	= fastset_expressionMethods,
+	.tp_dealloc	= (destructor) FastsetExpression_dealloc,
+	.tp_iter	= (getiterfunc) FastsetExpression_getiter,
+	.tp_as_sequence	= &fastset_expressionSequenceMethods,
+	.tp_as_number	= &fastset_expressionNumberMethods,
+};
+
+static fastset_Expression *
+FastsetExpression_alloc(fastset_Domain *domain, PyTypeObject *set_class, unsigned int noperands, unsigned int ninsns)
+{
+	fastset_Expression *self;
+
+	self = (fastset_Expression *) fastset_ExpressionType.tp_alloc(&fastset_ExpressionType, 0);
+	if (self == NULL)
+		return NULL;
+
+	self->operands = PyMem_New(PyObject *, noperands);
+	self->program = PyMem_Malloc(sizeof(fastset_bitvec_program_t) + ninsns * sizeof(fastset_bitvec_insn_t));
+	if (self->operands == NULL || self->program == NULL) {
+		Py_DECREF(self);
+		PyErr_NoMemory();
+		return NULL;
+	}
+
+	self->program->ninsns = 0;
+	self->program->depth = 0;
+
+	Py_INCREF(domain);
+	self->domain = domain;
+	Py_INCREF(set_class);
+	self->set_class = set_class;
+	return self;
+}
+
+static void
+FastsetExpression_dealloc(fastset_Expression *self)
+{
+	unsigned int i;
+
+	if (self->operands) {
+		for (i = 0; i < self->noperands; ++i)
+			Py_XDECREF(self->operands[i]);
+		PyMem_Free(self->operands);
+	}
+
+	PyMem_Free(self->program);
+	Py_XDECREF(self->set_class);
+	Py_XDECREF(self->domain);
+	Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static unsigned int
+FastsetExpression_addOperand(fastset_Expression *self, PyObject *set)
+{
+	unsigned int i;
+
+	/* A set used several times is stored once */
+	for (i = 0; i < self->noperands; ++i) {
+		if (self->operands[i] == set)
+			return i;
+	}
+
+	Py_XINCREF(set);
+	self->operands[self->noperands] = set;
+	return self->noperands++;
+}
+
+static void
+FastsetExpression_emit(fastset_Expression *self, int opcode, int op, unsigned int arg)
+{
+	fastset_bitvec_insn_t *insn = &self->program->insns[self->program->ninsns++];
+
+	insn->opcode = opcode;
+	insn->op = op;
+	insn->arg = arg;
+}
+
+PyObject *
+FastsetExpression_fromSet(fastset_Set *set)
+{
+	fastset_Expression *self;
+
+	if (!(self = FastsetExpression_alloc(set->domain, Py_TYPE(set), 1, 1)))
+		return NULL;
+
+	FastsetExpression_emit(self, FASTSET_INSN_LOAD, 0, FastsetExpression_addOperand(self, (PyObject *) set));
+	self->program->depth = 1;
+	return (PyObject *) self;
+}
+
+/*
+ * Operands of the expression operators may be expressions or sets
+ * of the same domain. Sets are treated as single-set expressions.
+ */
+static fastset_Expression *
+FastsetExpression_cast(PyObject *obj, fastset_Domain *domain)
+{
+	if (Py_TYPE(obj) == &fastset_ExpressionType) {
+		if (((fastset_Expression *) obj)->domain != domain)
+			return NULL;
+		Py_INCREF(obj);
+		return (fastset_Expression *) obj;
+	}
+
+	if (!FastsetDomain_IsSet(domain, obj))
+		return NULL;
+
+	return (fastset_Expression *) FastsetExpression_fromSet((fastset_Set *) obj);
+}
+
+/*
+ * Append the program of other, renumbering its operands
+ */
+static void
+FastsetExpression_append(fastset_Expression *self, const fastset_Expression *other)
+{
+	unsigned int pc;
+
+	for (pc = 0; pc < other->program->ninsns; ++pc) {
+		const fastset_bitvec_insn_t *insn = &other->program->insns[pc];
+		unsigned int arg = insn->arg;
+
+		if (insn->opcode != FASTSET_INSN_COMBINE)
+			arg = FastsetExpression_addOperand(self, other->operands[arg]);
+		FastsetExpression_emit(self, insn->opcode, insn->op, arg);
+	}
+}
+
+/*
+ * Check whether expr is the complement of a single set
+ */
+static bool
+FastsetExpression_isComplement(const fastset_Expression *expr)
+{
+	const fastset_bitvec_program_t *prog = expr->program;
+
+	return prog->ninsns == 2
+	    && prog->insns[0].opcode == FASTSET_INSN_LOAD
+	    && expr->operands[prog->insns[0].arg] == NULL
+	    && prog->insns[1].opcode == FASTSET_INSN_APPLY
+	    && prog->insns[1].op == FASTSET_OP_ANDNOT;
+}
+
+/*
+ * Build the expression (left OP right), by appending the program of right
+ * to that of left. If right is a single set, it is applied to the top of
+ * the stack directly, so that chains like a | b & c - d run on one
+ * stack slot.
+ */
+static PyObject *
+FastsetExpression_combine(fastset_Expression *left, fastset_Expression *right, int op)
+{
+	const fastset_bitvec_program_t *rprog = right->program;
+	fastset_Expression *self;
+	unsigned int depth;
+	bool flat;
+
+	flat = rprog->ninsns == 1 || (op == FASTSET_OP_AND && FastsetExpression_isComplement(right));
+	if (flat)
+		depth = left->program->depth;
+	else
+		depth = Py_MAX(left->program->depth, rprog->depth + 1);
+
+	if (depth > FASTSET_PROGRAM_MAX_DEPTH) {
+		PyErr_SetString(PyExc_ValueError, "set expression is nested too deeply");
+		return NULL;
+	}
+
+	self = FastsetExpression_alloc(left->domain, left->set_class, left->noperands + right->noperands,
+			left->program->ninsns + rprog->ninsns + 1);
+	if (self == NULL)
+		return NULL;
+
+	FastsetExpression_append(self, left);
+
+	if (rprog->ninsns == 1) {
+		FastsetExpression_emit(self, FASTSET_INSN_APPLY, op,
+				FastsetExpression_addOperand(self, right->operands[rprog->insns[0].arg]));
+	} else if (flat) {
+		/* x & ~c is computed as (x & live) - c, on the same stack slot */
+		FastsetExpression_emit(self, FASTSET_INSN_APPLY, FASTSET_OP_AND,
+				FastsetExpression_addOperand(self, NULL));
+		FastsetExpression_emit(self, FASTSET_INSN_APPLY, FASTSET_OP_ANDNOT,
+				FastsetExpression_addOperand(self, right->operands[rprog->insns[1].arg]));
+	} else {
+		FastsetExpression_append(self, right);
+		FastsetExpression_emit(self, FASTSET_INSN_COMBINE, op, 0);
+	}
+
+	self->program->depth = depth;
+	return (PyObject *) self;
+}
+
+/*
+ * ~expr is compiled as (live - expr)
+ */
+static PyObject *
+FastsetExpression_invert(fastset_Expression *expr)
+{
+	const fastset_bitvec_program_t *prog = expr->program;
+	fastset_Expression *self;
+
+	if (prog->depth + 1 > FASTSET_PROGRAM_MAX_DEPTH) {
+		PyErr_SetString(PyExc_ValueError, "set expression is nested too deeply");
+		return NULL;
+	}
+
+	self = FastsetExpression_alloc(expr->domain, expr->set_class, expr->noperands + 1, prog->ninsns + 2);
+	if (self == NULL)
+		return NULL;
+
+	FastsetExpression_emit(self, FASTSET_INSN_LOAD, 0, FastsetExpression_addOperand(self, NULL));
+	if (prog->ninsns == 1) {
+		FastsetExpression_emit(self, FASTSET_INSN_APPLY, FASTSET_OP_ANDNOT,
+				FastsetExpression_addOperand(self, expr->operands[prog->insns[0].arg]));
+		self->program->depth = 1;
+	} else {
+		FastsetExpression_append(self, expr);
+		FastsetExpression_emit(self, FASTSET_INSN_COMBINE, FASTSET_OP_ANDNOT, 0);
+		self->program->depth = prog->depth + 1;
+	}
+
+	return (PyObject *) self;
+}
+
+static PyObject *
+FastsetExpression_operator(PyObject *a, PyObject *b, int op)
+{
+	fastset_Expression *left = NULL, *right = NULL;
+	fastset_Domain *domain;
+	PyObject *result;
+
+	/* At least one of the two is an expression */
+	if (Py_TYPE(a) == &fastset_ExpressionType)
+		domain = ((fastset_Expression *) a)->domain;
+	else
+		domain = ((fastset_Expression *) b)->domain;
+
+	if (!(left = FastsetExpression_cast(a, domain)) || !(right = FastsetExpression_cast(b, domain))) {
+		Py_XDECREF(left);
+		if (PyErr_Occurred())
+			return NULL;
+		Py_RETURN_NOTIMPLEMENTED;
+	}
+
+	result = FastsetExpression_combine(left, right, op);
+	Py_DECREF(left);
+	Py_DECREF(right);
+	return result;
+}
+
+static PyObject *
+FastsetExpression_or(PyObject *a, PyObject *b)
+{
+	return FastsetExpression_operator(a, b, FASTSET_OP_OR);
+}
+
+static PyObject *
+FastsetExpression_and(PyObject *a, PyObject *b)
+{
+	return FastsetExpression_operator(a, b, FASTSET_OP_AND);
+}
+
+static PyObject *
+FastsetExpression_subtract(PyObject *a, PyObject *b)
+{
+	return FastsetExpression_operator(a, b, FASTSET_OP_ANDNOT);
+}
+
+static PyObject *
+FastsetExpression_xor(PyObject *a, PyObject *b)
+{
+	return FastsetExpression_operator(a, b, FASTSET_OP_XOR);
+}
+
+/*
+ * Collect the current bitvecs of all operands
+ */
+static const fastset_bitvec_t **
+FastsetExpression_getVectors(fastset_Expression *self, const fastset_bitvec_t **buf, unsigned int size)
+{
+	const fastset_bitvec_t **vecs = buf;
+	unsigned int i;
+
+	if (self->noperands > size && !(vecs = PyMem_New(const fastset_bitvec_t *, self->noperands))) {
+		PyErr_NoMemory();
+		return NULL;
+	}
+
+	for (i = 0; i < self->noperands; ++i) {
+		if (self->operands[i] == NULL)
+			vecs[i] = self->domain->live;
+		else
+			vecs[i] = Fastset_bitvec((fastset_Set *) self->operands[i]);
+	}
+	return vecs;
+}
+
+static void
+FastsetExpression_putVectors(const fastset_bitvec_t **vecs, const fastset_bitvec_t **buf)
+{
+	if (vecs != buf)
+		PyMem_Free(vecs);
+}
+
+static PyObject *
+FastsetExpression_materialize(fastset_Expression *self, PyObject *unused)
+{
+	const fastset_bitvec_t *buf[FASTSET_COMBINE_BATCH], **vecs;
+	fastset_Set *result;
+
+	if (!(vecs = FastsetExpression_getVectors(self, buf, FASTSET_COMBINE_BATCH)))
+		return NULL;
+
+	if ((result = Fastset_newTypedSet(self->set_class, self->domain)) != NULL) {
+		fastset_bitvec_program_eval_into(result->bitvec, self->program, vecs);
+		fastset_bitvec_optimize(result->bitvec);
+	}
+
+	FastsetExpression_putVectors(vecs, buf);
+	return (PyObject *) result;
+}
+
+static Py_ssize_t
+FastsetExpression_length(fastset_Expression *self)
+{
+	const fastset_bitvec_t *buf[FASTSET_COMBINE_BATCH], **vecs;
+	unsigned int count;
+
+	if (!(vecs = FastsetExpression_getVectors(self, buf, FASTSET_COMBINE_BATCH)))
+		return -1;
+
+	count = fastset_bitvec_program_count(self->program, vecs);
+	FastsetExpression_putVectors(vecs, buf);
+	return count;
+}
+
+static int
+FastsetExpression_nonempty(fastset_Expression *self)
+{
+	Py_ssize_t count = FastsetExpression_length(self);
+
+	return count < 0? -1 : count != 0;
+}
+
+static int
+FastsetExpression_contains(fastset_Expression *self, PyObject *member)
+{
+	const fastset_bitvec_t *buf[FASTSET_COMBINE_BATCH], **vecs;
+	bool result;
+
+	if (!FastsetDomain_IsMember(self->domain, member))
+		return 0;
+
+	if (!(vecs = FastsetExpression_getVectors(self, buf, FASTSET_COMBINE_BATCH)))
+		return -1;
+
+	result = fastset_bitvec_program_test_bit(self->program, vecs, ((fastset_Member *) member)->index);
+	FastsetExpression_putVectors(vecs, buf);
+	return result;
+}
+
+static PyObject *
+FastsetExpression_getiter(fastset_Expression *self)
+{
+	PyObject *set, *iter;
+
+	if (!(set = FastsetExpression_materialize(self, NULL)))
+		return NULL;
+
+	iter = PyObject_GetIter(set);
+	Py_DECREF(set);
+	return iter;
+}
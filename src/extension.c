@@ -103,10 +103,17 @@ PyInit_fastset(void)
 {
 	PyObject* m;
 
+	fastset_bitvec_kernels_init();
+
 	m = PyModule_Create(&fastset_module_def);
+	PyModule_AddStringConstant(m, "simd", fastset_bitvec_kernels->name);
 
 	fastset_registerType(m, "Domain", &fastset_DomainType);
 	fastset_registerType(m, "Transform", &fastset_TransformType);
+	fastset_registerType(m, "Expression", &fastset_ExpressionType);
+	fastset_registerType(m, "Relation", &fastset_RelationType);
+	fastset_registerType(m, "SetArray", &fastset_SetArrayType);
+	fastset_registerType(m, "SetIndex", &fastset_SetIndexType);
 	fastset_registerType(m, "iterator", &fastset_SetIteratorType);
 	return m;
 }
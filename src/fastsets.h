@@ -9,31 +9,233 @@
 #define FASTSETS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <Python.h>
 
 
 typedef uint64_t	fastset_bitvec_word_t;
 
+/*
+ * Compressed bitvecs are split into chunks of 64K bits, each of which
+ * is stored in a container of its own.
+ */
+#define FASTSET_CHUNK_SHIFT	16
+#define FASTSET_CHUNK_BITS	(1U << FASTSET_CHUNK_SHIFT)
+#define FASTSET_CHUNK_WORDS	(FASTSET_CHUNK_BITS / 64)
+#define FASTSET_ARRAY_MAX	4096
+
+enum {
+	FASTSET_CONTAINER_ARRAY,	/* sorted array of 16bit offsets */
+	FASTSET_CONTAINER_BITMAP,	/* FASTSET_CHUNK_WORDS words */
+	FASTSET_CONTAINER_RUN,		/* sorted array of runs */
+};
+
+typedef struct fastset_run {
+	uint16_t	start;
+	uint16_t	last;		/* inclusive */
+} fastset_run_t;
+
+typedef struct fastset_container {
+	unsigned int	type;
+	unsigned int	cardinality;
+	unsigned int	count;		/* number of values or runs */
+	unsigned int	nalloc;
+	union {
+		void *			data;
+		uint16_t *		values;
+		fastset_bitvec_word_t *	bitmap;
+		fastset_run_t *		runs;
+	};
+} fastset_container_t;
+
+struct fastset_bitvec_pool;
+
 typedef struct fastset_bitvec {
 	unsigned int	refcount;
 
+	/* Allocator for headers and words; may be NULL */
+	struct fastset_bitvec_pool *pool;
+
 	unsigned int	max_index;
 	unsigned int	nwords;
 
 	unsigned int	nalloc;
 	fastset_bitvec_word_t *words;
+
+	/* Number of bits set, or -1 if not known. set() and clear()
+	 * keep this exact, bulk operations invalidate it. */
+	int		cardinality;
+
+	/* In compressed form, words is not used. Instead, the bits
+	 * are stored in one container per chunk (NULL if the chunk
+	 * is empty), and cardinality is always exact. */
+	bool		compressed;
+	unsigned int	nchunks;
+	fastset_container_t **chunks;
+
+	/* Sets in small domains embed their bitvec in the set object,
+	 * along with ninline words of storage. An embedded bitvec is
+	 * never shared; words points to inline_words unless the vector
+	 * outgrew them. */
+	fastset_bitvec_word_t *inline_words;
+	unsigned int	ninline;
 } fastset_bitvec_t;
 
+/*
+ * Per-domain free lists of bitvec headers and word arrays
+ */
+#define FASTSET_POOL_CLASSES		8
+#define FASTSET_POOL_MAX_FREE		64
+#define FASTSET_POOL_MAX_HEADERS	256
+#define FASTSET_POOL_MAX_BYTES		(4 * 1024 * 1024)
+
+typedef struct fastset_bitvec_pool {
+	struct fastset_pool_class {
+		unsigned int	nwords;
+		unsigned int	count;
+		void *		free;
+	} classes[FASTSET_POOL_CLASSES];
+	size_t		cached_bytes;
+
+	unsigned int	nfree_headers;
+	void *		free_headers;
+
+	struct {
+		unsigned long	words_hits;
+		unsigned long	words_misses;
+		unsigned long	words_released;
+		unsigned long	headers_hits;
+		unsigned long	headers_misses;
+		unsigned long	headers_released;
+	} stats;
+} fastset_bitvec_pool_t;
+
+/*
+ * A compiled transform maps the input one byte at a time. If all bits of
+ * an input byte map into the same output word, the byte's value indexes
+ * a table of output masks for that word; other bytes are mapped bit by
+ * bit. Bytes with the same layout of output bits share their table.
+ */
+#define FASTSET_TRANSFORM_MAX_TABLES	1024
+
+typedef struct fastset_transform_byte {
+	unsigned int	word;
+	int		table;		/* -1 if the byte is mapped bit by bit */
+} fastset_transform_byte_t;
+
+typedef struct fastset_bitvec_transform_table {
+	unsigned int	npositions;	/* number of input bytes */
+	unsigned int	res_max_index;	/* highest output bit + 1 */
+	fastset_transform_byte_t *positions;
+
+	unsigned int	ntables;
+	fastset_bitvec_word_t (*tables)[256];
+
+	/* False if too few bytes have a table to be worth looking them up */
+	bool		use_tables;
+} fastset_bitvec_transform_table_t;
+
 typedef struct fastset_bitvec_transform {
 	unsigned int	max_index;
 	int *		mapping;
+
+	/* Built by fastset_bitvec_transform_compile(), dropped on change */
+	fastset_bitvec_transform_table_t *compiled;
 } fastset_bitvec_transform_t;
 
+/*
+ * A bit matrix, stored row by row in a single allocation. Rows are
+ * aligned to a cache line, and padded to a whole number of them.
+ */
+#define FASTSET_MATRIX_ALIGN_WORDS	8
+
+typedef struct fastset_bitvec_matrix {
+	unsigned int	nrows;
+	unsigned int	ncols;
+	unsigned int	stride;		/* words per row */
+	unsigned int	nalloc;		/* rows allocated */
+	fastset_bitvec_word_t *words;
+} fastset_bitvec_matrix_t;
+
+/*
+ * Set expressions are compiled to a small postfix program over a list
+ * of operand vectors. Each instruction takes one of the FASTSET_OP_*
+ * operations.
+ */
+enum {
+	FASTSET_INSN_LOAD,		/* push operand arg */
+	FASTSET_INSN_APPLY,		/* top = top OP operand arg */
+	FASTSET_INSN_COMBINE,		/* pop b; top = top OP b */
+};
+
+typedef struct fastset_bitvec_insn {
+	unsigned char	opcode;
+	unsigned char	op;
+	unsigned int	arg;
+} fastset_bitvec_insn_t;
+
+#define FASTSET_PROGRAM_MAX_DEPTH	32
+
+typedef struct fastset_bitvec_program {
+	unsigned int	ninsns;
+	unsigned int	depth;		/* max stack depth */
+	fastset_bitvec_insn_t insns[];
+} fastset_bitvec_program_t;
+
+/*
+ * Word-level kernels used by the bitvec code. Several versions of these
+ * are compiled for different instruction sets, and the best one for the
+ * host CPU is selected at module load time.
+ */
+typedef struct fastset_bitvec_kernels {
+	const char *	name;
+
+	/* res = a OP b, for nwords words. res may alias a or b */
+	void		(*op_or)(fastset_bitvec_word_t *res, const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords);
+	void		(*op_and)(fastset_bitvec_word_t *res, const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords);
+	void		(*op_andnot)(fastset_bitvec_word_t *res, const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords);
+	void		(*op_xor)(fastset_bitvec_word_t *res, const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords);
+
+	/* return true iff (a & b) resp. (a & ~b) has any bit set */
+	bool		(*test_and)(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords);
+	bool		(*test_andnot)(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords);
+
+	/* return the number of bits set in a, (a & b), (a | b) and (a & ~b) */
+	unsigned int	(*popcount)(const fastset_bitvec_word_t *a, unsigned int nwords);
+	unsigned int	(*popcount_and)(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords);
+	unsigned int	(*popcount_or)(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords);
+	unsigned int	(*popcount_andnot)(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords);
+} fastset_bitvec_kernels_t;
+
+extern const fastset_bitvec_kernels_t *fastset_bitvec_kernels;
+extern void		fastset_bitvec_kernels_init(void);
+
 extern PyTypeObject	fastset_DomainType;
 extern PyTypeObject	fastset_SetIteratorType;
 extern PyTypeObject	fastset_SetTypeTemplate;
 extern PyTypeObject	fastset_MemberTypeTemplate;
 extern PyTypeObject	fastset_TransformType;
+extern PyTypeObject	fastset_ExpressionType;
+extern PyTypeObject	fastset_RelationType;
+extern PyTypeObject	fastset_SetArrayType;
+extern PyTypeObject	fastset_SetIndexType;
+
+/*
+ * Transforms, relations, set arrays and set indexes keep data for each
+ * slot of their domain. Each holds one of these, which links it into a
+ * list of the domain, and records when it last dropped the data of
+ * unregistered members.
+ */
+typedef struct fastset_DomainLink {
+	struct fastset_DomainLink *next;
+	struct fastset_DomainLink **prev;
+
+	/* Domain generation at which the owner was last scrubbed */
+	unsigned long	generation;
+} fastset_DomainLink;
+
+/* Get the object a link is embedded in, as its member named link */
+#define FASTSET_LINK_OWNER(ptr, type)	((type *) ((char *) (ptr) - offsetof(type, link)))
 
 typedef struct {
 	PyObject_HEAD
@@ -46,6 +248,45 @@ typedef struct {
 	unsigned int	size;
 	unsigned int	count;
 	PyObject **	domain_objects;
+
+	/* Allocated length of domain_objects, and a stack of the
+	 * slots below size that are unused */
+	unsigned int	nalloc;
+	unsigned int	nfree_slots;
+	unsigned int *	free_slots;
+
+	/* Number of bitvec words embedded in each set object */
+	unsigned int	inline_words;
+
+	/* Slots holding a registered member. Universe sets share this
+	 * vector copy-on-write. */
+	fastset_bitvec_t *live;
+
+	/* Slot reuse. Each time a member is unregistered, the generation
+	 * is bumped and recorded for its slot. dead has a bit for each
+	 * slot that was vacated after generation dead_since; it is reset
+	 * once it holds FASTSET_DEAD_MAX slots. */
+	unsigned long	generation;
+	unsigned long *	slot_generation;
+	fastset_bitvec_t *dead;
+	unsigned long	dead_since;
+	unsigned int	ndead;
+
+	fastset_bitvec_pool_t pool;
+
+	/* Set objects kept for reuse by the domain's set class */
+	struct fastset_Set *free_sets;
+	unsigned int	nfree_sets;
+
+	/* All live sets, transforms, relations, set arrays and set indexes
+	 * of the domain, so that compact() can renumber them. These lists
+	 * do not hold references. */
+	struct fastset_Set *sets;
+	fastset_DomainLink *transforms;
+	fastset_DomainLink *relations;
+	fastset_DomainLink *set_arrays;
+	fastset_DomainLink *set_indexes;
+	unsigned long	compactions;
 } fastset_Domain;
 
 typedef struct {
@@ -55,19 +296,41 @@ typedef struct {
 	int		index;
 } fastset_Member;
 
-typedef struct {
+typedef struct fastset_Set {
 	PyObject_HEAD
 
 	fastset_Domain *domain;
 	fastset_bitvec_t *bitvec;
+
+	/* Domain generation at which bitvec was last scrubbed of the
+	 * slots of unregistered members */
+	unsigned long	generation;
+
+	/* Link in the domain's list of sets */
+	struct fastset_Set *next_set;
+	struct fastset_Set **prev_set;
+
+	/* Embedded bitvec; the number of inline words is chosen per domain */
+	fastset_bitvec_t inline_vec;
+	fastset_bitvec_word_t inline_words[];
 } fastset_Set;
 
+/* Number of member indexes decoded at a time */
+#define FASTSET_EXTRACT_BATCH	256
+#define FASTSET_ITER_BATCH	64
+
 typedef struct {
 	PyObject_HEAD
 
 	fastset_Domain *domain;
 	fastset_bitvec_t *vector;
 	unsigned int	index;
+	unsigned long	generation;
+	unsigned long	compactions;
+
+	/* Member indexes decoded ahead of time */
+	unsigned int	pos, count;
+	uint32_t	batch[FASTSET_ITER_BATCH];
 } fastset_SetIterator;
 
 typedef struct {
@@ -77,32 +340,128 @@ typedef struct {
 	fastset_Domain *domain;
 } fastset_DomainSpecificType;
 
-typedef struct {
+/* Number of types for which we remember the domain */
+#define FASTSET_TYPE_CACHE_SIZE		64
+
+typedef struct fastset_Transform {
 	PyObject_HEAD
 
 	char *		name;
 
 	fastset_Domain *domain;
 	fastset_bitvec_transform_t *bittrans;
+
+	/* Link in the domain's list of transforms */
+	fastset_DomainLink link;
 } fastset_Transform;
 
+typedef struct {
+	PyObject_HEAD
+
+	fastset_Domain *domain;
+
+	/* The class of materialized results; that of the leftmost set */
+	PyTypeObject *	set_class;
+
+	/* The sets the expression refers to, and the program combining them */
+	unsigned int	noperands;
+	PyObject **	operands;
+	fastset_bitvec_program_t *program;
+} fastset_Expression;
+
+typedef struct fastset_Relation {
+	PyObject_HEAD
+
+	fastset_Domain *domain;
+
+	/* Row i holds the members related to the member in slot i. The
+	 * transposed matrix is built when needed, for preimages. */
+	fastset_bitvec_matrix_t matrix;
+	fastset_bitvec_matrix_t transposed;
+	bool		have_transposed;
+
+	/* Link in the domain's list of relations */
+	fastset_DomainLink link;
+} fastset_Relation;
+
+typedef struct fastset_SetArray {
+	PyObject_HEAD
+
+	fastset_Domain *domain;
+
+	/* The class of the sets returned by indexing */
+	PyTypeObject *	set_class;
+
+	/* Row i holds the members of the i-th set */
+	fastset_bitvec_matrix_t matrix;
+
+	/* Link in the domain's list of set arrays */
+	fastset_DomainLink link;
+} fastset_SetArray;
+
+typedef struct fastset_SetIndex {
+	PyObject_HEAD
+
+	fastset_Domain *domain;
+
+	/* For each domain slot, the ids of the stored sets that contain
+	 * its member, or NULL if there are none */
+	unsigned int	npostings;
+	fastset_bitvec_t **postings;
+
+	/* The ids of all stored sets, which are numbered from 0 */
+	fastset_bitvec_t *all;
+	unsigned int	count;
+
+	/* Link in the domain's list of set indexes */
+	fastset_DomainLink link;
+} fastset_SetIndex;
+
 #define FASTSET_DST_MAGIC	0xfaded0ddbeefcafe
 
+/* Default number of domain members for which sets use inline storage */
+#define FASTSET_INLINE_SIZE_DEFAULT	256
+
+/* Max number of free set objects a domain keeps around */
+#define FASTSET_SET_FREELIST_MAX	80
+
+/* Number of sets combined in one pass by Domain.union_all() and friends */
+#define FASTSET_COMBINE_BATCH		32
+
+/* Max number of vacated slots tracked by a domain's dead mask */
+#define FASTSET_DEAD_MAX		1024
+
 extern fastset_bitvec_t *fastset_bitvec_new(unsigned int size);
+extern fastset_bitvec_t *fastset_bitvec_new_pooled(fastset_bitvec_pool_t *, unsigned int size);
+extern void		fastset_bitvec_init_inline(fastset_bitvec_t *, fastset_bitvec_pool_t *,
+					fastset_bitvec_word_t *words, unsigned int ninline);
+extern fastset_bitvec_t *fastset_bitvec_detach(fastset_bitvec_t *);
+extern void		fastset_bitvec_free_words(fastset_bitvec_t *);
+extern void		fastset_bitvec_assign(fastset_bitvec_t *res, const fastset_bitvec_t *arg);
 extern fastset_bitvec_t *fastset_bitvec_unshare(fastset_bitvec_t *);
 extern fastset_bitvec_t *fastset_bitvec_hold(fastset_bitvec_t *);
 extern fastset_bitvec_t *fastset_bitvec_copy(const fastset_bitvec_t *);
 extern void		fastset_bitvec_resize(fastset_bitvec_t *, unsigned int max_index);
+extern void		fastset_bitvec_reserve(fastset_bitvec_t *, unsigned int max_index);
+extern void		fastset_bitvec_shrink_to_fit(fastset_bitvec_t *);
 extern void		fastset_bitvec_release(fastset_bitvec_t *);
 extern bool		fastset_bitvec_set(fastset_bitvec_t *, unsigned int i);
 extern bool		fastset_bitvec_clear(fastset_bitvec_t *, unsigned int i);
 extern void		fastset_bitvec_update_union(fastset_bitvec_t *, const fastset_bitvec_t *);
+extern void		fastset_bitvec_combine_into(fastset_bitvec_t *res, const fastset_bitvec_t **args,
+					unsigned int nargs, int op);
 extern void		fastset_bitvec_update_intersection(fastset_bitvec_t *, const fastset_bitvec_t *);
 extern void		fastset_bitvec_update_difference(fastset_bitvec_t *, const fastset_bitvec_t *);
 extern void		fastset_bitvec_update_symmetric_difference(fastset_bitvec_t *, const fastset_bitvec_t *);
 extern int		fastset_bitvec_compare(const fastset_bitvec_t *, const fastset_bitvec_t *);
 extern int		fastset_bitvec_find_next_bit(const fastset_bitvec_t *, unsigned int);
+extern unsigned int	fastset_bitvec_extract(const fastset_bitvec_t *, unsigned int from_index, uint32_t *out, unsigned int max);
+extern unsigned int	fastset_bitvec_words_extract(const fastset_bitvec_word_t *words, unsigned int nwords, unsigned int from_index,
+					uint32_t base, uint32_t *out, unsigned int max);
 extern unsigned int	fastset_bitvec_count_ones(const fastset_bitvec_t *);
+extern unsigned int	fastset_bitvec_intersection_count(const fastset_bitvec_t *, const fastset_bitvec_t *);
+extern unsigned int	fastset_bitvec_union_count(const fastset_bitvec_t *, const fastset_bitvec_t *);
+extern unsigned int	fastset_bitvec_difference_count(const fastset_bitvec_t *, const fastset_bitvec_t *);
 
 extern bool		fastset_bitvec_test_subset(const fastset_bitvec_t *subset, const fastset_bitvec_t *superset);
 extern bool		fastset_bitvec_test_disjoint(const fastset_bitvec_t *subset, const fastset_bitvec_t *superset);
@@ -114,10 +473,89 @@ extern fastset_bitvec_t *fastset_bitvec_intersection(const fastset_bitvec_t *arg
 extern fastset_bitvec_t *fastset_bitvec_difference(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2);
 extern fastset_bitvec_t *fastset_bitvec_symmetric_difference(const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2);
 extern fastset_bitvec_t *fastset_bitvec_transform(const fastset_bitvec_t *arg, const fastset_bitvec_transform_t *);
+extern void		fastset_bitvec_union_into(fastset_bitvec_t *res, const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2);
+extern void		fastset_bitvec_intersection_into(fastset_bitvec_t *res, const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2);
+extern void		fastset_bitvec_difference_into(fastset_bitvec_t *res, const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2);
+extern void		fastset_bitvec_symmetric_difference_into(fastset_bitvec_t *res, const fastset_bitvec_t *arg1, const fastset_bitvec_t *arg2);
+extern void		fastset_bitvec_transform_into(fastset_bitvec_t *res, const fastset_bitvec_t *arg, const fastset_bitvec_transform_t *);
+
+extern void		fastset_bitvec_program_eval_into(fastset_bitvec_t *res, const fastset_bitvec_program_t *,
+					const fastset_bitvec_t **vecs);
+extern unsigned int	fastset_bitvec_program_count(const fastset_bitvec_program_t *, const fastset_bitvec_t **vecs);
+extern bool		fastset_bitvec_program_test_bit(const fastset_bitvec_program_t *, const fastset_bitvec_t **vecs,
+					unsigned int index);
 
 extern fastset_bitvec_transform_t *fastset_bitvec_transform_new(unsigned int);
 extern void		fastset_bitvec_transform_add(fastset_bitvec_transform_t *, unsigned int arg_index, int res_index);
 extern void		fastset_bitvec_transform_free(fastset_bitvec_transform_t *);
+extern void		fastset_bitvec_transform_compile(fastset_bitvec_transform_t *);
+extern fastset_bitvec_transform_t *fastset_bitvec_transform_compose(const fastset_bitvec_transform_t *outer,
+					const fastset_bitvec_transform_t *inner);
+extern fastset_bitvec_transform_t *fastset_bitvec_transform_invert(const fastset_bitvec_transform_t *);
+extern void		fastset_bitvec_preimage_into(fastset_bitvec_t *res, const fastset_bitvec_t *arg,
+					const fastset_bitvec_transform_t *);
+
+enum {
+	FASTSET_OP_OR,
+	FASTSET_OP_AND,
+	FASTSET_OP_ANDNOT,
+	FASTSET_OP_XOR,
+};
+
+extern void		fastset_bitvec_matrix_init(fastset_bitvec_matrix_t *);
+extern void		fastset_bitvec_matrix_destroy(fastset_bitvec_matrix_t *);
+extern void		fastset_bitvec_matrix_resize(fastset_bitvec_matrix_t *, unsigned int nrows, unsigned int ncols);
+extern void		fastset_bitvec_matrix_reserve(fastset_bitvec_matrix_t *, unsigned int nrows);
+extern void		fastset_bitvec_matrix_copy(fastset_bitvec_matrix_t *dst, const fastset_bitvec_matrix_t *src);
+extern bool		fastset_bitvec_matrix_set(fastset_bitvec_matrix_t *, unsigned int r, unsigned int c);
+extern bool		fastset_bitvec_matrix_clear(fastset_bitvec_matrix_t *, unsigned int r, unsigned int c);
+extern bool		fastset_bitvec_matrix_test(const fastset_bitvec_matrix_t *, unsigned int r, unsigned int c);
+extern void		fastset_bitvec_matrix_clear_row(fastset_bitvec_matrix_t *, unsigned int r);
+extern void		fastset_bitvec_matrix_clear_column(fastset_bitvec_matrix_t *, unsigned int c);
+extern void		fastset_bitvec_matrix_transpose(fastset_bitvec_matrix_t *dst, const fastset_bitvec_matrix_t *src);
+extern void		fastset_bitvec_matrix_get_row(fastset_bitvec_t *res, const fastset_bitvec_matrix_t *, unsigned int r);
+extern void		fastset_bitvec_matrix_update_row(fastset_bitvec_matrix_t *, unsigned int r, const fastset_bitvec_t *);
+extern void		fastset_bitvec_matrix_image_into(fastset_bitvec_t *res, const fastset_bitvec_matrix_t *,
+					const fastset_bitvec_t *select);
+extern void		fastset_bitvec_matrix_reachable(fastset_bitvec_t *res, const fastset_bitvec_matrix_t *,
+					const fastset_bitvec_t *start);
+extern void		fastset_bitvec_matrix_closure(fastset_bitvec_matrix_t *, unsigned int nthreads);
+extern void		fastset_bitvec_matrix_or_rows(fastset_bitvec_matrix_t *, const fastset_bitvec_word_t *mask);
+extern void		fastset_bitvec_matrix_row_counts(const fastset_bitvec_matrix_t *, uint32_t *counts);
+extern unsigned int	fastset_bitvec_matrix_select_rows(const fastset_bitvec_matrix_t *, const fastset_bitvec_word_t *query,
+					int how, uint32_t *out);
+
+extern void		fastset_bitvec_pool_init(fastset_bitvec_pool_t *);
+extern void		fastset_bitvec_pool_destroy(fastset_bitvec_pool_t *);
+extern fastset_bitvec_word_t *fastset_bitvec_pool_get_words(fastset_bitvec_pool_t *, unsigned int nwords);
+extern void		fastset_bitvec_pool_put_words(fastset_bitvec_pool_t *, fastset_bitvec_word_t *, unsigned int nwords);
+extern fastset_bitvec_t *fastset_bitvec_pool_get_header(fastset_bitvec_pool_t *);
+extern void		fastset_bitvec_pool_put_header(fastset_bitvec_pool_t *, fastset_bitvec_t *);
+
+extern void		fastset_bitvec_compress(fastset_bitvec_t *);
+extern void		fastset_bitvec_decompress(fastset_bitvec_t *);
+extern void		fastset_bitvec_optimize(fastset_bitvec_t *);
+extern bool		fastset_bitvec_want_compressed(unsigned int max_index, unsigned int cardinality, bool compressed);
+extern size_t		fastset_bitvec_memory(const fastset_bitvec_t *);
+extern void		fastset_bitvec_chunked_destroy(fastset_bitvec_t *);
+extern fastset_bitvec_t *fastset_bitvec_chunked_copy(const fastset_bitvec_t *);
+extern void		fastset_bitvec_chunked_resize(fastset_bitvec_t *, unsigned int max_index);
+extern void		fastset_bitvec_chunked_shrink(fastset_bitvec_t *);
+extern bool		fastset_bitvec_chunked_test(const fastset_bitvec_t *, unsigned int);
+extern bool		fastset_bitvec_chunked_set(fastset_bitvec_t *, unsigned int);
+extern bool		fastset_bitvec_chunked_clear(fastset_bitvec_t *, unsigned int);
+extern int		fastset_bitvec_chunked_find_next_bit(const fastset_bitvec_t *, unsigned int);
+extern unsigned int	fastset_bitvec_chunked_extract(const fastset_bitvec_t *, unsigned int from_index, uint32_t *out, unsigned int max);
+extern fastset_bitvec_t *fastset_bitvec_chunked_binop(const fastset_bitvec_t *, const fastset_bitvec_t *, int op);
+extern unsigned int	fastset_bitvec_chunked_intersection_count(const fastset_bitvec_t *, const fastset_bitvec_t *);
+
+/* Row selection for fastset_bitvec_matrix_select_rows() */
+enum {
+	FASTSET_ROWS_SUBSET,		/* row is a subset of query */
+	FASTSET_ROWS_SUPERSET,		/* row is a superset of query */
+	FASTSET_ROWS_DISJOINT,		/* row and query have no bits in common */
+	FASTSET_ROWS_INTERSECTING,	/* row and query have some bits in common */
+};
 
 enum {
 	FASTSET_REL_EQUAL		= 0,
@@ -126,6 +564,25 @@ enum {
 	FASTSET_REL_NOT_EQUAL		= 3,
 };
 
+static inline bool
+fastset_bitvec_is_embedded(const fastset_bitvec_t *vec)
+{
+	return vec->inline_words != NULL;
+}
+
+/* True if the vector's bits live in the set object's inline storage */
+static inline bool
+fastset_bitvec_is_inline(const fastset_bitvec_t *vec)
+{
+	return vec->inline_words != NULL && !vec->compressed && vec->words == vec->inline_words;
+}
+
+static inline fastset_bitvec_word_t *
+fastset_bitvec_matrix_row(const fastset_bitvec_matrix_t *m, unsigned int r)
+{
+	return m->words + (size_t) r * m->stride;
+}
+
 static inline void
 fastset_bitvec_drop(fastset_bitvec_t **var)
 {
@@ -137,17 +594,80 @@ fastset_bitvec_drop(fastset_bitvec_t **var)
 	}
 }
 
+extern void		Fastset_clearFreeSets(fastset_Domain *);
+extern fastset_Set *	Fastset_newDomainSet(fastset_Domain *);
+extern fastset_Set *	Fastset_newTypedSet(PyTypeObject *type, fastset_Domain *);
+extern PyObject *	FastsetExpression_fromSet(fastset_Set *);
+extern PyObject *	Fastset_universe(fastset_Domain *);
+extern void		Fastset_scrub(fastset_Set *);
+extern void		Fastset_remapAll(fastset_Domain *, const fastset_bitvec_transform_t *);
+extern void		FastsetTransform_remapAll(fastset_Domain *, const fastset_bitvec_transform_t *);
+extern void		FastsetRelation_remapAll(fastset_Domain *, const fastset_bitvec_transform_t *);
+extern void		FastsetSetArray_remapAll(fastset_Domain *, const fastset_bitvec_transform_t *);
+extern void		FastsetSetIndex_remapAll(fastset_Domain *, const fastset_bitvec_transform_t *);
+extern PyObject *	Fastset_combineAll(fastset_Domain *, PyObject *iterable, int op);
+extern PyObject *	Fastset_uintArray(PyObject *bytes);
+extern PyObject *	Fastset_bitvecIndices(const fastset_bitvec_t *);
 extern PyObject *	fastset_callType(PyTypeObject *typeObject, PyObject *args, PyObject *kwds);
 
 extern int		FastsetDomain_Check(PyObject *self);
-extern bool		FastsetDomain_IsMember(fastset_Domain *self, PyObject *object);
-extern bool		FastsetDomain_IsSet(fastset_Domain *self, PyObject *object);
 extern void		FastsetDomain_register(fastset_Domain *self, fastset_Member *member);
 extern void		FastsetDomain_unregister(fastset_Domain *self, fastset_Member *member);
+extern void		FastsetDomain_reserve(fastset_Domain *self, unsigned int size);
 extern PyObject *	FastsetDomain_GetMember(fastset_Domain *self, unsigned int index);
+extern void		FastsetDomain_link(fastset_Domain *self, fastset_DomainLink **list, fastset_DomainLink *link);
+extern void		FastsetDomain_unlink(fastset_DomainLink *link);
+extern fastset_bitvec_word_t *FastsetDomain_changedSlots(fastset_Domain *self, fastset_DomainLink *link, unsigned int nslots);
 
 extern PyObject *	FastsetSet_TransformBitvec(fastset_Set *self, const fastset_bitvec_transform_t *);
+extern PyObject *	FastsetSet_PreimageBitvec(fastset_Set *self, const fastset_bitvec_transform_t *);
 
 extern fastset_Domain *	Fastset_DSTGetDomain(PyObject *obj);
+extern fastset_Domain *	Fastset_DSTGetTypeDomain(PyTypeObject *type);
+extern const fastset_DomainSpecificType *Fastset_DSTFindType(PyTypeObject *type);
+
+/*
+ * Objects are usually of the domain's own member and set classes, so
+ * check for these before looking at the type's base classes
+ */
+static inline bool
+FastsetDomain_IsMember(fastset_Domain *self, PyObject *object)
+{
+	const fastset_DomainSpecificType *dst;
+
+	if (Py_TYPE(object) == self->member_class)
+		return true;
+	return ((dst = Fastset_DSTFindType(Py_TYPE(object))) != NULL && &dst->base == self->member_class);
+}
+
+static inline bool
+FastsetDomain_IsSet(fastset_Domain *self, PyObject *object)
+{
+	const fastset_DomainSpecificType *dst;
+
+	if (Py_TYPE(object) == self->set_class)
+		return true;
+	return ((dst = Fastset_DSTFindType(Py_TYPE(object))) != NULL && &dst->base == self->set_class);
+}
+
+/*
+ * Return the set's bitvec, after clearing the bits of any members
+ * that were unregistered since the set was last used. Their slots
+ * may have been handed to new members in the meantime.
+ */
+static inline fastset_bitvec_t *
+Fastset_bitvec(fastset_Set *self)
+{
+	if (self->generation != self->domain->generation)
+		Fastset_scrub(self);
+	return self->bitvec;
+}
+
+/* True if the member at index was unregistered after the given generation */
+static inline bool
+FastsetDomain_slotChanged(const fastset_Domain *self, unsigned int index, unsigned long generation)
+{
+	return index < self->size && self->slot_generation[index] > generation;
+}
 
 #endif /* FASTSETS_H */
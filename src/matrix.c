@@ -0,0 +1,374 @@
+/*
+fastsets - bit matrices
+
+Copyright (C) 2023 SUSE
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * A bit matrix keeps all of its rows in a single allocation. Every row
+ * has the same stride, which is a multiple of FASTSET_MATRIX_ALIGN_WORDS,
+ * and starts on a cache line boundary, so that the word kernels can
+ * stream over rows without any per-row bookkeeping.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "fastsets.h"
+
+static inline unsigned int
+MIN(unsigned int a, unsigned int b)
+{
+	return (a < b)? a : b;
+}
+
+static inline unsigned int
+fastset_bitvec_matrix_stride(unsigned int ncols)
+{
+	unsigned int nwords = (ncols + 63) / 64;
+
+	return (nwords + FASTSET_MATRIX_ALIGN_WORDS - 1) & ~(FASTSET_MATRIX_ALIGN_WORDS - 1);
+}
+
+static fastset_bitvec_word_t *
+fastset_bitvec_matrix_alloc(unsigned int nrows, unsigned int stride)
+{
+	size_t size = (size_t) nrows * stride * sizeof(fastset_bitvec_word_t);
+	fastset_bitvec_word_t *words;
+
+	if (size == 0)
+		return NULL;
+
+	words = aligned_alloc(FASTSET_MATRIX_ALIGN_WORDS * sizeof(fastset_bitvec_word_t), size);
+	if (words == NULL)
+		abort();
+
+	memset(words, 0, size);
+	return words;
+}
+
+void
+fastset_bitvec_matrix_init(fastset_bitvec_matrix_t *m)
+{
+	memset(m, 0, sizeof(*m));
+}
+
+void
+fastset_bitvec_matrix_destroy(fastset_bitvec_matrix_t *m)
+{
+	free(m->words);
+	memset(m, 0, sizeof(*m));
+}
+
+/*
+ * Change the dimensions of the matrix, keeping the bits that are within
+ * both the old and the new bounds.
+ */
+void
+fastset_bitvec_matrix_resize(fastset_bitvec_matrix_t *m, unsigned int nrows, unsigned int ncols)
+{
+	unsigned int stride = fastset_bitvec_matrix_stride(ncols);
+	fastset_bitvec_word_t *words;
+	unsigned int r, copy_rows, copy_words;
+
+	if (stride == m->stride && nrows <= m->nalloc) {
+		/* Rows beyond nrows may hold stale bits */
+		if (nrows > m->nrows && stride != 0)
+			memset(fastset_bitvec_matrix_row(m, m->nrows), 0, (size_t) (nrows - m->nrows) * stride * sizeof(m->words[0]));
+		m->nrows = nrows;
+	} else {
+		words = fastset_bitvec_matrix_alloc(nrows, stride);
+
+		copy_rows = MIN(nrows, m->nrows);
+		copy_words = MIN(stride, m->stride);
+		for (r = 0; r < copy_rows; ++r)
+			memcpy(words + (size_t) r * stride, fastset_bitvec_matrix_row(m, r), copy_words * sizeof(words[0]));
+
+		free(m->words);
+		m->words = words;
+		m->nrows = nrows;
+		m->nalloc = nrows;
+		m->stride = stride;
+	}
+
+	/* Clear the columns we dropped */
+	if (ncols < m->ncols && ncols / 64 < m->stride) {
+		unsigned int first = ncols / 64;
+		fastset_bitvec_word_t keep = ((fastset_bitvec_word_t) 1 << (ncols % 64)) - 1;
+
+		for (r = 0; r < m->nrows; ++r) {
+			fastset_bitvec_word_t *row = fastset_bitvec_matrix_row(m, r);
+
+			row[first] &= keep;
+			memset(row + first + 1, 0, (m->stride - first - 1) * sizeof(row[0]));
+		}
+	}
+
+	m->ncols = ncols;
+}
+
+/*
+ * Make room for nrows rows without reallocating, for matrices that grow
+ * one row at a time
+ */
+void
+fastset_bitvec_matrix_reserve(fastset_bitvec_matrix_t *m, unsigned int nrows)
+{
+	fastset_bitvec_word_t *words;
+
+	if (nrows <= m->nalloc)
+		return;
+
+	words = fastset_bitvec_matrix_alloc(nrows, m->stride);
+	if (m->words)
+		memcpy(words, m->words, (size_t) m->nrows * m->stride * sizeof(words[0]));
+
+	free(m->words);
+	m->words = words;
+	m->nalloc = nrows;
+}
+
+void
+fastset_bitvec_matrix_copy(fastset_bitvec_matrix_t *dst, const fastset_bitvec_matrix_t *src)
+{
+	fastset_bitvec_matrix_destroy(dst);
+	dst->words = fastset_bitvec_matrix_alloc(src->nrows, src->stride);
+	if (dst->words)
+		memcpy(dst->words, src->words, (size_t) src->nrows * src->stride * sizeof(src->words[0]));
+	dst->nrows = src->nrows;
+	dst->nalloc = src->nrows;
+	dst->ncols = src->ncols;
+	dst->stride = src->stride;
+}
+
+bool
+fastset_bitvec_matrix_set(fastset_bitvec_matrix_t *m, unsigned int r, unsigned int c)
+{
+	fastset_bitvec_word_t *word, mask;
+	bool rv;
+
+	assert(r < m->nrows && c < m->ncols);
+	word = fastset_bitvec_matrix_row(m, r) + c / 64;
+	mask = (fastset_bitvec_word_t) 1 << (c % 64);
+
+	rv = !!(*word & mask);
+	*word |= mask;
+	return rv;
+}
+
+bool
+fastset_bitvec_matrix_clear(fastset_bitvec_matrix_t *m, unsigned int r, unsigned int c)
+{
+	fastset_bitvec_word_t *word, mask;
+	bool rv;
+
+	if (r >= m->nrows || c >= m->ncols)
+		return false;
+
+	word = fastset_bitvec_matrix_row(m, r) + c / 64;
+	mask = (fastset_bitvec_word_t) 1 << (c % 64);
+
+	rv = !!(*word & mask);
+	*word &= ~mask;
+	return rv;
+}
+
+bool
+fastset_bitvec_matrix_test(const fastset_bitvec_matrix_t *m, unsigned int r, unsigned int c)
+{
+	if (r >= m->nrows || c >= m->ncols)
+		return false;
+
+	return (fastset_bitvec_matrix_row(m, r)[c / 64] >> (c % 64)) & 1;
+}
+
+void
+fastset_bitvec_matrix_clear_row(fastset_bitvec_matrix_t *m, unsigned int r)
+{
+	if (r < m->nrows)
+		memset(fastset_bitvec_matrix_row(m, r), 0, m->stride * sizeof(m->words[0]));
+}
+
+void
+fastset_bitvec_matrix_clear_column(fastset_bitvec_matrix_t *m, unsigned int c)
+{
+	fastset_bitvec_word_t mask = ~((fastset_bitvec_word_t) 1 << (c % 64));
+	unsigned int r;
+
+	if (c >= m->ncols)
+		return;
+
+	for (r = 0; r < m->nrows; ++r)
+		fastset_bitvec_matrix_row(m, r)[c / 64] &= mask;
+}
+
+/*
+ * Make dst the transpose of src
+ */
+void
+fastset_bitvec_matrix_transpose(fastset_bitvec_matrix_t *dst, const fastset_bitvec_matrix_t *src)
+{
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int r;
+
+	fastset_bitvec_matrix_destroy(dst);
+	fastset_bitvec_matrix_resize(dst, src->ncols, src->nrows);
+
+	for (r = 0; r < src->nrows; ++r) {
+		const fastset_bitvec_word_t *row = fastset_bitvec_matrix_row(src, r);
+		unsigned int index = 0, count, i;
+
+		while ((count = fastset_bitvec_words_extract(row, src->stride, index, 0, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+			for (i = 0; i < count; ++i)
+				fastset_bitvec_matrix_set(dst, indexes[i], r);
+			index = indexes[count - 1] + 1;
+		}
+	}
+}
+
+/*
+ * Copy row r into res
+ */
+void
+fastset_bitvec_matrix_get_row(fastset_bitvec_t *res, const fastset_bitvec_matrix_t *m, unsigned int r)
+{
+	assert(!res->compressed);
+
+	fastset_bitvec_resize(res, 0);
+	if (r >= m->nrows || m->ncols == 0)
+		return;
+
+	fastset_bitvec_resize(res, m->ncols);
+	memcpy(res->words, fastset_bitvec_matrix_row(m, r), MIN(res->nwords, m->stride) * sizeof(res->words[0]));
+	res->cardinality = -1;
+}
+
+/*
+ * Add the bits of vec to row r. The matrix must have room for them.
+ */
+void
+fastset_bitvec_matrix_update_row(fastset_bitvec_matrix_t *m, unsigned int r, const fastset_bitvec_t *vec)
+{
+	fastset_bitvec_word_t *row = fastset_bitvec_matrix_row(m, r);
+
+	assert(r < m->nrows && vec->max_index <= m->ncols);
+
+	if (vec->compressed) {
+		uint32_t indexes[FASTSET_EXTRACT_BATCH];
+		unsigned int index = 0, count, i;
+
+		while ((count = fastset_bitvec_extract(vec, index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+			for (i = 0; i < count; ++i)
+				row[indexes[i] / 64] |= (fastset_bitvec_word_t) 1 << (indexes[i] % 64);
+			index = indexes[count - 1] + 1;
+		}
+	} else {
+		fastset_bitvec_kernels->op_or(row, row, vec->words, MIN(vec->nwords, m->stride));
+	}
+}
+
+/*
+ * Compute the union of all rows selected by the bits of select
+ */
+void
+fastset_bitvec_matrix_image_into(fastset_bitvec_t *res, const fastset_bitvec_matrix_t *m, const fastset_bitvec_t *select)
+{
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int index = 0, count, i, nwords;
+
+	assert(!res->compressed);
+	assert(res != select);
+
+	fastset_bitvec_resize(res, 0);
+	if (m->ncols == 0)
+		return;
+
+	fastset_bitvec_resize(res, m->ncols);
+	nwords = MIN(res->nwords, m->stride);
+
+	while ((count = fastset_bitvec_extract(select, index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+		for (i = 0; i < count; ++i) {
+			if (indexes[i] >= m->nrows)
+				goto done;
+			fastset_bitvec_kernels->op_or(res->words, res->words, fastset_bitvec_matrix_row(m, indexes[i]), nwords);
+		}
+		index = indexes[count - 1] + 1;
+	}
+
+done:
+	res->cardinality = -1;
+}
+
+/*
+ * OR mask into every row. mask must have at least m->stride words.
+ */
+void
+fastset_bitvec_matrix_or_rows(fastset_bitvec_matrix_t *m, const fastset_bitvec_word_t *mask)
+{
+	unsigned int r;
+
+	for (r = 0; r < m->nrows; ++r) {
+		fastset_bitvec_word_t *row = fastset_bitvec_matrix_row(m, r);
+
+		fastset_bitvec_kernels->op_or(row, row, mask, m->stride);
+	}
+}
+
+void
+fastset_bitvec_matrix_row_counts(const fastset_bitvec_matrix_t *m, uint32_t *counts)
+{
+	unsigned int r;
+
+	for (r = 0; r < m->nrows; ++r)
+		counts[r] = fastset_bitvec_kernels->popcount(fastset_bitvec_matrix_row(m, r), m->stride);
+}
+
+/*
+ * Store the indices of all rows that relate to query as given by how,
+ * and return their number. query must have at least m->stride words.
+ */
+unsigned int
+fastset_bitvec_matrix_select_rows(const fastset_bitvec_matrix_t *m, const fastset_bitvec_word_t *query, int how, uint32_t *out)
+{
+	const fastset_bitvec_kernels_t *kernels = fastset_bitvec_kernels;
+	unsigned int r, count = 0;
+
+	for (r = 0; r < m->nrows; ++r) {
+		const fastset_bitvec_word_t *row = fastset_bitvec_matrix_row(m, r);
+		bool match = false;
+
+		switch (how) {
+		case FASTSET_ROWS_SUBSET:
+			match = !kernels->test_andnot(row, query, m->stride);
+			break;
+		case FASTSET_ROWS_SUPERSET:
+			match = !kernels->test_andnot(query, row, m->stride);
+			break;
+		case FASTSET_ROWS_DISJOINT:
+			match = !kernels->test_and(row, query, m->stride);
+			break;
+		case FASTSET_ROWS_INTERSECTING:
+			match = kernels->test_and(row, query, m->stride);
+			break;
+		}
+
+		if (match)
+			out[count++] = r;
+	}
+
+	return count;
+}
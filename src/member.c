@@ -19,7 +19,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "fastsets.h"
+#include <structmember.h>
 
 static PyObject *	Fastset_newMember(PyTypeObject *type, PyObject *args, PyObject *kwds);
 static int		Fastset_initMember(fastset_Member *self, PyObject *args, PyObject *kwds);
@@ -29,6 +31,11 @@ static PyMethodDef fastset_memberMethods[] = {
 	{ NULL }
 };
 
+static PyMemberDef	fastset_memberMembers[] = {
+	{ "index", T_INT, offsetof(fastset_Member, index), READONLY, "index of the member within its domain" },
+	{ NULL, }
+};
+
 PyTypeObject	fastset_MemberTypeTemplate = {
 	PyVarObject_HEAD_INIT(NULL, 0)
 
@@ -38,6 +45,7 @@ PyTypeObject	fastset_MemberTypeTemplate = {
 	.tp_doc		= NULL,
 
 	.tp_methods	= fastset_memberMethods,
+	.tp_members	= fastset_memberMembers,
 	.tp_init	= (initproc) Fastset_initMember,
 	.tp_new		= Fastset_newMember,
 	.tp_dealloc	= (destructor) Fastset_deallocMember,
@@ -87,4 +95,5 @@ Fastset_deallocMember(fastset_Member *self)
 	if (self->index >= 0)
 		FastsetDomain_unregister(self->domain, self);
 	Py_CLEAR(self->domain);
+	Py_TYPE(self)->tp_free((PyObject *) self);
 }
@@ -0,0 +1,182 @@
+/*
+fastsets - recycling allocator for bitvecs
+
+Copyright (C) 2023 SUSE
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * Every domain has a pool that keeps bitvec headers and word arrays
+ * of its sets on free lists rather than returning them to libc. Word
+ * arrays are kept per size class (ie number of words); since the sets
+ * of a domain mostly have the same size, a few classes suffice.
+ *
+ * All buffers are plain malloc'ed memory, so a buffer may be freed
+ * to a different pool than it was allocated from, or to none at all.
+ * Passing a NULL pool makes these functions fall back to libc.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "fastsets.h"
+
+/* Free list entries are linked through the first bytes of the buffer */
+typedef struct fastset_pool_item {
+	struct fastset_pool_item *next;
+} fastset_pool_item_t;
+
+void
+fastset_bitvec_pool_init(fastset_bitvec_pool_t *pool)
+{
+	memset(pool, 0, sizeof(*pool));
+}
+
+static void
+fastset_pool_drain(fastset_pool_item_t **head)
+{
+	fastset_pool_item_t *item;
+
+	while ((item = *head) != NULL) {
+		*head = item->next;
+		free(item);
+	}
+}
+
+void
+fastset_bitvec_pool_destroy(fastset_bitvec_pool_t *pool)
+{
+	unsigned int k;
+
+	for (k = 0; k < FASTSET_POOL_CLASSES; ++k)
+		fastset_pool_drain((fastset_pool_item_t **) &pool->classes[k].free);
+	fastset_pool_drain((fastset_pool_item_t **) &pool->free_headers);
+	fastset_bitvec_pool_init(pool);
+}
+
+fastset_bitvec_word_t *
+fastset_bitvec_pool_get_words(fastset_bitvec_pool_t *pool, unsigned int nwords)
+{
+	unsigned int k;
+
+	assert(nwords);
+	if (pool == NULL)
+		return malloc(nwords * sizeof(fastset_bitvec_word_t));
+
+	for (k = 0; k < FASTSET_POOL_CLASSES; ++k) {
+		struct fastset_pool_class *class = &pool->classes[k];
+		fastset_pool_item_t *item;
+
+		if (class->nwords == nwords && (item = class->free) != NULL) {
+			class->free = item->next;
+			class->count--;
+			pool->cached_bytes -= nwords * sizeof(fastset_bitvec_word_t);
+			pool->stats.words_hits++;
+			return (fastset_bitvec_word_t *) item;
+		}
+	}
+
+	pool->stats.words_misses++;
+	return malloc(nwords * sizeof(fastset_bitvec_word_t));
+}
+
+void
+fastset_bitvec_pool_put_words(fastset_bitvec_pool_t *pool, fastset_bitvec_word_t *words, unsigned int nwords)
+{
+	struct fastset_pool_class *class, *spare = NULL;
+	size_t size = nwords * sizeof(fastset_bitvec_word_t);
+	fastset_pool_item_t *item;
+	unsigned int k;
+
+	if (words == NULL)
+		return;
+
+	if (pool == NULL || pool->cached_bytes + size > FASTSET_POOL_MAX_BYTES)
+		goto release;
+
+	/* Find the class for this size, or else the one holding the
+	 * fewest buffers, which we evict. */
+	for (k = 0, class = NULL; k < FASTSET_POOL_CLASSES; ++k) {
+		if (pool->classes[k].nwords == nwords) {
+			class = &pool->classes[k];
+			break;
+		}
+		if (spare == NULL || pool->classes[k].count < spare->count)
+			spare = &pool->classes[k];
+	}
+
+	if (class == NULL) {
+		class = spare;
+		pool->cached_bytes -= class->count * class->nwords * sizeof(fastset_bitvec_word_t);
+		pool->stats.words_released += class->count;
+		fastset_pool_drain((fastset_pool_item_t **) &class->free);
+		class->count = 0;
+		class->nwords = nwords;
+	}
+
+	if (class->count >= FASTSET_POOL_MAX_FREE)
+		goto release;
+
+	item = (fastset_pool_item_t *) words;
+	item->next = class->free;
+	class->free = item;
+	class->count++;
+	pool->cached_bytes += size;
+	return;
+
+release:
+	if (pool)
+		pool->stats.words_released++;
+	free(words);
+}
+
+fastset_bitvec_t *
+fastset_bitvec_pool_get_header(fastset_bitvec_pool_t *pool)
+{
+	fastset_pool_item_t *item;
+
+	if (pool == NULL)
+		return calloc(1, sizeof(fastset_bitvec_t));
+
+	if ((item = pool->free_headers) == NULL) {
+		pool->stats.headers_misses++;
+		return calloc(1, sizeof(fastset_bitvec_t));
+	}
+
+	pool->free_headers = item->next;
+	pool->nfree_headers--;
+	pool->stats.headers_hits++;
+
+	memset(item, 0, sizeof(fastset_bitvec_t));
+	return (fastset_bitvec_t *) item;
+}
+
+void
+fastset_bitvec_pool_put_header(fastset_bitvec_pool_t *pool, fastset_bitvec_t *vec)
+{
+	fastset_pool_item_t *item = (fastset_pool_item_t *) vec;
+
+	if (pool == NULL || pool->nfree_headers >= FASTSET_POOL_MAX_HEADERS) {
+		if (pool)
+			pool->stats.headers_released++;
+		free(vec);
+		return;
+	}
+
+	item->next = pool->free_headers;
+	pool->free_headers = item;
+	pool->nfree_headers++;
+}
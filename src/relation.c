@@ -0,0 +1,597 @@
+/*
+fastsets - relation objects
+
+Copyright (C) 2023 SUSE
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * A relation maps each member of a domain to a set of members, such as
+ * the dependencies of a package. Unlike a transform, which maps every
+ * member to at most one result, a relation is stored as a square bit
+ * matrix with one row per domain slot. The image of a set is the union
+ * of the rows of its members; the preimage is computed the same way
+ * from the transposed matrix.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "fastsets.h"
+
+static inline unsigned int
+MIN(unsigned int a, unsigned int b)
+{
+	return (a < b)? a : b;
+}
+
+static inline unsigned int
+MAX(unsigned int a, unsigned int b)
+{
+	return (a > b)? a : b;
+}
+
+static PyObject *	Fastset_newRelation(PyTypeObject *type, PyObject *args, PyObject *kwds);
+static int		Fastset_initRelation(fastset_Relation *self, PyObject *args, PyObject *kwds);
+static void		Fastset_deallocRelation(fastset_Relation *self);
+static PyObject *	FastsetRelation_call(fastset_Relation *self, PyObject *args, PyObject *kwds);
+static PyObject *	FastsetRelation_add(fastset_Relation *self, PyObject *args);
+static PyObject *	FastsetRelation_discard(fastset_Relation *self, PyObject *args);
+static PyObject *	FastsetRelation_update(fastset_Relation *self, PyObject *args);
+static PyObject *	FastsetRelation_row(fastset_Relation *self, PyObject *arg);
+static PyObject *	FastsetRelation_preimage(fastset_Relation *self, PyObject *arg);
+static PyObject *	FastsetRelation_inverse(fastset_Relation *self, PyObject *unused);
+static PyObject *	FastsetRelation_reachable(fastset_Relation *self, PyObject *args, PyObject *kwds);
+static PyObject *	FastsetRelation_closure(fastset_Relation *self, PyObject *args, PyObject *kwds);
+
+static PyMethodDef fastset_relationMethods[] = {
+      { "add", (PyCFunction) FastsetRelation_add, METH_VARARGS,
+        "relate the first member to the second"
+      },
+      { "discard", (PyCFunction) FastsetRelation_discard, METH_VARARGS,
+        "remove the relation between two members, if any"
+      },
+      { "update", (PyCFunction) FastsetRelation_update, METH_VARARGS,
+        "relate a member to all members of a set"
+      },
+      { "row", (PyCFunction) FastsetRelation_row, METH_O,
+        "return the set of members a member is related to"
+      },
+      { "preimage", (PyCFunction) FastsetRelation_preimage, METH_O,
+        "return the set of all members related to any member of the given set"
+      },
+      { "inverse", (PyCFunction) FastsetRelation_inverse, METH_NOARGS,
+        "return the inverse relation"
+      },
+      { "reachable", (PyCFunction) FastsetRelation_reachable, METH_VARARGS | METH_KEYWORDS,
+        "return the set of all members reachable from the given set"
+      },
+      { "closure", (PyCFunction) FastsetRelation_closure, METH_VARARGS | METH_KEYWORDS,
+        "return the transitive closure of the relation"
+      },
+      { NULL }
+};
+
+PyTypeObject	fastset_RelationType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+
+	.tp_name	= "relation",
+	.tp_basicsize	= sizeof(fastset_Relation),
+	.tp_flags	= Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	.tp_doc		= "relation between the members of a domain",
+
+	.tp_methods	= fastset_relationMethods,
+	.tp_init	= (initproc) Fastset_initRelation,
+	.tp_new		= Fastset_newRelation,
+	.tp_dealloc	= (destructor) Fastset_deallocRelation,
+	.tp_call	= (ternaryfunc) FastsetRelation_call,
+};
+
+static void
+FastsetRelation_setDomain(fastset_Relation *self, fastset_Domain *domain)
+{
+	Py_INCREF(domain);
+	self->domain = domain;
+	FastsetDomain_link(domain, &domain->relations, &self->link);
+}
+
+static PyObject *
+Fastset_newRelation(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	fastset_Relation *self;
+
+	self = (fastset_Relation *) type->tp_alloc(type, 0);
+	if (self == NULL)
+		return NULL;
+
+	/* init members */
+	self->domain = NULL;
+	fastset_bitvec_matrix_init(&self->matrix);
+	fastset_bitvec_matrix_init(&self->transposed);
+	self->have_transposed = false;
+
+	return (PyObject *) self;
+}
+
+static int
+Fastset_initRelation(fastset_Relation *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {
+		"domain",
+		NULL
+	};
+	PyObject *domainObject = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &domainObject))
+		return -1;
+
+	if (!FastsetDomain_Check(domainObject)) {
+		PyErr_SetString(PyExc_ValueError, "first argument must be a fastset domain instance");
+		return -1;
+	}
+
+	FastsetDomain_unlink(&self->link);
+	Py_CLEAR(self->domain);
+	fastset_bitvec_matrix_destroy(&self->matrix);
+	fastset_bitvec_matrix_destroy(&self->transposed);
+	self->have_transposed = false;
+
+	FastsetRelation_setDomain(self, (fastset_Domain *) domainObject);
+	return 0;
+}
+
+static void
+Fastset_deallocRelation(fastset_Relation *self)
+{
+	FastsetDomain_unlink(&self->link);
+	Py_CLEAR(self->domain);
+
+	fastset_bitvec_matrix_destroy(&self->matrix);
+	fastset_bitvec_matrix_destroy(&self->transposed);
+
+	Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+/*
+ * Clear the rows and columns of members unregistered since the relation
+ * was last used
+ */
+static fastset_bitvec_matrix_t *
+FastsetRelation_matrix(fastset_Relation *self)
+{
+	fastset_bitvec_matrix_t *m = &self->matrix;
+	fastset_bitvec_word_t *changed, word;
+	unsigned int w, i;
+
+	if (!(changed = FastsetDomain_changedSlots(self->domain, &self->link, m->nrows)))
+		return m;
+
+	for (w = 0; w * 64 < m->nrows; ++w) {
+		for (word = changed[w]; word; word &= word - 1) {
+			i = w * 64 + __builtin_ctzll(word);
+			fastset_bitvec_matrix_clear_row(m, i);
+			fastset_bitvec_matrix_clear_column(m, i);
+		}
+	}
+	self->have_transposed = false;
+
+	free(changed);
+	return m;
+}
+
+static const fastset_bitvec_matrix_t *
+FastsetRelation_transposed(fastset_Relation *self)
+{
+	const fastset_bitvec_matrix_t *m = FastsetRelation_matrix(self);
+
+	if (!self->have_transposed) {
+		fastset_bitvec_matrix_transpose(&self->transposed, m);
+		self->have_transposed = true;
+	}
+
+	return &self->transposed;
+}
+
+/*
+ * Make room for relating the members of the first size slots. We grow
+ * along with the domain, which grows geometrically.
+ */
+static fastset_bitvec_matrix_t *
+FastsetRelation_reserve(fastset_Relation *self, unsigned int size)
+{
+	fastset_bitvec_matrix_t *m = FastsetRelation_matrix(self);
+
+	if (size > m->nrows) {
+		if (size < self->domain->nalloc)
+			size = self->domain->nalloc;
+
+		fastset_bitvec_matrix_resize(m, size, size);
+		if (self->have_transposed)
+			fastset_bitvec_matrix_resize(&self->transposed, size, size);
+	}
+
+	return m;
+}
+
+static fastset_Relation *
+FastsetRelation_checkDomain(fastset_Relation *self)
+{
+	if (self->domain == NULL) {
+		PyErr_SetString(PyExc_ValueError, "relation has no domain");
+		return NULL;
+	}
+	return self;
+}
+
+static int
+FastsetRelation_memberIndex(fastset_Relation *self, PyObject *obj, const char *name)
+{
+	fastset_Member *member;
+
+	if (!FastsetDomain_IsMember(self->domain, obj)) {
+		PyErr_Format(PyExc_ValueError, "%s is from a different domain", name);
+		return -1;
+	}
+
+	member = (fastset_Member *) obj;
+	if (member->index < 0) {
+		PyErr_Format(PyExc_RuntimeError, "%s is an uninitialized domain member", name);
+		return -1;
+	}
+
+	return member->index;
+}
+
+static fastset_Set *
+FastsetRelation_castToSet(fastset_Relation *self, PyObject *obj)
+{
+	if (!FastsetDomain_IsSet(self->domain, obj)) {
+		PyErr_SetString(PyExc_ValueError, "argument is not a set of the relation's domain");
+		return NULL;
+	}
+
+	return (fastset_Set *) obj;
+}
+
+static bool
+FastsetRelation_getPair(fastset_Relation *self, PyObject *args, int *from_p, int *to_p)
+{
+	PyObject *fromObject, *toObject;
+
+	if (!FastsetRelation_checkDomain(self))
+		return false;
+
+	if (!PyArg_ParseTuple(args, "OO", &fromObject, &toObject))
+		return false;
+
+	if ((*from_p = FastsetRelation_memberIndex(self, fromObject, "first argument")) < 0
+	 || (*to_p = FastsetRelation_memberIndex(self, toObject, "second argument")) < 0)
+		return false;
+
+	return true;
+}
+
+static PyObject *
+FastsetRelation_add(fastset_Relation *self, PyObject *args)
+{
+	fastset_bitvec_matrix_t *m;
+	int from, to;
+
+	if (!FastsetRelation_getPair(self, args, &from, &to))
+		return NULL;
+
+	m = FastsetRelation_reserve(self, MAX(from, to) + 1);
+	fastset_bitvec_matrix_set(m, from, to);
+	if (self->have_transposed)
+		fastset_bitvec_matrix_set(&self->transposed, to, from);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+FastsetRelation_discard(fastset_Relation *self, PyObject *args)
+{
+	fastset_bitvec_matrix_t *m;
+	int from, to;
+
+	if (!FastsetRelation_getPair(self, args, &from, &to))
+		return NULL;
+
+	m = FastsetRelation_matrix(self);
+	fastset_bitvec_matrix_clear(m, from, to);
+	if (self->have_transposed)
+		fastset_bitvec_matrix_clear(&self->transposed, to, from);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+FastsetRelation_update(fastset_Relation *self, PyObject *args)
+{
+	PyObject *memberObject, *setObject;
+	const fastset_bitvec_t *vec;
+	fastset_bitvec_matrix_t *m;
+	fastset_Set *set;
+	int from;
+
+	if (!FastsetRelation_checkDomain(self))
+		return NULL;
+
+	if (!PyArg_ParseTuple(args, "OO", &memberObject, &setObject))
+		return NULL;
+
+	if ((from = FastsetRelation_memberIndex(self, memberObject, "first argument")) < 0)
+		return NULL;
+
+	if (!(set = FastsetRelation_castToSet(self, setObject)))
+		return NULL;
+
+	vec = Fastset_bitvec(set);
+	m = FastsetRelation_reserve(self, MAX(from + 1, vec->max_index));
+	fastset_bitvec_matrix_update_row(m, from, vec);
+	self->have_transposed = false;
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+FastsetRelation_row(fastset_Relation *self, PyObject *arg)
+{
+	fastset_Set *result;
+	int from;
+
+	if (!FastsetRelation_checkDomain(self))
+		return NULL;
+
+	if ((from = FastsetRelation_memberIndex(self, arg, "argument")) < 0)
+		return NULL;
+
+	if ((result = Fastset_newDomainSet(self->domain)) != NULL)
+		fastset_bitvec_matrix_get_row(result->bitvec, FastsetRelation_matrix(self), from);
+
+	return (PyObject *) result;
+}
+
+/*
+ * relation(set) returns the set of all members related to any member of set
+ */
+static PyObject *
+FastsetRelation_call(fastset_Relation *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {
+		"argument",
+		NULL
+	};
+	PyObject *argObject = NULL;
+	fastset_Set *set, *result;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &argObject))
+		return NULL;
+
+	if (!FastsetRelation_checkDomain(self) || !(set = FastsetRelation_castToSet(self, argObject)))
+		return NULL;
+
+	if ((result = Fastset_newDomainSet(self->domain)) != NULL)
+		fastset_bitvec_matrix_image_into(result->bitvec, FastsetRelation_matrix(self), Fastset_bitvec(set));
+
+	return (PyObject *) result;
+}
+
+static PyObject *
+FastsetRelation_preimage(fastset_Relation *self, PyObject *arg)
+{
+	fastset_Set *set, *result;
+
+	if (!FastsetRelation_checkDomain(self) || !(set = FastsetRelation_castToSet(self, arg)))
+		return NULL;
+
+	if ((result = Fastset_newDomainSet(self->domain)) != NULL)
+		fastset_bitvec_matrix_image_into(result->bitvec, FastsetRelation_transposed(self), Fastset_bitvec(set));
+
+	return (PyObject *) result;
+}
+
+static PyObject *
+FastsetRelation_inverse(fastset_Relation *self, PyObject *unused)
+{
+	fastset_Relation *inverse;
+
+	if (!FastsetRelation_checkDomain(self))
+		return NULL;
+
+	inverse = (fastset_Relation *) Fastset_newRelation(&fastset_RelationType, NULL, NULL);
+	if (inverse == NULL)
+		return NULL;
+
+	FastsetRelation_setDomain(inverse, self->domain);
+	fastset_bitvec_matrix_copy(&inverse->matrix, FastsetRelation_transposed(self));
+	fastset_bitvec_matrix_copy(&inverse->transposed, &self->matrix);
+	inverse->have_transposed = true;
+
+	return (PyObject *) inverse;
+}
+
+/*
+ * r.reachable(set) returns all members reachable from set in one or more
+ * steps, plus the members of set itself if reflexive is true
+ */
+static PyObject *
+FastsetRelation_reachable(fastset_Relation *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {
+		"start",
+		"reflexive",
+		NULL
+	};
+	PyObject *startObject = NULL;
+	int reflexive = 0;
+	fastset_Set *start, *result;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p", kwlist, &startObject, &reflexive))
+		return NULL;
+
+	if (!FastsetRelation_checkDomain(self) || !(start = FastsetRelation_castToSet(self, startObject)))
+		return NULL;
+
+	if ((result = Fastset_newDomainSet(self->domain)) == NULL)
+		return NULL;
+
+	fastset_bitvec_matrix_reachable(result->bitvec, FastsetRelation_matrix(self), Fastset_bitvec(start));
+	if (reflexive)
+		fastset_bitvec_update_union(result->bitvec, Fastset_bitvec(start));
+
+	return (PyObject *) result;
+}
+
+/*
+ * Renumber the rows and columns of a relation matrix, for a domain of
+ * size slots
+ */
+static void
+FastsetRelation_remapMatrix(fastset_bitvec_matrix_t *m, const fastset_bitvec_transform_t *trans, unsigned int size)
+{
+	fastset_bitvec_matrix_t remapped;
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int r;
+
+	fastset_bitvec_matrix_init(&remapped);
+	fastset_bitvec_matrix_resize(&remapped, size, size);
+
+	for (r = 0; r < m->nrows && r < trans->max_index; ++r) {
+		const fastset_bitvec_word_t *row = fastset_bitvec_matrix_row(m, r);
+		unsigned int index = 0, count, i;
+		int new_row = trans->mapping[r];
+
+		if (new_row < 0)
+			continue;
+
+		while ((count = fastset_bitvec_words_extract(row, m->stride, index, 0, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+			for (i = 0; i < count; ++i) {
+				if (indexes[i] < trans->max_index && trans->mapping[indexes[i]] >= 0)
+					fastset_bitvec_matrix_set(&remapped, new_row, trans->mapping[indexes[i]]);
+			}
+			index = indexes[count - 1] + 1;
+		}
+	}
+
+	fastset_bitvec_matrix_destroy(m);
+	*m = remapped;
+}
+
+/*
+ * r.closure() returns a new relation that relates each member to all
+ * members reachable from it. The computation runs without holding the
+ * GIL, and can be spread over several threads.
+ */
+static PyObject *
+FastsetRelation_closure(fastset_Relation *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {
+		"threads",
+		NULL
+	};
+	unsigned int nthreads = 1;
+	fastset_Relation *closure;
+	fastset_Domain *domain;
+	fastset_bitvec_matrix_t m;
+	PyObject **members;
+	unsigned long generation, compactions;
+	unsigned int i, nslots;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|I", kwlist, &nthreads))
+		return NULL;
+
+	if (nthreads == 0 || nthreads > 256) {
+		PyErr_SetString(PyExc_ValueError, "number of threads must be between 1 and 256");
+		return NULL;
+	}
+
+	if (!FastsetRelation_checkDomain(self))
+		return NULL;
+	domain = self->domain;
+
+	closure = (fastset_Relation *) Fastset_newRelation(&fastset_RelationType, NULL, NULL);
+	if (closure == NULL)
+		return NULL;
+
+	/* Other threads may use the domain while we do not hold the GIL,
+	 * and compact() remaps all relations linked to it. So we work on a
+	 * matrix of our own, and link the result to the domain when done. */
+	fastset_bitvec_matrix_init(&m);
+	fastset_bitvec_matrix_copy(&m, FastsetRelation_matrix(self));
+	generation = domain->generation;
+	compactions = domain->compactions;
+
+	/* Remember the member in each slot, so that the result can follow
+	 * them if the domain is compacted meanwhile */
+	nslots = MIN(m.nrows, domain->size);
+	if (!(members = PyMem_New(PyObject *, nslots))) {
+		fastset_bitvec_matrix_destroy(&m);
+		Py_DECREF(closure);
+		return PyErr_NoMemory();
+	}
+	for (i = 0; i < nslots; ++i) {
+		members[i] = domain->domain_objects[i];
+		Py_XINCREF(members[i]);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	fastset_bitvec_matrix_closure(&m, nthreads);
+	Py_END_ALLOW_THREADS
+
+	if (domain->compactions != compactions) {
+		fastset_bitvec_transform_t *trans = fastset_bitvec_transform_new(nslots);
+
+		for (i = 0; i < nslots; ++i) {
+			fastset_Member *member = (fastset_Member *) members[i];
+
+			if (member != NULL && member->index >= 0)
+				fastset_bitvec_transform_add(trans, i, member->index);
+		}
+		FastsetRelation_remapMatrix(&m, trans, domain->size);
+		fastset_bitvec_transform_free(trans);
+	}
+
+	for (i = 0; i < nslots; ++i)
+		Py_XDECREF(members[i]);
+	PyMem_Free(members);
+
+	/* Members unregistered meanwhile are scrubbed on first use */
+	FastsetRelation_setDomain(closure, domain);
+	closure->matrix = m;
+	closure->link.generation = generation;
+
+	return (PyObject *) closure;
+}
+
+/*
+ * Renumber the rows and columns of all relations of the domain, which is
+ * being compacted
+ */
+void
+FastsetRelation_remapAll(fastset_Domain *domain, const fastset_bitvec_transform_t *trans)
+{
+	fastset_DomainLink *link;
+
+	for (link = domain->relations; link; link = link->next) {
+		fastset_Relation *self = FASTSET_LINK_OWNER(link, fastset_Relation);
+
+		FastsetRelation_remapMatrix(FastsetRelation_matrix(self), trans, domain->count);
+		fastset_bitvec_matrix_destroy(&self->transposed);
+		self->have_transposed = false;
+	}
+}
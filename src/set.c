@@ -26,77 +26,137 @@ static int		Fastset_initSet(fastset_Set *self, PyObject *args, PyObject *kwds);
 static void		Fastset_deallocSet(fastset_Set *self);
 
 static PyObject *	Fastset_getiter(fastset_Set *self);
-static PyObject *	Fastset_add(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_remove(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_discard(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_pop(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_copy(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_union(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_intersection(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_difference(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_symmetric_difference(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_update(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_intersection_update(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_difference_update(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_symmetric_difference_update(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_issubset(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_issuperset(fastset_Set *self, PyObject *args, PyObject *kwds);
-static PyObject *	Fastset_isdisjoint(fastset_Set *self, PyObject *args, PyObject *kwds);
+static PyObject *	Fastset_add(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_remove(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_discard(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_pop(fastset_Set *self, PyObject *unused);
+static PyObject *	Fastset_copy(fastset_Set *self, PyObject *unused);
+static PyObject *	Fastset_union(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs);
+static PyObject *	Fastset_intersection(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs);
+static PyObject *	Fastset_difference(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs);
+static PyObject *	Fastset_symmetric_difference(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_update(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs);
+static PyObject *	Fastset_intersection_update(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs);
+static PyObject *	Fastset_difference_update(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs);
+static PyObject *	Fastset_symmetric_difference_update(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_issubset(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_issuperset(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_isdisjoint(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_intersection_count(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_union_count(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_difference_count(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_jaccard(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_sizeof(fastset_Set *self, PyObject *unused);
+static PyObject *	Fastset_reserve(fastset_Set *self, PyObject *arg);
+static PyObject *	Fastset_shrink_to_fit(fastset_Set *self, PyObject *unused);
+static PyObject *	Fastset_to_list(fastset_Set *self, PyObject *unused);
+static PyObject *	Fastset_to_tuple(fastset_Set *self, PyObject *unused);
+static PyObject *	Fastset_to_pyset(fastset_Set *self, PyObject *unused);
+static PyObject *	Fastset_indices(fastset_Set *self, PyObject *unused);
+static PyObject *	Fastset_lazy(fastset_Set *self, PyObject *unused);
+static PyObject *	Fastset_complement(fastset_Set *self, PyObject *unused);
 static Py_ssize_t	Fastset_length(fastset_Set *);
 static PyObject *	Fastset_str(fastset_Set *);
 static PyObject *	Fastset_richcompare(fastset_Set *self, PyObject *other, int op);
 static int		Fastset_contains(fastset_Set *self, PyObject *member);
 static int		Fastset_nonempty(fastset_Set *);
+static PyObject *	Fastset_nb_or(PyObject *, PyObject *);
+static PyObject *	Fastset_nb_and(PyObject *, PyObject *);
+static PyObject *	Fastset_nb_subtract(PyObject *, PyObject *);
+static PyObject *	Fastset_nb_xor(PyObject *, PyObject *);
+static PyObject *	Fastset_nb_inplace_or(PyObject *, PyObject *);
+static PyObject *	Fastset_nb_inplace_and(PyObject *, PyObject *);
+static PyObject *	Fastset_nb_inplace_subtract(PyObject *, PyObject *);
+static PyObject *	Fastset_nb_inplace_xor(PyObject *, PyObject *);
 
 static PyMethodDef fastset_setMethods[] = {
-      { "copy", (PyCFunction) Fastset_copy, METH_VARARGS | METH_KEYWORDS,
+      { "copy", (PyCFunction) Fastset_copy, METH_NOARGS,
         "create a copy of a set"
       },
-      { "add", (PyCFunction) Fastset_add, METH_VARARGS | METH_KEYWORDS,
+      { "add", (PyCFunction) Fastset_add, METH_O,
         "add an object to the set"
       },
-      { "remove", (PyCFunction) Fastset_remove, METH_VARARGS | METH_KEYWORDS,
+      { "remove", (PyCFunction) Fastset_remove, METH_O,
         "remove an object from the set"
       },
-      { "discard", (PyCFunction) Fastset_discard, METH_VARARGS | METH_KEYWORDS,
+      { "discard", (PyCFunction) Fastset_discard, METH_O,
         "discard an object from the set"
       },
-      { "pop", (PyCFunction) Fastset_pop, METH_VARARGS | METH_KEYWORDS,
+      { "pop", (PyCFunction) Fastset_pop, METH_NOARGS,
         "pop an object from the set"
       },
-      { "union", (PyCFunction) Fastset_union, METH_VARARGS | METH_KEYWORDS,
-        "compute the union of this set with another set"
+      { "union", (PyCFunction) Fastset_union, METH_FASTCALL,
+        "compute the union of this set with other sets"
       },
-      { "intersection", (PyCFunction) Fastset_intersection, METH_VARARGS | METH_KEYWORDS,
-        "compute the intersection of this set with another set"
+      { "intersection", (PyCFunction) Fastset_intersection, METH_FASTCALL,
+        "compute the intersection of this set with other sets"
       },
-      { "difference", (PyCFunction) Fastset_difference, METH_VARARGS | METH_KEYWORDS,
-        "compute the difference of this set with another set"
+      { "difference", (PyCFunction) Fastset_difference, METH_FASTCALL,
+        "compute the difference of this set and other sets"
       },
-      { "symmetric_difference", (PyCFunction) Fastset_symmetric_difference, METH_VARARGS | METH_KEYWORDS,
+      { "symmetric_difference", (PyCFunction) Fastset_symmetric_difference, METH_O,
         "compute the symmetric difference of this set with another set"
       },
-      { "update", (PyCFunction) Fastset_update, METH_VARARGS | METH_KEYWORDS,
-        "update the set with the union of this set with another set"
+      { "update", (PyCFunction) Fastset_update, METH_FASTCALL,
+        "update the set with the union of this set with other sets"
       },
-      { "intersection_update", (PyCFunction) Fastset_intersection_update, METH_VARARGS | METH_KEYWORDS,
-        "update the set with the intersection of this set with another set"
+      { "intersection_update", (PyCFunction) Fastset_intersection_update, METH_FASTCALL,
+        "update the set with the intersection of this set with other sets"
       },
-      { "difference_update", (PyCFunction) Fastset_difference_update, METH_VARARGS | METH_KEYWORDS,
-        "update the set with the difference of this set with another set"
+      { "difference_update", (PyCFunction) Fastset_difference_update, METH_FASTCALL,
+        "update the set with the difference of this set and other sets"
       },
-      { "symmetric_difference_update", (PyCFunction) Fastset_symmetric_difference_update, METH_VARARGS | METH_KEYWORDS,
+      { "symmetric_difference_update", (PyCFunction) Fastset_symmetric_difference_update, METH_O,
         "update the set with the symmetric difference of this set with another set"
       },
-      { "issubset", (PyCFunction) Fastset_issubset, METH_VARARGS | METH_KEYWORDS,
+      { "issubset", (PyCFunction) Fastset_issubset, METH_O,
         "test whether the set is a subset of another set"
       },
-      { "issuperset", (PyCFunction) Fastset_issuperset, METH_VARARGS | METH_KEYWORDS,
+      { "issuperset", (PyCFunction) Fastset_issuperset, METH_O,
         "test whether the set is a superset of another set"
       },
-      { "isdisjoint", (PyCFunction) Fastset_isdisjoint, METH_VARARGS | METH_KEYWORDS,
+      { "isdisjoint", (PyCFunction) Fastset_isdisjoint, METH_O,
         "test whether the set is disjoint wrt another set"
       },
+      { "intersection_count", (PyCFunction) Fastset_intersection_count, METH_O,
+        "compute the size of the intersection of this set with another set"
+      },
+      { "union_count", (PyCFunction) Fastset_union_count, METH_O,
+        "compute the size of the union of this set with another set"
+      },
+      { "difference_count", (PyCFunction) Fastset_difference_count, METH_O,
+        "compute the size of the difference of this set with another set"
+      },
+      { "jaccard", (PyCFunction) Fastset_jaccard, METH_O,
+        "compute the Jaccard similarity of this set with another set"
+      },
+      { "__sizeof__", (PyCFunction) Fastset_sizeof, METH_NOARGS,
+        "return the memory used by the set, in bytes"
+      },
+      { "reserve", (PyCFunction) Fastset_reserve, METH_O,
+        "preallocate memory for the given number of domain members"
+      },
+      { "shrink_to_fit", (PyCFunction) Fastset_shrink_to_fit, METH_NOARGS,
+        "release memory not needed for the current members of the set"
+      },
+      { "to_list", (PyCFunction) Fastset_to_list, METH_NOARGS,
+        "return the members of the set as a list"
+      },
+      { "to_tuple", (PyCFunction) Fastset_to_tuple, METH_NOARGS,
+        "return the members of the set as a tuple"
+      },
+      { "to_pyset", (PyCFunction) Fastset_to_pyset, METH_NOARGS,
+        "return the members of the set as a python set"
+      },
+      { "indices", (PyCFunction) Fastset_indices, METH_NOARGS,
+        "return the domain indices of the set's members as array('I')"
+      },
+      { "complement", (PyCFunction) Fastset_complement, METH_NOARGS,
+        "compute the set of all domain members not in this set"
+      },
+      { "lazy", (PyCFunction) Fastset_lazy, METH_NOARGS,
+        "return an expression whose operators are evaluated lazily"
+      },
       { NULL, }
 };
 
@@ -107,6 +167,15 @@ static PySequenceMethods fastset_sequenceMethods = {
 
 static PyNumberMethods fastset_numberMethods = {
 	.nb_bool	= (inquiry) Fastset_nonempty,
+	.nb_or		= Fastset_nb_or,
+	.nb_and		= Fastset_nb_and,
+	.nb_subtract	= Fastset_nb_subtract,
+	.nb_xor		= Fastset_nb_xor,
+	.nb_invert	= (unaryfunc) Fastset_complement,
+	.nb_inplace_or	= Fastset_nb_inplace_or,
+	.nb_inplace_and	= Fastset_nb_inplace_and,
+	.nb_inplace_subtract = Fastset_nb_inplace_subtract,
+	.nb_inplace_xor	= Fastset_nb_inplace_xor,
 };
 
 PyTypeObject	fastset_SetTypeTemplate = {
@@ -128,20 +197,200 @@ PyTypeObject	fastset_SetTypeTemplate = {
 	.tp_str		= (reprfunc) Fastset_str,
 };
 
+/*
+ * Bitvecs are shared copy-on-write between sets (and iterators).
+ * Every function that modifies a set's bitvec in place must call
+ * this first.
+ */
+static inline fastset_bitvec_t *
+Fastset_writableBitvec(fastset_Set *self)
+{
+	if (self->generation != self->domain->generation)
+		Fastset_scrub(self);
+	return self->bitvec = fastset_bitvec_unshare(self->bitvec);
+}
+
+/*
+ * Clear the bits of all members unregistered since the set was last
+ * scrubbed. If that was recently enough, the domain's dead mask tells
+ * us which slots to look at; else we check every bit of the set.
+ */
+void
+Fastset_scrub(fastset_Set *self)
+{
+	fastset_Domain *domain = self->domain;
+	const fastset_bitvec_t *candidates;
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int index = 0, count, i;
+
+	candidates = (self->generation >= domain->dead_since)? domain->dead : self->bitvec;
+
+	while ((count = fastset_bitvec_extract(candidates, index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+		for (i = 0; i < count; ++i) {
+			if (!FastsetDomain_slotChanged(domain, indexes[i], self->generation)
+			 || !fastset_bitvec_test_bit(self->bitvec, indexes[i]))
+				continue;
+
+			/* Do not go through Fastset_writableBitvec, it would
+			 * call us again */
+			self->bitvec = fastset_bitvec_unshare(self->bitvec);
+			fastset_bitvec_clear(self->bitvec, indexes[i]);
+		}
+		index = indexes[count - 1] + 1;
+	}
+
+	self->generation = domain->generation;
+}
+
+/*
+ * Renumber the bits of all sets of the domain, which is being compacted.
+ * Sets are scrubbed first, as the slots of unregistered members may
+ * already have been reused.
+ */
+void
+Fastset_remapAll(fastset_Domain *domain, const fastset_bitvec_transform_t *trans)
+{
+	fastset_Set *self;
+
+	for (self = domain->sets; self; self = self->next_set) {
+		fastset_bitvec_t *res;
+
+		res = fastset_bitvec_new_pooled(&domain->pool, 0);
+		fastset_bitvec_transform_into(res, Fastset_bitvec(self), trans);
+
+		if (fastset_bitvec_is_embedded(self->bitvec)) {
+			fastset_bitvec_assign(self->bitvec, res);
+			fastset_bitvec_release(res);
+		} else {
+			fastset_bitvec_release(self->bitvec);
+			self->bitvec = res;
+		}
+
+		fastset_bitvec_optimize(self->bitvec);
+		fastset_bitvec_shrink_to_fit(self->bitvec);
+	}
+}
+
+/*
+ * Return a reference to our bitvec that may outlive the set object.
+ * A bitvec embedded in the set cannot be shared; if its bits are in
+ * inline storage, we hand out a copy, else we move the bits to a
+ * heap allocated bitvec first.
+ */
+static fastset_bitvec_t *
+Fastset_shareBitvec(fastset_Set *self)
+{
+	if (fastset_bitvec_is_inline(Fastset_bitvec(self)))
+		return fastset_bitvec_copy(self->bitvec);
+
+	self->bitvec = fastset_bitvec_detach(self->bitvec);
+	return fastset_bitvec_hold(self->bitvec);
+}
+
+/*
+ * Set objects of a domain's set class are recycled through a free list
+ * on the domain. Free objects are linked through their bitvec pointer.
+ */
+static inline fastset_Set **
+Fastset_freeLink(fastset_Set *self)
+{
+	return (fastset_Set **) &self->bitvec;
+}
+
+void
+Fastset_clearFreeSets(fastset_Domain *domain)
+{
+	fastset_Set *self;
+
+	while ((self = domain->free_sets) != NULL) {
+		domain->free_sets = *Fastset_freeLink(self);
+		PyObject_Free(self);
+	}
+	domain->nfree_sets = 0;
+}
+
+/*
+ * Each domain keeps a list of its live sets
+ */
+static inline void
+Fastset_link(fastset_Set *self, fastset_Domain *domain)
+{
+	if ((self->next_set = domain->sets) != NULL)
+		self->next_set->prev_set = &self->next_set;
+	self->prev_set = &domain->sets;
+	domain->sets = self;
+}
+
+static inline void
+Fastset_unlink(fastset_Set *self)
+{
+	if (self->prev_set == NULL)
+		return;
+
+	if (self->next_set)
+		self->next_set->prev_set = self->prev_set;
+	*(self->prev_set) = self->next_set;
+	self->next_set = NULL;
+	self->prev_set = NULL;
+}
+
+/*
+ * Allocate an empty set of the given type, which belongs to domain.
+ * This is the common part of tp_new and of creating result sets.
+ */
+static fastset_Set *
+Fastset_allocSet(PyTypeObject *type, fastset_Domain *domain)
+{
+	fastset_Set *self;
+
+	if (type == domain->set_class && (self = domain->free_sets) != NULL) {
+		domain->free_sets = *Fastset_freeLink(self);
+		domain->nfree_sets--;
+		PyObject_Init((PyObject *) self, type);
+	} else {
+		self = (fastset_Set *) type->tp_alloc(type, 0);
+		if (self == NULL)
+			return NULL;
+	}
+
+	/* init members. We hold a reference on the domain from the
+	 * start, because our bitvec allocates from the domain's pool. */
+	Py_INCREF(domain);
+	self->domain = domain;
+	self->generation = domain->generation;
+	Fastset_link(self, domain);
+
+	/* Sets of small domains keep their bits in the object itself */
+	if (domain->inline_words) {
+		fastset_bitvec_init_inline(&self->inline_vec, &domain->pool, self->inline_words, domain->inline_words);
+		self->bitvec = &self->inline_vec;
+	} else {
+		self->bitvec = fastset_bitvec_new_pooled(&domain->pool, 0);
+	}
+
+	return self;
+}
+
+/*
+ * Create an empty set of the domain's set class
+ */
+fastset_Set *
+Fastset_newDomainSet(fastset_Domain *domain)
+{
+	return Fastset_allocSet(domain->set_class, domain);
+}
+
 PyObject *
 Fastset_newSet(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
-	fastset_Set *self;
+	fastset_Domain *domain;
 
-	self = (fastset_Set *) type->tp_alloc(type, 0);
-	if (self == NULL)
+	if (!(domain = Fastset_DSTGetTypeDomain(type))) {
+		PyErr_SetString(PyExc_RuntimeError, "unable to locate fastset domain for this type");
 		return NULL;
+	}
 
-	/* init members */
-	self->domain = NULL;
-	self->bitvec = fastset_bitvec_new(0);
-
-	return (PyObject *) self;
+	return (PyObject *) Fastset_allocSet(type, domain);
 }
 
 int
@@ -149,19 +398,28 @@ Fastset_initSet(fastset_Set *self, PyObject *args, PyObject *kwds)
 {
 	static char *kwlist[] = {
 		"values",
+		"reserve",
 		NULL
 	};
-	fastset_Domain *domain;
 	PyObject *values = NULL;
+	unsigned int reserve = 0;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &values))
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OI", kwlist, &values, &reserve))
 		return -1;
 
-	if (!(domain = Fastset_DSTGetDomain((PyObject *) self)))
-		return -1;
+	if (values != NULL && values != Py_None && reserve == 0) {
+		Py_ssize_t hint;
 
-	Py_INCREF(domain);
-	self->domain = domain;
+		/* Size the vector for the whole domain up front, unless the
+		 * set is sparse enough to be stored in compressed form */
+		if ((hint = PyObject_LengthHint(values, 0)) < 0)
+			return -1;
+		if (!fastset_bitvec_want_compressed(self->domain->size, hint, false))
+			reserve = self->domain->size;
+	}
+
+	if (reserve)
+		fastset_bitvec_reserve(Fastset_writableBitvec(self), reserve);
 
 	if (values != NULL && values != Py_None) {
 		PyObject *iter, *member_object = NULL;
@@ -169,6 +427,8 @@ Fastset_initSet(fastset_Set *self, PyObject *args, PyObject *kwds)
 		if (!(iter = PyObject_GetIter(values)))
 			return -1;
 
+		Fastset_writableBitvec(self);
+
 		while ((member_object = PyIter_Next(iter)) != NULL) {
 			fastset_Member *member;
 
@@ -192,6 +452,8 @@ Fastset_initSet(fastset_Set *self, PyObject *args, PyObject *kwds)
 		Py_CLEAR(iter);
 		if (PyErr_Occurred())
 			return -1;
+
+		fastset_bitvec_optimize(self->bitvec);
 	}
 
 	return 0;
@@ -200,10 +462,25 @@ Fastset_initSet(fastset_Set *self, PyObject *args, PyObject *kwds)
 void
 Fastset_deallocSet(fastset_Set *self)
 {
-	if (self->domain)
-		Py_CLEAR(self->domain);
+	fastset_Domain *domain = self->domain;
+
+	Fastset_unlink(self);
+
+	/* Release the bitvec first, its storage goes back to the domain's pool */
+	if (self->bitvec)
+		fastset_bitvec_drop(&self->bitvec);
+
+	if (domain && Py_TYPE(self) == domain->set_class
+	 && domain->nfree_sets < FASTSET_SET_FREELIST_MAX) {
+		*Fastset_freeLink(self) = domain->free_sets;
+		domain->free_sets = self;
+		domain->nfree_sets++;
+	} else {
+		Py_TYPE(self)->tp_free((PyObject *) self);
+	}
 
-	fastset_bitvec_drop(&self->bitvec);
+	/* This may free the domain, and with it the free list */
+	Py_XDECREF(domain);
 }
 
 Py_ssize_t
@@ -211,7 +488,7 @@ Fastset_length(fastset_Set *self)
 {
 	if (self->bitvec == NULL)
 		return 0;
-	return fastset_bitvec_count_ones(self->bitvec);
+	return fastset_bitvec_count_ones(Fastset_bitvec(self));
 }
 
 int
@@ -220,69 +497,63 @@ Fastset_contains(fastset_Set *self, PyObject *member)
 	if (!FastsetDomain_IsMember(self->domain, member))
 		return 0;
 
-	return fastset_bitvec_test_bit(self->bitvec, ((fastset_Member *) member)->index);
+	return fastset_bitvec_test_bit(Fastset_bitvec(self), ((fastset_Member *) member)->index);
 }
 
 int
 Fastset_nonempty(fastset_Set *self)
 {
-	return !fastset_bitvec_test_empty(self->bitvec);
+	return !fastset_bitvec_test_empty(Fastset_bitvec(self));
 }
 
+/*
+ * Create the iterator directly, rather than going through the
+ * iterator type's tp_new and tp_init
+ */
 PyObject *
 Fastset_getiter(fastset_Set *self)
 {
-	PyObject *tuple, *result;
+	fastset_SetIterator *iter;
 
-	tuple = PyTuple_New(1);
+	iter = (fastset_SetIterator *) fastset_SetIteratorType.tp_alloc(&fastset_SetIteratorType, 0);
+	if (iter == NULL)
+		return NULL;
 
-	PyTuple_SetItem(tuple, 0, (PyObject *) self);
-	Py_INCREF(self);
+	iter->domain = self->domain;
+	Py_INCREF(iter->domain);
 
-	result = fastset_callType(&fastset_SetIteratorType, tuple, NULL);
+	iter->vector = Fastset_shareBitvec(self);
+	iter->generation = self->domain->generation;
+	iter->compactions = self->domain->compactions;
+	iter->index = 0;
+	iter->pos = iter->count = 0;
 
-	Py_DECREF(tuple);
-	return result;
+	return (PyObject *) iter;
 }
 
+/*
+ * Get the domain and a reference to the bitvec of a set. The caller
+ * must release the bitvec.
+ */
 static bool
 Fastset_getDomainAndBitvector(PyObject *obj, fastset_Domain **domain_p, fastset_bitvec_t **vec_p)
 {
-	PyTypeObject *type;
-
-	for (type = obj->ob_type; type; type = type->tp_base) {
-		if (type->tp_init == (initproc) Fastset_initSet) {
-			fastset_Set *set = (fastset_Set *) obj;
-
-			*domain_p = set->domain;
-			*vec_p = set->bitvec;
-			return true;
-		}
-	}
-
-	return false;
-}
+	fastset_Domain *domain;
 
-static bool
-Fastset_argsVoid(fastset_Set *self, PyObject *args, PyObject *kwds)
-{
-	static char *kwlist[] = { NULL };
+	if (!(domain = Fastset_DSTGetTypeDomain(Py_TYPE(obj))) || !FastsetDomain_IsSet(domain, obj))
+		return false;
 
-	return !!PyArg_ParseTupleAndKeywords(args, kwds, "", kwlist);
+	*domain_p = domain;
+	*vec_p = Fastset_shareBitvec((fastset_Set *) obj);
+	return true;
 }
 
+/*
+ * Set methods take their argument as METH_O; these check its type
+ */
 static fastset_Member *
-Fastset_argsToMember(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_castToMember(fastset_Set *self, PyObject *member_object)
 {
-	static char *kwlist[] = {
-		"member",
-		NULL
-	};
-	PyObject *member_object = NULL;
-
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &member_object))
-		return NULL;
-
 	if (!FastsetDomain_IsMember(self->domain, member_object)) {
 		PyErr_SetString(PyExc_RuntimeError, "argument is not compatible with domain");
 		return NULL;
@@ -294,7 +565,7 @@ Fastset_argsToMember(fastset_Set *self, PyObject *args, PyObject *kwds)
 static fastset_Set *
 Fastset_castToSet(fastset_Set *self, PyObject *other_object)
 {
-	if (self->ob_base.ob_type != other_object->ob_type) {
+	if (!FastsetDomain_IsSet(self->domain, other_object)) {
 		PyErr_SetString(PyExc_RuntimeError, "argument is not compatible with set domain");
 		return NULL;
 	}
@@ -302,21 +573,6 @@ Fastset_castToSet(fastset_Set *self, PyObject *other_object)
 	return (fastset_Set *) other_object;
 }
 
-static fastset_Set *
-Fastset_argsToSet(fastset_Set *self, PyObject *args, PyObject *kwds)
-{
-	static char *kwlist[] = {
-		"other",
-		NULL
-	};
-	PyObject *other_object = NULL;
-
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &other_object))
-		return NULL;
-
-	return Fastset_castToSet(self, other_object);
-}
-
 static PyObject *
 boolObject(bool rv)
 {
@@ -327,11 +583,11 @@ boolObject(bool rv)
 }
 
 PyObject *
-Fastset_add(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_add(fastset_Set *self, PyObject *arg)
 {
 	fastset_Member *member;
 
-	if (!(member = Fastset_argsToMember(self, args, kwds)))
+	if (!(member = Fastset_castToMember(self, arg)))
 		return NULL;
 
 	if (member->index < 0) {
@@ -339,234 +595,592 @@ Fastset_add(fastset_Set *self, PyObject *args, PyObject *kwds)
 		return NULL;
 	}
 
-	return boolObject(fastset_bitvec_set(self->bitvec, member->index));
+	/* Avoid unsharing the vector if there's nothing to do */
+	if (fastset_bitvec_test_bit(Fastset_bitvec(self), member->index))
+		return boolObject(true);
+
+	return boolObject(fastset_bitvec_set(Fastset_writableBitvec(self), member->index));
 }
 
 PyObject *
-Fastset_remove(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_remove(fastset_Set *self, PyObject *arg)
 {
 	fastset_Member *member;
 
-	if (!(member = Fastset_argsToMember(self, args, kwds)))
+	if (!(member = Fastset_castToMember(self, arg)))
 		return NULL;
 
-	if (member->index < 0 || !fastset_bitvec_clear(self->bitvec, member->index)) {
+	if (member->index < 0 || !fastset_bitvec_test_bit(Fastset_bitvec(self), member->index)) {
 		PyErr_SetObject(PyExc_KeyError, (PyObject *) member);
 		return NULL;
 	}
 
+	fastset_bitvec_clear(Fastset_writableBitvec(self), member->index);
+
 	Py_INCREF(Py_None);
 	return Py_None;
 }
 
 PyObject *
-Fastset_discard(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_discard(fastset_Set *self, PyObject *arg)
 {
 	fastset_Member *member;
 	PyObject *ret;
 
-	if (!(member = Fastset_argsToMember(self, args, kwds)))
+	if (!(member = Fastset_castToMember(self, arg)))
 		return NULL;
 
 	ret = Py_True;
-	if (member->index < 0 || !fastset_bitvec_clear(self->bitvec, member->index))
+	if (member->index < 0 || !fastset_bitvec_test_bit(Fastset_bitvec(self), member->index))
 		ret = Py_False;
+	else
+		fastset_bitvec_clear(Fastset_writableBitvec(self), member->index);
 
 	Py_INCREF(ret);
 	return ret;
 }
 
 PyObject *
-Fastset_pop(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_pop(fastset_Set *self, PyObject *unused)
 {
 	PyObject *member;
 	int next_bit = 0;
 
-	if (!Fastset_argsVoid(self, args, kwds))
-		return NULL;
-
 	do {
-		next_bit = fastset_bitvec_find_next_bit(self->bitvec, next_bit);
+		next_bit = fastset_bitvec_find_next_bit(Fastset_bitvec(self), next_bit);
 		if (next_bit < 0) {
 			Py_INCREF(Py_None);
 			return Py_None;
 		}
 
 		member = FastsetDomain_GetMember(self->domain, next_bit);
-		fastset_bitvec_clear(self->bitvec, next_bit);
+		fastset_bitvec_clear(Fastset_writableBitvec(self), next_bit);
 	} while (member == NULL);
 
 	Py_INCREF(member);
 	return member;
 }
 
+/*
+ * Create an empty set of the given set class of the domain.
+ * Subclasses defined in python may have their own constructor, so
+ * we call the type for these.
+ */
+fastset_Set *
+Fastset_newTypedSet(PyTypeObject *type, fastset_Domain *domain)
+{
+	if (type == domain->set_class)
+		return Fastset_allocSet(type, domain);
+
+	return (fastset_Set *) fastset_callType(type, NULL, NULL);
+}
+
+/*
+ * Create an empty set of the same type, to hold the result of an operation.
+ * The result is computed directly into its bitvec, so that sets of small
+ * domains never allocate anything beyond the set object.
+ */
+static fastset_Set *
+Fastset_newResult(fastset_Set *self)
+{
+	return Fastset_newTypedSet(Py_TYPE(self), self->domain);
+}
+
 static PyObject *
-Fastset_buildResult(PyTypeObject *set_type, fastset_bitvec_t *vec)
+Fastset_finishResult(fastset_Set *result)
 {
-	PyObject *result;
+	fastset_bitvec_optimize(result->bitvec);
+	return (PyObject *) result;
+}
 
-	result = fastset_callType(set_type, NULL, NULL);
-	if (result != NULL) {
-		((fastset_Set *) result)->bitvec = vec;
+PyObject *
+Fastset_copy(fastset_Set *self, PyObject *unused)
+{
+	fastset_Set *result;
+
+	if (!(result = Fastset_newResult(self)))
+		return NULL;
+
+	if (fastset_bitvec_is_inline(Fastset_bitvec(self))) {
+		/* Small sets are cheaper to copy than to share */
+		fastset_bitvec_assign(result->bitvec, Fastset_bitvec(self));
 	} else {
-		fastset_bitvec_release(vec);
+		/* The copy shares our bitvec until one of the two is modified */
+		fastset_bitvec_drop(&result->bitvec);
+		result->bitvec = Fastset_shareBitvec(self);
 	}
 
-	return result;
+	return (PyObject *) result;
 }
 
+/*
+ * Domain.universe(): the set of all live members. It shares the domain's
+ * live mask until either of them is modified, so this is cheap.
+ */
 PyObject *
-Fastset_copy(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_universe(fastset_Domain *domain)
 {
-	fastset_bitvec_t *vec = NULL;
+	fastset_Set *result;
 
-	if (!Fastset_argsVoid(self, args, kwds))
+	if (!(result = Fastset_newDomainSet(domain)))
 		return NULL;
 
-	vec = fastset_bitvec_copy(self->bitvec);
-
-	return Fastset_buildResult(self->ob_base.ob_type, vec);
+	fastset_bitvec_drop(&result->bitvec);
+	result->bitvec = fastset_bitvec_hold(domain->live);
+	return (PyObject *) result;
 }
 
 PyObject *
-Fastset_union(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_complement(fastset_Set *self, PyObject *unused)
 {
-	fastset_bitvec_t *vec = NULL;
-	fastset_Set *other;
+	fastset_Set *result;
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
+	if (!(result = Fastset_newResult(self)))
 		return NULL;
 
-	vec = fastset_bitvec_union(self->bitvec, other->bitvec);
-	return Fastset_buildResult(self->ob_base.ob_type, vec);
+	fastset_bitvec_difference_into(result->bitvec, self->domain->live, Fastset_bitvec(self));
+	return Fastset_finishResult(result);
 }
 
+/*
+ * Common implementation of the binary set operations and their in-place
+ * forms, for methods and operators alike
+ */
 static PyObject *
-Fastset_intersection(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_binop(fastset_Set *self, fastset_Set *other, int op)
 {
-	fastset_bitvec_t *vec = NULL;
-	fastset_Set *other;
+	fastset_Set *result;
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
+	if (!(result = Fastset_newResult(self)))
 		return NULL;
 
-	vec = fastset_bitvec_intersection(self->bitvec, other->bitvec);
-	return Fastset_buildResult(self->ob_base.ob_type, vec);
+	switch (op) {
+	case FASTSET_OP_OR:
+		fastset_bitvec_union_into(result->bitvec, Fastset_bitvec(self), Fastset_bitvec(other));
+		break;
+	case FASTSET_OP_AND:
+		fastset_bitvec_intersection_into(result->bitvec, Fastset_bitvec(self), Fastset_bitvec(other));
+		break;
+	case FASTSET_OP_ANDNOT:
+		fastset_bitvec_difference_into(result->bitvec, Fastset_bitvec(self), Fastset_bitvec(other));
+		break;
+	case FASTSET_OP_XOR:
+		fastset_bitvec_symmetric_difference_into(result->bitvec, Fastset_bitvec(self), Fastset_bitvec(other));
+		break;
+	}
+
+	return Fastset_finishResult(result);
+}
+
+static void
+Fastset_inplace(fastset_Set *self, fastset_Set *other, int op)
+{
+	fastset_bitvec_t *vec = Fastset_writableBitvec(self);
+
+	switch (op) {
+	case FASTSET_OP_OR:
+		fastset_bitvec_update_union(vec, Fastset_bitvec(other));
+		break;
+	case FASTSET_OP_AND:
+		fastset_bitvec_update_intersection(vec, Fastset_bitvec(other));
+		break;
+	case FASTSET_OP_ANDNOT:
+		fastset_bitvec_update_difference(vec, Fastset_bitvec(other));
+		break;
+	case FASTSET_OP_XOR:
+		fastset_bitvec_update_symmetric_difference(vec, Fastset_bitvec(other));
+		break;
+	}
+
+	fastset_bitvec_optimize(vec);
 }
 
 static PyObject *
-Fastset_difference(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_binopMethod(fastset_Set *self, PyObject *arg, int op)
 {
-	fastset_bitvec_t *vec = NULL;
 	fastset_Set *other;
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
+	if (!(other = Fastset_castToSet(self, arg)))
 		return NULL;
 
-	vec = fastset_bitvec_difference(self->bitvec, other->bitvec);
-	return Fastset_buildResult(self->ob_base.ob_type, vec);
+	return Fastset_binop(self, other, op);
 }
 
 static PyObject *
-Fastset_symmetric_difference(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_inplaceMethod(fastset_Set *self, PyObject *arg, int op)
 {
-	fastset_bitvec_t *vec = NULL;
 	fastset_Set *other;
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
+	if (!(other = Fastset_castToSet(self, arg)))
 		return NULL;
 
-	vec = fastset_bitvec_symmetric_difference(self->bitvec, other->bitvec);
-	return Fastset_buildResult(self->ob_base.ob_type, vec);
+	Fastset_inplace(self, other, op);
+
+	Py_INCREF(Py_None);
+	return Py_None;
 }
 
-PyObject *
-Fastset_update(fastset_Set *self, PyObject *args, PyObject *kwds)
+/*
+ * union(), intersection() and difference() take any number of sets, like
+ * their counterparts of python sets. The result is computed in a single
+ * pass over all arguments.
+ */
+static PyObject *
+Fastset_combineMethod(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs, int op)
 {
-	fastset_Set *other;
+	const fastset_bitvec_t *stackbuf[FASTSET_COMBINE_BATCH], **vecs = stackbuf;
+	fastset_Set *result;
+	PyObject *res = NULL;
+	Py_ssize_t i;
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
-		return NULL;
+	if (nargs == 1)
+		return Fastset_binopMethod(self, args[0], op);
+
+	if (nargs + 1 > FASTSET_COMBINE_BATCH && !(vecs = PyMem_New(const fastset_bitvec_t *, nargs + 1)))
+		return PyErr_NoMemory();
+
+	vecs[0] = Fastset_bitvec(self);
+	for (i = 0; i < nargs; ++i) {
+		fastset_Set *other;
 
-	fastset_bitvec_update_union(self->bitvec, other->bitvec);
+		if (!(other = Fastset_castToSet(self, args[i])))
+			goto out;
+		vecs[i + 1] = Fastset_bitvec(other);
+	}
+
+	if ((result = Fastset_newResult(self)) != NULL) {
+		fastset_bitvec_combine_into(result->bitvec, vecs, nargs + 1, op);
+		res = Fastset_finishResult(result);
+	}
+
+out:
+	if (vecs != stackbuf)
+		PyMem_Free(vecs);
+	return res;
+}
+
+static PyObject *
+Fastset_inplaceMulti(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs, int op)
+{
+	Py_ssize_t i;
+
+	for (i = 0; i < nargs; ++i) {
+		if (!Fastset_castToSet(self, args[i]))
+			return NULL;
+	}
+
+	for (i = 0; i < nargs; ++i)
+		Fastset_inplace(self, (fastset_Set *) args[i], op);
 
 	Py_INCREF(Py_None);
 	return Py_None;
 }
 
 PyObject *
-Fastset_intersection_update(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_union(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs)
 {
-	fastset_Set *other;
+	return Fastset_combineMethod(self, args, nargs, FASTSET_OP_OR);
+}
+
+static PyObject *
+Fastset_intersection(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs)
+{
+	return Fastset_combineMethod(self, args, nargs, FASTSET_OP_AND);
+}
+
+static PyObject *
+Fastset_difference(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs)
+{
+	return Fastset_combineMethod(self, args, nargs, FASTSET_OP_ANDNOT);
+}
+
+static PyObject *
+Fastset_symmetric_difference(fastset_Set *self, PyObject *arg)
+{
+	return Fastset_binopMethod(self, arg, FASTSET_OP_XOR);
+}
+
+PyObject *
+Fastset_update(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs)
+{
+	return Fastset_inplaceMulti(self, args, nargs, FASTSET_OP_OR);
+}
+
+PyObject *
+Fastset_intersection_update(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs)
+{
+	return Fastset_inplaceMulti(self, args, nargs, FASTSET_OP_AND);
+}
+
+PyObject *
+Fastset_difference_update(fastset_Set *self, PyObject *const *args, Py_ssize_t nargs)
+{
+	return Fastset_inplaceMulti(self, args, nargs, FASTSET_OP_ANDNOT);
+}
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
+PyObject *
+Fastset_symmetric_difference_update(fastset_Set *self, PyObject *arg)
+{
+	return Fastset_inplaceMethod(self, arg, FASTSET_OP_XOR);
+}
+
+/*
+ * Domain.union_all() and intersection_all(): combine all sets produced by
+ * an iterable. The sets are consumed in batches, each of which is combined
+ * with the result so far in a single pass. The result has the class of
+ * the first set.
+ */
+PyObject *
+Fastset_combineAll(fastset_Domain *domain, PyObject *iterable, int op)
+{
+	const fastset_bitvec_t *vecs[FASTSET_COMBINE_BATCH + 1];
+	PyObject *batch[FASTSET_COMBINE_BATCH];
+	fastset_bitvec_t *acc, *tmp;
+	unsigned int nbatch = 0, k;
+	bool empty = true;
+	PyObject *iter, *item, *res = NULL;
+	PyTypeObject *type = NULL;
+	fastset_Set *result;
+
+	if (!(iter = PyObject_GetIter(iterable)))
 		return NULL;
 
-	fastset_bitvec_update_intersection(self->bitvec, other->bitvec);
+	acc = fastset_bitvec_new_pooled(&domain->pool, 0);
+	tmp = fastset_bitvec_new_pooled(&domain->pool, 0);
 
-	Py_INCREF(Py_None);
-	return Py_None;
+	do {
+		if ((item = PyIter_Next(iter)) != NULL) {
+			if (!FastsetDomain_IsSet(domain, item)) {
+				PyErr_SetString(PyExc_RuntimeError, "argument is not compatible with domain");
+				Py_DECREF(item);
+				goto out;
+			}
+
+			if (type == NULL) {
+				type = Py_TYPE(item);
+				Py_INCREF(type);
+			}
+
+			batch[nbatch++] = item;
+			if (nbatch < FASTSET_COMBINE_BATCH)
+				continue;
+		} else if (PyErr_Occurred()) {
+			goto out;
+		}
+
+		if (nbatch) {
+			fastset_bitvec_t *swap;
+			unsigned int n = 0;
+
+			if (!empty)
+				vecs[n++] = acc;
+			for (k = 0; k < nbatch; ++k)
+				vecs[n++] = Fastset_bitvec((fastset_Set *) batch[k]);
+
+			fastset_bitvec_combine_into(tmp, vecs, n, op);
+			swap = acc;
+			acc = tmp;
+			tmp = swap;
+			empty = false;
+
+			while (nbatch)
+				Py_DECREF(batch[--nbatch]);
+		}
+	} while (item != NULL);
+
+	if (empty && op == FASTSET_OP_AND) {
+		PyErr_SetString(PyExc_ValueError, "intersection_all() of an empty iterable");
+		goto out;
+	}
+
+	if ((result = Fastset_newTypedSet(type? type : domain->set_class, domain)) != NULL) {
+		fastset_bitvec_assign(result->bitvec, acc);
+		res = Fastset_finishResult(result);
+	}
+
+out:
+	while (nbatch)
+		Py_DECREF(batch[--nbatch]);
+	fastset_bitvec_release(acc);
+	fastset_bitvec_release(tmp);
+	Py_XDECREF(type);
+	Py_DECREF(iter);
+	return res;
+}
+
+/*
+ * Number protocol: a | b, a & b, a - b, a ^ b and their in-place forms.
+ * Both operands must be sets of the same domain, but may be of different
+ * classes; the result has the class of the left operand. Operands of any
+ * other type are left to python.
+ */
+static bool
+Fastset_isOperandPair(PyObject *a, PyObject *b)
+{
+	fastset_Domain *domain;
+
+	if (!(domain = Fastset_DSTGetTypeDomain(Py_TYPE(a))) || !FastsetDomain_IsSet(domain, a))
+		return false;
+	return FastsetDomain_IsSet(domain, b);
+}
+
+static PyObject *
+Fastset_operator(PyObject *a, PyObject *b, int op)
+{
+	if (!Fastset_isOperandPair(a, b))
+		Py_RETURN_NOTIMPLEMENTED;
+
+	return Fastset_binop((fastset_Set *) a, (fastset_Set *) b, op);
+}
+
+static PyObject *
+Fastset_inplaceOperator(PyObject *a, PyObject *b, int op)
+{
+	if (!Fastset_isOperandPair(a, b))
+		Py_RETURN_NOTIMPLEMENTED;
+
+	Fastset_inplace((fastset_Set *) a, (fastset_Set *) b, op);
+
+	Py_INCREF(a);
+	return a;
+}
+
+static PyObject *
+Fastset_nb_or(PyObject *a, PyObject *b)
+{
+	return Fastset_operator(a, b, FASTSET_OP_OR);
+}
+
+static PyObject *
+Fastset_nb_and(PyObject *a, PyObject *b)
+{
+	return Fastset_operator(a, b, FASTSET_OP_AND);
+}
+
+static PyObject *
+Fastset_nb_subtract(PyObject *a, PyObject *b)
+{
+	return Fastset_operator(a, b, FASTSET_OP_ANDNOT);
+}
+
+static PyObject *
+Fastset_nb_xor(PyObject *a, PyObject *b)
+{
+	return Fastset_operator(a, b, FASTSET_OP_XOR);
+}
+
+static PyObject *
+Fastset_nb_inplace_or(PyObject *a, PyObject *b)
+{
+	return Fastset_inplaceOperator(a, b, FASTSET_OP_OR);
+}
+
+static PyObject *
+Fastset_nb_inplace_and(PyObject *a, PyObject *b)
+{
+	return Fastset_inplaceOperator(a, b, FASTSET_OP_AND);
+}
+
+static PyObject *
+Fastset_nb_inplace_subtract(PyObject *a, PyObject *b)
+{
+	return Fastset_inplaceOperator(a, b, FASTSET_OP_ANDNOT);
+}
+
+static PyObject *
+Fastset_nb_inplace_xor(PyObject *a, PyObject *b)
+{
+	return Fastset_inplaceOperator(a, b, FASTSET_OP_XOR);
 }
 
 PyObject *
-Fastset_difference_update(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_issubset(fastset_Set *self, PyObject *arg)
 {
 	fastset_Set *other;
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
+	if (!(other = Fastset_castToSet(self, arg)))
 		return NULL;
 
-	fastset_bitvec_update_difference(self->bitvec, other->bitvec);
+	return boolObject(fastset_bitvec_test_subset(Fastset_bitvec(self), Fastset_bitvec(other)));
+}
 
-	Py_INCREF(Py_None);
-	return Py_None;
+PyObject *
+Fastset_issuperset(fastset_Set *self, PyObject *arg)
+{
+	fastset_Set *other;
+
+	if (!(other = Fastset_castToSet(self, arg)))
+		return NULL;
+
+	return boolObject(fastset_bitvec_test_subset(Fastset_bitvec(other), Fastset_bitvec(self)));
 }
 
 PyObject *
-Fastset_symmetric_difference_update(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_isdisjoint(fastset_Set *self, PyObject *arg)
 {
 	fastset_Set *other;
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
+	if (!(other = Fastset_castToSet(self, arg)))
 		return NULL;
 
-	fastset_bitvec_update_symmetric_difference(self->bitvec, other->bitvec);
+	return boolObject(fastset_bitvec_test_disjoint(Fastset_bitvec(self), Fastset_bitvec(other)));
+}
 
-	Py_INCREF(Py_None);
-	return Py_None;
+/*
+ * Cardinality of set operations, computed without building the result
+ */
+PyObject *
+Fastset_intersection_count(fastset_Set *self, PyObject *arg)
+{
+	fastset_Set *other;
+
+	if (!(other = Fastset_castToSet(self, arg)))
+		return NULL;
+
+	return PyLong_FromUnsignedLong(fastset_bitvec_intersection_count(Fastset_bitvec(self), Fastset_bitvec(other)));
 }
 
 PyObject *
-Fastset_issubset(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_union_count(fastset_Set *self, PyObject *arg)
 {
 	fastset_Set *other;
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
+	if (!(other = Fastset_castToSet(self, arg)))
 		return NULL;
 
-	return boolObject(fastset_bitvec_test_subset(self->bitvec, other->bitvec));
+	return PyLong_FromUnsignedLong(fastset_bitvec_union_count(Fastset_bitvec(self), Fastset_bitvec(other)));
 }
 
 PyObject *
-Fastset_issuperset(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_difference_count(fastset_Set *self, PyObject *arg)
 {
 	fastset_Set *other;
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
+	if (!(other = Fastset_castToSet(self, arg)))
 		return NULL;
 
-	return boolObject(fastset_bitvec_test_subset(other->bitvec, self->bitvec));
+	return PyLong_FromUnsignedLong(fastset_bitvec_difference_count(Fastset_bitvec(self), Fastset_bitvec(other)));
 }
 
+/*
+ * Jaccard similarity |A & B| / |A | B|. We define the similarity of two
+ * empty sets to be 1.0
+ */
 PyObject *
-Fastset_isdisjoint(fastset_Set *self, PyObject *args, PyObject *kwds)
+Fastset_jaccard(fastset_Set *self, PyObject *arg)
 {
+	unsigned int inter, total;
 	fastset_Set *other;
 
-	if (!(other = Fastset_argsToSet(self, args, kwds)))
+	if (!(other = Fastset_castToSet(self, arg)))
 		return NULL;
 
-	return boolObject(fastset_bitvec_test_disjoint(self->bitvec, other->bitvec));
+	inter = fastset_bitvec_intersection_count(Fastset_bitvec(self), Fastset_bitvec(other));
+	total = fastset_bitvec_count_ones(Fastset_bitvec(self)) + fastset_bitvec_count_ones(Fastset_bitvec(other)) - inter;
+	if (total == 0)
+		return PyFloat_FromDouble(1.0);
+
+	return PyFloat_FromDouble((double) inter / total);
 }
 
 PyObject *
@@ -579,7 +1193,7 @@ Fastset_richcompare(fastset_Set *self, PyObject *other_object, int op)
 	if (!(other = Fastset_castToSet(self, other_object)))
 		return NULL;
 
-	relation = fastset_bitvec_compare(self->bitvec, other->bitvec);
+	relation = fastset_bitvec_compare(Fastset_bitvec(self), Fastset_bitvec(other));
 	switch (op) {
 	case Py_LT:
 		// printf("%s(Py_LT): relation %d\n", __func__, relation);
@@ -613,32 +1227,230 @@ Fastset_richcompare(fastset_Set *self, PyObject *other_object, int op)
 	return boolObject(rv);
 }
 
+PyObject *
+Fastset_sizeof(fastset_Set *self, PyObject *unused)
+{
+	size_t size;
+
+	size = Py_TYPE(self)->tp_basicsize;
+	if (self->bitvec)
+		size += fastset_bitvec_memory(self->bitvec);
+
+	return PyLong_FromSize_t(size);
+}
+
+PyObject *
+Fastset_reserve(fastset_Set *self, PyObject *arg)
+{
+	unsigned long size;
+
+	size = PyLong_AsUnsignedLong(arg);
+	if (PyErr_Occurred())
+		return NULL;
+	if (size > UINT_MAX) {
+		PyErr_SetString(PyExc_OverflowError, "size too large");
+		return NULL;
+	}
+
+	fastset_bitvec_reserve(Fastset_writableBitvec(self), size);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyObject *
+Fastset_shrink_to_fit(fastset_Set *self, PyObject *unused)
+{
+	/* This does not change the contents, so there's no need to unshare */
+	fastset_bitvec_shrink_to_fit(self->bitvec);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/*
+ * Bulk conversion to python containers. These decode the set in
+ * batches and fill a result that is sized up front.
+ */
+static Py_ssize_t
+Fastset_fillMembers(fastset_Set *self, PyObject **items, Py_ssize_t max)
+{
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int index = 0, count, i;
+	Py_ssize_t n = 0;
+
+	while (n < max && (count = fastset_bitvec_extract(Fastset_bitvec(self), index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+		for (i = 0; i < count && n < max; ++i) {
+			PyObject *member;
+
+			/* Skip members that have been removed from the domain */
+			if ((member = FastsetDomain_GetMember(self->domain, indexes[i])) == NULL)
+				continue;
+
+			Py_INCREF(member);
+			items[n++] = member;
+		}
+
+		index = indexes[count - 1] + 1;
+	}
+
+	return n;
+}
+
+PyObject *
+Fastset_to_list(fastset_Set *self, PyObject *unused)
+{
+	Py_ssize_t count, n;
+	PyObject *result;
+
+	count = fastset_bitvec_count_ones(Fastset_bitvec(self));
+	if (!(result = PyList_New(count)) || count == 0)
+		return result;
+
+	n = Fastset_fillMembers(self, &PyList_GET_ITEM(result, 0), count);
+	if (n < count && PyList_SetSlice(result, n, count, NULL) < 0) {
+		Py_DECREF(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+PyObject *
+Fastset_to_tuple(fastset_Set *self, PyObject *unused)
+{
+	Py_ssize_t count, n;
+	PyObject *result;
+
+	count = fastset_bitvec_count_ones(Fastset_bitvec(self));
+	if (!(result = PyTuple_New(count)) || count == 0)
+		return result;
+
+	n = Fastset_fillMembers(self, &PyTuple_GET_ITEM(result, 0), count);
+	if (n < count && _PyTuple_Resize(&result, n) < 0)
+		return NULL;
+
+	return result;
+}
+
+PyObject *
+Fastset_to_pyset(fastset_Set *self, PyObject *unused)
+{
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int index = 0, count, i;
+	PyObject *result;
+
+	if (!(result = PySet_New(NULL)))
+		return NULL;
+
+	while ((count = fastset_bitvec_extract(Fastset_bitvec(self), index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+		for (i = 0; i < count; ++i) {
+			PyObject *member;
+
+			if ((member = FastsetDomain_GetMember(self->domain, indexes[i])) == NULL)
+				continue;
+
+			if (PySet_Add(result, member) < 0) {
+				Py_DECREF(result);
+				return NULL;
+			}
+		}
+
+		index = indexes[count - 1] + 1;
+	}
+
+	return result;
+}
+
+/*
+ * Convert a bytes object holding uint32_t values to array('I')
+ */
+PyObject *
+Fastset_uintArray(PyObject *bytes)
+{
+	PyObject *module, *result, *rv;
+
+	result = NULL;
+	if ((module = PyImport_ImportModule("array")) != NULL) {
+		result = PyObject_CallMethod(module, "array", "s", "I");
+		Py_DECREF(module);
+	}
+
+	if (result != NULL) {
+		if ((rv = PyObject_CallMethod(result, "frombytes", "O", bytes)) == NULL)
+			Py_CLEAR(result);
+		Py_XDECREF(rv);
+	}
+
+	return result;
+}
+
+/*
+ * Return the indices of all bits set in vec, as array('I')
+ */
+PyObject *
+Fastset_bitvecIndices(const fastset_bitvec_t *vec)
+{
+	PyObject *bytes, *result;
+	unsigned int count, n = 0, done;
+	uint32_t *indexes;
+
+	count = fastset_bitvec_count_ones(vec);
+	if (!(bytes = PyBytes_FromStringAndSize(NULL, count * sizeof(uint32_t))))
+		return NULL;
+
+	indexes = (uint32_t *) PyBytes_AS_STRING(bytes);
+	while (n < count && (done = fastset_bitvec_extract(vec, n? indexes[n - 1] + 1 : 0, indexes + n, count - n)) != 0)
+		n += done;
+	assert(n == count);
+
+	result = Fastset_uintArray(bytes);
+	Py_DECREF(bytes);
+	return result;
+}
+
+/*
+ * Return the domain indices of all members. This does not look at the
+ * member objects at all.
+ */
+PyObject *
+Fastset_indices(fastset_Set *self, PyObject *unused)
+{
+	return Fastset_bitvecIndices(Fastset_bitvec(self));
+}
+
+PyObject *
+Fastset_lazy(fastset_Set *self, PyObject *unused)
+{
+	return FastsetExpression_fromSet(self);
+}
+
 /*
  * Represent set as string
  */
 PyObject *
 Fastset_str(fastset_Set *self)
 {
-	const fastset_bitvec_t *bv = self->bitvec;
-	unsigned int index = 0;
+	const fastset_bitvec_t *bv = Fastset_bitvec(self);
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int index = 0, count, i;
 	PyObject *seq = NULL, *sepa = NULL, *result = NULL;
 
 	seq = PyList_New(0);
-	while (true) {
-		int next_bit;
-		PyObject *member, *item_str;
+	while ((count = fastset_bitvec_extract(bv, index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+		for (i = 0; i < count; ++i) {
+			PyObject *member, *item_str;
 
-		next_bit = fastset_bitvec_find_next_bit(bv, index);
-		if (next_bit < 0)
-			break;
+			member = FastsetDomain_GetMember(self->domain, indexes[i]);
+			if (member == NULL)
+				continue;
 
-		member = FastsetDomain_GetMember(self->domain, next_bit);
-
-		item_str = PyObject_Str(member);
-		PyList_Append(seq, item_str);
-		Py_CLEAR(item_str);
+			item_str = PyObject_Str(member);
+			PyList_Append(seq, item_str);
+			Py_CLEAR(item_str);
+		}
 
-		index = next_bit + 1;
+		index = indexes[count - 1] + 1;
 	}
 
 	sepa = PyUnicode_FromString(" ");
@@ -656,15 +1468,25 @@ Fastset_str(fastset_Set *self)
 PyObject *
 FastsetSet_TransformBitvec(fastset_Set *self, const fastset_bitvec_transform_t *trans)
 {
-	fastset_bitvec_t *res;
+	fastset_Set *result;
 
-	res = fastset_bitvec_transform(self->bitvec, trans);
-	if (res == NULL) {
-		PyErr_SetString(PyExc_ValueError, "transformation failed");
+	if (!(result = Fastset_newResult(self)))
 		return NULL;
-	}
 
-	return Fastset_buildResult(self->ob_base.ob_type, res);
+	fastset_bitvec_transform_into(result->bitvec, Fastset_bitvec(self), trans);
+	return Fastset_finishResult(result);
+}
+
+PyObject *
+FastsetSet_PreimageBitvec(fastset_Set *self, const fastset_bitvec_transform_t *trans)
+{
+	fastset_Set *result;
+
+	if (!(result = Fastset_newResult(self)))
+		return NULL;
+
+	fastset_bitvec_preimage_into(result->bitvec, Fastset_bitvec(self), trans);
+	return Fastset_finishResult(result);
 }
 
 
@@ -709,6 +1531,7 @@ FastsetIterator_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 	self->domain = NULL;
 	self->vector = NULL;
 	self->index = 0;
+	self->pos = self->count = 0;
 
 	return (PyObject *)self;
 }
@@ -741,7 +1564,8 @@ FastsetIterator_init(fastset_SetIterator *self, PyObject *args, PyObject *kwds)
 		Py_INCREF(self->domain);
 
 		self->vector = vec;
-		fastset_bitvec_hold(vec);
+		self->generation = domain->generation;
+		self->compactions = domain->compactions;
 	}
 
 	return 0;
@@ -750,12 +1574,13 @@ FastsetIterator_init(fastset_SetIterator *self, PyObject *args, PyObject *kwds)
 static void
 FastsetIterator_dealloc(fastset_SetIterator *self)
 {
-	Py_CLEAR(self->domain);
-
 	if (self->vector) {
 		fastset_bitvec_release(self->vector);
 		self->vector = NULL;
 	}
+
+	Py_CLEAR(self->domain);
+	Py_TYPE(self)->tp_free((PyObject *) self);
 }
 
 PyObject *
@@ -771,18 +1596,34 @@ FastsetIterator_iternext(fastset_SetIterator *self)
 	PyObject *member = NULL;
 	int next_bit;
 
+	/* Indexes decoded before Domain.compact() no longer refer to the same members */
+	if (self->domain && self->compactions != self->domain->compactions) {
+		PyErr_SetString(PyExc_RuntimeError, "domain was compacted during iteration");
+		return NULL;
+	}
+
 	/* We may have to do this loop serveral times in case a member has been removed
 	 * from the domain */
 	do {
-		next_bit = fastset_bitvec_find_next_bit(self->vector, self->index);
-		if (next_bit < 0) {
-			/* raise StopIteration exception? */
-			return NULL;
+		if (self->pos >= self->count) {
+			if (self->vector == NULL)
+				return NULL;
+
+			/* Decode the next batch of members */
+			self->count = fastset_bitvec_extract(self->vector, self->index, self->batch, FASTSET_ITER_BATCH);
+			self->pos = 0;
+			if (self->count == 0) {
+				/* raise StopIteration exception? */
+				return NULL;
+			}
+			self->index = self->batch[self->count - 1] + 1;
 		}
 
+		/* Skip slots that were reused after we started */
+		next_bit = self->batch[self->pos++];
+		if (FastsetDomain_slotChanged(self->domain, next_bit, self->generation))
+			continue;
 		member = FastsetDomain_GetMember(self->domain, next_bit);
-
-		self->index = next_bit + 1;
 	} while (member == NULL);
 
 	Py_INCREF(member);
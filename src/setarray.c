@@ -0,0 +1,505 @@
+/*
+fastsets - set arrays
+
+Copyright (C) 2023 SUSE
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * A set array stores many sets of one domain as the rows of a single bit
+ * matrix, rather than as separate set objects with separate bit vectors.
+ * Operations that apply to all of these sets, such as finding the ones
+ * that are a subset of some query, then stream over one allocation.
+ *
+ * Indexing a set array returns a regular set of the domain (or of the set
+ * class given when creating the array), holding a copy of the row;
+ * assigning a set to an index stores a copy of the set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "fastsets.h"
+
+static inline unsigned int
+MAX(unsigned int a, unsigned int b)
+{
+	return (a > b)? a : b;
+}
+
+static PyObject *	Fastset_newSetArray(PyTypeObject *type, PyObject *args, PyObject *kwds);
+static int		Fastset_initSetArray(fastset_SetArray *self, PyObject *args, PyObject *kwds);
+static void		Fastset_deallocSetArray(fastset_SetArray *self);
+static Py_ssize_t	FastsetSetArray_length(fastset_SetArray *self);
+static PyObject *	FastsetSetArray_item(fastset_SetArray *self, Py_ssize_t i);
+static int		FastsetSetArray_assItem(fastset_SetArray *self, Py_ssize_t i, PyObject *value);
+static PyObject *	FastsetSetArray_append(fastset_SetArray *self, PyObject *arg);
+static PyObject *	FastsetSetArray_updateAll(fastset_SetArray *self, PyObject *arg);
+static PyObject *	FastsetSetArray_counts(fastset_SetArray *self, PyObject *unused);
+static PyObject *	FastsetSetArray_subsetsOf(fastset_SetArray *self, PyObject *arg);
+static PyObject *	FastsetSetArray_supersetsOf(fastset_SetArray *self, PyObject *arg);
+static PyObject *	FastsetSetArray_disjointFrom(fastset_SetArray *self, PyObject *arg);
+static PyObject *	FastsetSetArray_intersecting(fastset_SetArray *self, PyObject *arg);
+
+static PyMethodDef fastset_setArrayMethods[] = {
+      { "append", (PyCFunction) FastsetSetArray_append, METH_O,
+        "append a copy of a set"
+      },
+      { "update_all", (PyCFunction) FastsetSetArray_updateAll, METH_O,
+        "add the members of a set to all sets of the array"
+      },
+      { "counts", (PyCFunction) FastsetSetArray_counts, METH_NOARGS,
+        "return the size of each set as array('I')"
+      },
+      { "subsets_of", (PyCFunction) FastsetSetArray_subsetsOf, METH_O,
+        "return the positions of all sets that are a subset of the argument"
+      },
+      { "supersets_of", (PyCFunction) FastsetSetArray_supersetsOf, METH_O,
+        "return the positions of all sets that are a superset of the argument"
+      },
+      { "disjoint_from", (PyCFunction) FastsetSetArray_disjointFrom, METH_O,
+        "return the positions of all sets that have no member in common with the argument"
+      },
+      { "intersecting", (PyCFunction) FastsetSetArray_intersecting, METH_O,
+        "return the positions of all sets that have some member in common with the argument"
+      },
+      { NULL }
+};
+
+static PySequenceMethods fastset_setArraySequenceMethods = {
+	.sq_length	= (lenfunc) FastsetSetArray_length,
+	.sq_item	= (ssizeargfunc) FastsetSetArray_item,
+	.sq_ass_item	= (ssizeobjargproc) FastsetSetArray_assItem,
+};
+
+PyTypeObject	fastset_SetArrayType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+
+	.tp_name	= "set_array",
+	.tp_basicsize	= sizeof(fastset_SetArray),
+	.tp_flags	= Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	.tp_doc		= "array of sets of a domain, stored as a bit matrix",
+
+	.tp_methods	= fastset_setArrayMethods,
+	.tp_as_sequence	= &fastset_setArraySequenceMethods,
+	.tp_init	= (initproc) Fastset_initSetArray,
+	.tp_new		= Fastset_newSetArray,
+	.tp_dealloc	= (destructor) Fastset_deallocSetArray,
+};
+
+static PyObject *
+Fastset_newSetArray(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	fastset_SetArray *self;
+
+	self = (fastset_SetArray *) type->tp_alloc(type, 0);
+	if (self == NULL)
+		return NULL;
+
+	/* init members */
+	self->domain = NULL;
+	self->set_class = NULL;
+	fastset_bitvec_matrix_init(&self->matrix);
+
+	return (PyObject *) self;
+}
+
+/*
+ * Clear the columns of members unregistered since the array was last
+ * used
+ */
+static fastset_bitvec_matrix_t *
+FastsetSetArray_matrix(fastset_SetArray *self)
+{
+	fastset_bitvec_matrix_t *m = &self->matrix;
+	fastset_bitvec_word_t *changed;
+	unsigned int r;
+
+	if (!(changed = FastsetDomain_changedSlots(self->domain, &self->link, m->ncols)))
+		return m;
+
+	for (r = 0; r < m->nrows; ++r) {
+		fastset_bitvec_word_t *row = fastset_bitvec_matrix_row(m, r);
+
+		fastset_bitvec_kernels->op_andnot(row, row, changed, (m->ncols + 63) / 64);
+	}
+
+	free(changed);
+	return m;
+}
+
+/*
+ * Make room for the members of the first ncols slots. Like relations, we
+ * grow along with the domain.
+ */
+static fastset_bitvec_matrix_t *
+FastsetSetArray_reserveColumns(fastset_SetArray *self, unsigned int ncols)
+{
+	fastset_bitvec_matrix_t *m = FastsetSetArray_matrix(self);
+
+	if (ncols > m->ncols)
+		fastset_bitvec_matrix_resize(m, m->nrows, MAX(ncols, self->domain->nalloc));
+
+	return m;
+}
+
+static fastset_Set *
+FastsetSetArray_castToSet(fastset_SetArray *self, PyObject *obj)
+{
+	if (!FastsetDomain_IsSet(self->domain, obj)) {
+		PyErr_SetString(PyExc_ValueError, "argument is not a set of the array's domain");
+		return NULL;
+	}
+
+	return (fastset_Set *) obj;
+}
+
+static void
+FastsetSetArray_storeRow(fastset_SetArray *self, unsigned int r, const fastset_bitvec_t *vec)
+{
+	fastset_bitvec_matrix_t *m = FastsetSetArray_reserveColumns(self, vec->max_index);
+
+	fastset_bitvec_matrix_clear_row(m, r);
+	fastset_bitvec_matrix_update_row(m, r, vec);
+}
+
+static bool
+FastsetSetArray_appendSet(fastset_SetArray *self, PyObject *setObject)
+{
+	const fastset_bitvec_t *vec;
+	fastset_bitvec_matrix_t *m;
+	fastset_Set *set;
+
+	if (!(set = FastsetSetArray_castToSet(self, setObject)))
+		return false;
+
+	vec = Fastset_bitvec(set);
+	m = FastsetSetArray_reserveColumns(self, vec->max_index);
+
+	if (m->nrows == m->nalloc)
+		fastset_bitvec_matrix_reserve(m, MAX(16, 2 * m->nalloc));
+	fastset_bitvec_matrix_resize(m, m->nrows + 1, m->ncols);
+	fastset_bitvec_matrix_update_row(m, m->nrows - 1, vec);
+	return true;
+}
+
+static int
+Fastset_initSetArray(fastset_SetArray *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {
+		"domain",
+		"sets",
+		"type",
+		NULL
+	};
+	PyObject *domainObject = NULL, *setsObject = NULL;
+	PyTypeObject *type = NULL;
+	fastset_Domain *domain;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OO!", kwlist, &domainObject, &setsObject, &PyType_Type, &type))
+		return -1;
+
+	if (!FastsetDomain_Check(domainObject)) {
+		PyErr_SetString(PyExc_ValueError, "first argument must be a fastset domain instance");
+		return -1;
+	}
+
+	domain = (fastset_Domain *) domainObject;
+	if (type == NULL)
+		type = domain->set_class;
+	else if (!PyType_IsSubtype(type, domain->set_class)) {
+		PyErr_SetString(PyExc_TypeError, "type is not a set class of this domain");
+		return -1;
+	}
+
+	FastsetDomain_unlink(&self->link);
+	Py_CLEAR(self->domain);
+	Py_CLEAR(self->set_class);
+	fastset_bitvec_matrix_destroy(&self->matrix);
+
+	Py_INCREF(type);
+	self->set_class = type;
+	Py_INCREF(domain);
+	self->domain = domain;
+	FastsetDomain_link(domain, &domain->set_arrays, &self->link);
+
+	if (setsObject == NULL)
+		return 0;
+
+	/* SetArray(domain, n) creates n empty sets */
+	if (PyLong_Check(setsObject)) {
+		long count = PyLong_AsLong(setsObject);
+
+		if (count < 0 || count > UINT_MAX) {
+			if (!PyErr_Occurred())
+				PyErr_SetString(PyExc_ValueError, "invalid number of sets");
+			return -1;
+		}
+
+		fastset_bitvec_matrix_resize(&self->matrix, count, domain->nalloc);
+	} else {
+		PyObject *iter, *item;
+
+		if (!(iter = PyObject_GetIter(setsObject)))
+			return -1;
+
+		while ((item = PyIter_Next(iter)) != NULL) {
+			bool okay = FastsetSetArray_appendSet(self, item);
+
+			Py_DECREF(item);
+			if (!okay)
+				break;
+		}
+		Py_DECREF(iter);
+
+		if (PyErr_Occurred())
+			return -1;
+	}
+
+	return 0;
+}
+
+static void
+Fastset_deallocSetArray(fastset_SetArray *self)
+{
+	FastsetDomain_unlink(&self->link);
+	Py_CLEAR(self->domain);
+	Py_CLEAR(self->set_class);
+
+	fastset_bitvec_matrix_destroy(&self->matrix);
+
+	Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static fastset_SetArray *
+FastsetSetArray_checkDomain(fastset_SetArray *self)
+{
+	if (self->domain == NULL) {
+		PyErr_SetString(PyExc_ValueError, "set array has no domain");
+		return NULL;
+	}
+	return self;
+}
+
+static Py_ssize_t
+FastsetSetArray_length(fastset_SetArray *self)
+{
+	return self->matrix.nrows;
+}
+
+static bool
+FastsetSetArray_checkIndex(fastset_SetArray *self, Py_ssize_t i)
+{
+	if (i < 0 || i >= self->matrix.nrows) {
+		PyErr_SetString(PyExc_IndexError, "set array index out of range");
+		return false;
+	}
+	return true;
+}
+
+static PyObject *
+FastsetSetArray_item(fastset_SetArray *self, Py_ssize_t i)
+{
+	fastset_Set *result;
+
+	if (!FastsetSetArray_checkDomain(self) || !FastsetSetArray_checkIndex(self, i))
+		return NULL;
+
+	if (!(result = Fastset_newTypedSet(self->set_class, self->domain)))
+		return NULL;
+
+	fastset_bitvec_matrix_get_row(result->bitvec, FastsetSetArray_matrix(self), i);
+	fastset_bitvec_optimize(result->bitvec);
+	return (PyObject *) result;
+}
+
+static int
+FastsetSetArray_assItem(fastset_SetArray *self, Py_ssize_t i, PyObject *value)
+{
+	fastset_Set *set;
+
+	if (!FastsetSetArray_checkDomain(self) || !FastsetSetArray_checkIndex(self, i))
+		return -1;
+
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "cannot delete the sets of a set array");
+		return -1;
+	}
+
+	if (!(set = FastsetSetArray_castToSet(self, value)))
+		return -1;
+
+	FastsetSetArray_storeRow(self, i, Fastset_bitvec(set));
+	return 0;
+}
+
+static PyObject *
+FastsetSetArray_append(fastset_SetArray *self, PyObject *arg)
+{
+	if (!FastsetSetArray_checkDomain(self) || !FastsetSetArray_appendSet(self, arg))
+		return NULL;
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+FastsetSetArray_updateAll(fastset_SetArray *self, PyObject *arg)
+{
+	const fastset_bitvec_t *vec;
+	fastset_bitvec_matrix_t *m, mask;
+	fastset_Set *set;
+
+	if (!FastsetSetArray_checkDomain(self) || !(set = FastsetSetArray_castToSet(self, arg)))
+		return NULL;
+
+	vec = Fastset_bitvec(set);
+	m = FastsetSetArray_reserveColumns(self, vec->max_index);
+
+	fastset_bitvec_matrix_init(&mask);
+	fastset_bitvec_matrix_resize(&mask, 1, m->ncols);
+	fastset_bitvec_matrix_update_row(&mask, 0, vec);
+	fastset_bitvec_matrix_or_rows(m, mask.words);
+	fastset_bitvec_matrix_destroy(&mask);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+FastsetSetArray_counts(fastset_SetArray *self, PyObject *unused)
+{
+	const fastset_bitvec_matrix_t *m;
+	PyObject *bytes, *result;
+
+	if (!FastsetSetArray_checkDomain(self))
+		return NULL;
+
+	m = FastsetSetArray_matrix(self);
+	if (!(bytes = PyBytes_FromStringAndSize(NULL, m->nrows * sizeof(uint32_t))))
+		return NULL;
+
+	fastset_bitvec_matrix_row_counts(m, (uint32_t *) PyBytes_AS_STRING(bytes));
+
+	result = Fastset_uintArray(bytes);
+	Py_DECREF(bytes);
+	return result;
+}
+
+/*
+ * Return the positions of all sets that relate to the query set as
+ * given by how, as array('I')
+ */
+static PyObject *
+FastsetSetArray_select(fastset_SetArray *self, PyObject *arg, int how)
+{
+	const fastset_bitvec_matrix_t *m;
+	const fastset_bitvec_t *vec;
+	fastset_bitvec_matrix_t query;
+	PyObject *bytes, *result;
+	unsigned int count = 0;
+	uint32_t *rows;
+	fastset_Set *set;
+
+	if (!FastsetSetArray_checkDomain(self) || !(set = FastsetSetArray_castToSet(self, arg)))
+		return NULL;
+
+	vec = Fastset_bitvec(set);
+	m = FastsetSetArray_matrix(self);
+
+	rows = PyMem_New(uint32_t, m->nrows? m->nrows : 1);
+	if (rows == NULL)
+		return PyErr_NoMemory();
+
+	/* No set has members beyond the array's columns */
+	if (how != FASTSET_ROWS_SUPERSET || fastset_bitvec_find_next_bit(vec, m->ncols) < 0) {
+		fastset_bitvec_matrix_init(&query);
+		fastset_bitvec_matrix_resize(&query, 1, MAX(m->ncols, vec->max_index));
+		fastset_bitvec_matrix_update_row(&query, 0, vec);
+		count = fastset_bitvec_matrix_select_rows(m, query.words, how, rows);
+		fastset_bitvec_matrix_destroy(&query);
+	}
+
+	bytes = PyBytes_FromStringAndSize((const char *) rows, count * sizeof(uint32_t));
+	PyMem_Free(rows);
+	if (bytes == NULL)
+		return NULL;
+
+	result = Fastset_uintArray(bytes);
+	Py_DECREF(bytes);
+	return result;
+}
+
+static PyObject *
+FastsetSetArray_subsetsOf(fastset_SetArray *self, PyObject *arg)
+{
+	return FastsetSetArray_select(self, arg, FASTSET_ROWS_SUBSET);
+}
+
+static PyObject *
+FastsetSetArray_supersetsOf(fastset_SetArray *self, PyObject *arg)
+{
+	return FastsetSetArray_select(self, arg, FASTSET_ROWS_SUPERSET);
+}
+
+static PyObject *
+FastsetSetArray_disjointFrom(fastset_SetArray *self, PyObject *arg)
+{
+	return FastsetSetArray_select(self, arg, FASTSET_ROWS_DISJOINT);
+}
+
+static PyObject *
+FastsetSetArray_intersecting(fastset_SetArray *self, PyObject *arg)
+{
+	return FastsetSetArray_select(self, arg, FASTSET_ROWS_INTERSECTING);
+}
+
+/*
+ * Renumber the columns of all set arrays of the domain, which is being
+ * compacted
+ */
+void
+FastsetSetArray_remapAll(fastset_Domain *domain, const fastset_bitvec_transform_t *trans)
+{
+	fastset_DomainLink *link;
+
+	for (link = domain->set_arrays; link; link = link->next) {
+		fastset_SetArray *self = FASTSET_LINK_OWNER(link, fastset_SetArray);
+		const fastset_bitvec_matrix_t *m = FastsetSetArray_matrix(self);
+		fastset_bitvec_matrix_t remapped;
+		uint32_t indexes[FASTSET_EXTRACT_BATCH];
+		unsigned int r;
+
+		fastset_bitvec_matrix_init(&remapped);
+		fastset_bitvec_matrix_resize(&remapped, m->nrows, domain->count);
+
+		for (r = 0; r < m->nrows; ++r) {
+			const fastset_bitvec_word_t *row = fastset_bitvec_matrix_row(m, r);
+			unsigned int index = 0, count, i;
+
+			while ((count = fastset_bitvec_words_extract(row, m->stride, index, 0, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+				for (i = 0; i < count; ++i) {
+					if (indexes[i] < trans->max_index && trans->mapping[indexes[i]] >= 0)
+						fastset_bitvec_matrix_set(&remapped, r, trans->mapping[indexes[i]]);
+				}
+				index = indexes[count - 1] + 1;
+			}
+		}
+
+		fastset_bitvec_matrix_destroy(&self->matrix);
+		self->matrix = remapped;
+	}
+}
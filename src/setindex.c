@@ -0,0 +1,500 @@
+/*
+fastsets - set indexes
+
+Copyright (C) 2023 SUSE
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * A set index answers containment queries over a collection of stored
+ * sets, which are identified by the order in which they were added.
+ * It is an inverted index: for each member of the domain, a bit vector
+ * of the ids of all stored sets that contain it. With these,
+ *
+ *  - the sets containing all members of q are the intersection of the
+ *    vectors of the members of q;
+ *  - the sets containing any member of q are their union;
+ *  - the subsets of q are all sets, minus the vectors of the members
+ *    that are not in q.
+ *
+ * The vectors of rare members are sparse, and usually compressed.
+ * Intersections are computed by fastset_bitvec_combine_into(), which
+ * starts with the smallest vector. Unions and differences are applied
+ * to a flat vector of all ids, one word at a time for flat vectors and
+ * one id at a time for compressed ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "fastsets.h"
+
+static PyObject *	Fastset_newSetIndex(PyTypeObject *type, PyObject *args, PyObject *kwds);
+static int		Fastset_initSetIndex(fastset_SetIndex *self, PyObject *args, PyObject *kwds);
+static void		Fastset_deallocSetIndex(fastset_SetIndex *self);
+static Py_ssize_t	FastsetSetIndex_length(fastset_SetIndex *self);
+static PyObject *	FastsetSetIndex_add(fastset_SetIndex *self, PyObject *arg);
+static PyObject *	FastsetSetIndex_subsetsOf(fastset_SetIndex *self, PyObject *arg);
+static PyObject *	FastsetSetIndex_supersetsOf(fastset_SetIndex *self, PyObject *arg);
+static PyObject *	FastsetSetIndex_intersecting(fastset_SetIndex *self, PyObject *arg);
+
+static PyMethodDef fastset_setIndexMethods[] = {
+      { "add", (PyCFunction) FastsetSetIndex_add, METH_O,
+        "add a set to the index, and return its id"
+      },
+      { "subsets_of", (PyCFunction) FastsetSetIndex_subsetsOf, METH_O,
+        "return the ids of all stored sets that are a subset of the argument"
+      },
+      { "supersets_of", (PyCFunction) FastsetSetIndex_supersetsOf, METH_O,
+        "return the ids of all stored sets that contain all members of the argument"
+      },
+      { "intersecting", (PyCFunction) FastsetSetIndex_intersecting, METH_O,
+        "return the ids of all stored sets that have some member in common with the argument"
+      },
+      { NULL }
+};
+
+static PySequenceMethods fastset_setIndexSequenceMethods = {
+	.sq_length	= (lenfunc) FastsetSetIndex_length,
+};
+
+PyTypeObject	fastset_SetIndexType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+
+	.tp_name	= "set_index",
+	.tp_basicsize	= sizeof(fastset_SetIndex),
+	.tp_flags	= Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	.tp_doc		= "containment index over a collection of sets of a domain",
+
+	.tp_methods	= fastset_setIndexMethods,
+	.tp_as_sequence	= &fastset_setIndexSequenceMethods,
+	.tp_init	= (initproc) Fastset_initSetIndex,
+	.tp_new		= Fastset_newSetIndex,
+	.tp_dealloc	= (destructor) Fastset_deallocSetIndex,
+};
+
+static void
+FastsetSetIndex_clear(fastset_SetIndex *self)
+{
+	unsigned int i;
+
+	for (i = 0; i < self->npostings; ++i)
+		fastset_bitvec_drop(&self->postings[i]);
+	free(self->postings);
+	self->postings = NULL;
+	self->npostings = 0;
+
+	fastset_bitvec_drop(&self->all);
+	self->count = 0;
+}
+
+static PyObject *
+Fastset_newSetIndex(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	fastset_SetIndex *self;
+
+	self = (fastset_SetIndex *) type->tp_alloc(type, 0);
+	if (self == NULL)
+		return NULL;
+
+	/* init members */
+	self->domain = NULL;
+	self->npostings = 0;
+	self->postings = NULL;
+	self->all = NULL;
+	self->count = 0;
+
+	return (PyObject *) self;
+}
+
+static void
+Fastset_deallocSetIndex(fastset_SetIndex *self)
+{
+	FastsetDomain_unlink(&self->link);
+	FastsetSetIndex_clear(self);
+	Py_CLEAR(self->domain);
+
+	Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+/*
+ * Drop the postings of members unregistered since the index was last
+ * used
+ */
+static void
+FastsetSetIndex_scrub(fastset_SetIndex *self)
+{
+	fastset_bitvec_word_t *changed, word;
+	unsigned int w;
+
+	if (!(changed = FastsetDomain_changedSlots(self->domain, &self->link, self->npostings)))
+		return;
+
+	for (w = 0; w * 64 < self->npostings; ++w) {
+		for (word = changed[w]; word; word &= word - 1)
+			fastset_bitvec_drop(&self->postings[w * 64 + __builtin_ctzll(word)]);
+	}
+
+	free(changed);
+}
+
+static inline const fastset_bitvec_t *
+FastsetSetIndex_posting(const fastset_SetIndex *self, unsigned int slot)
+{
+	return slot < self->npostings? self->postings[slot] : NULL;
+}
+
+static fastset_Set *
+FastsetSetIndex_castToSet(fastset_SetIndex *self, PyObject *obj)
+{
+	if (self->domain == NULL) {
+		PyErr_SetString(PyExc_ValueError, "set index has no domain");
+		return NULL;
+	}
+
+	if (!FastsetDomain_IsSet(self->domain, obj)) {
+		PyErr_SetString(PyExc_ValueError, "argument is not a set of the index's domain");
+		return NULL;
+	}
+
+	return (fastset_Set *) obj;
+}
+
+static int
+FastsetSetIndex_addSet(fastset_SetIndex *self, PyObject *setObject)
+{
+	fastset_Domain *domain = self->domain;
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int index = 0, count, i, id;
+	const fastset_bitvec_t *vec;
+	fastset_Set *set;
+
+	if (!(set = FastsetSetIndex_castToSet(self, setObject)))
+		return -1;
+
+	FastsetSetIndex_scrub(self);
+
+	vec = Fastset_bitvec(set);
+	if (vec->max_index > self->npostings) {
+		unsigned int npostings = vec->max_index;
+
+		/* Grow along with the domain */
+		if (npostings < domain->nalloc)
+			npostings = domain->nalloc;
+
+		self->postings = realloc(self->postings, npostings * sizeof(self->postings[0]));
+		if (self->postings == NULL)
+			abort();
+		memset(self->postings + self->npostings, 0, (npostings - self->npostings) * sizeof(self->postings[0]));
+		self->npostings = npostings;
+	}
+
+	id = self->count++;
+	while ((count = fastset_bitvec_extract(vec, index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+		for (i = 0; i < count; ++i) {
+			fastset_bitvec_t **posting = &self->postings[indexes[i]];
+
+			if (*posting == NULL)
+				*posting = fastset_bitvec_new_pooled(&domain->pool, 0);
+			fastset_bitvec_set(*posting, id);
+		}
+		index = indexes[count - 1] + 1;
+	}
+
+	fastset_bitvec_set(self->all, id);
+	return id;
+}
+
+static int
+Fastset_initSetIndex(fastset_SetIndex *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {
+		"domain",
+		"sets",
+		NULL
+	};
+	PyObject *domainObject = NULL, *setsObject = NULL;
+	fastset_Domain *domain;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &domainObject, &setsObject))
+		return -1;
+
+	if (!FastsetDomain_Check(domainObject)) {
+		PyErr_SetString(PyExc_ValueError, "first argument must be a fastset domain instance");
+		return -1;
+	}
+
+	FastsetDomain_unlink(&self->link);
+	FastsetSetIndex_clear(self);
+	Py_CLEAR(self->domain);
+
+	domain = (fastset_Domain *) domainObject;
+	Py_INCREF(domain);
+	self->domain = domain;
+	self->all = fastset_bitvec_new_pooled(&domain->pool, 0);
+	FastsetDomain_link(domain, &domain->set_indexes, &self->link);
+
+	if (setsObject != NULL) {
+		PyObject *iter, *item;
+
+		if (!(iter = PyObject_GetIter(setsObject)))
+			return -1;
+
+		while ((item = PyIter_Next(iter)) != NULL) {
+			int id = FastsetSetIndex_addSet(self, item);
+
+			Py_DECREF(item);
+			if (id < 0)
+				break;
+		}
+		Py_DECREF(iter);
+
+		if (PyErr_Occurred())
+			return -1;
+	}
+
+	return 0;
+}
+
+static Py_ssize_t
+FastsetSetIndex_length(fastset_SetIndex *self)
+{
+	return self->count;
+}
+
+static PyObject *
+FastsetSetIndex_add(fastset_SetIndex *self, PyObject *arg)
+{
+	int id;
+
+	if ((id = FastsetSetIndex_addSet(self, arg)) < 0)
+		return NULL;
+
+	return PyLong_FromLong(id);
+}
+
+/*
+ * res = start OP args[0] OP args[1] ..., where start is either no ids
+ * (for OR) or all ids (for ANDNOT)
+ */
+static void
+FastsetSetIndex_accumulate(fastset_SetIndex *self, fastset_bitvec_t *res, const fastset_bitvec_t **args, unsigned int nargs, int op)
+{
+	const fastset_bitvec_kernels_t *kernels = fastset_bitvec_kernels;
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int k, w;
+
+	fastset_bitvec_resize(res, self->count);
+	if (res->nwords == 0)
+		return;
+
+	if (op == FASTSET_OP_ANDNOT) {
+		w = self->count / 64;
+		memset(res->words, 0xff, w * sizeof(res->words[0]));
+		if (w < res->nwords) {
+			res->words[w] = ((fastset_bitvec_word_t) 1 << (self->count % 64)) - 1;
+			memset(res->words + w + 1, 0, (res->nwords - w - 1) * sizeof(res->words[0]));
+		}
+	}
+
+	for (k = 0; k < nargs; ++k) {
+		const fastset_bitvec_t *posting = args[k];
+		unsigned int index = 0, count, i;
+
+		if (!posting->compressed) {
+			w = posting->nwords < res->nwords? posting->nwords : res->nwords;
+			if (op == FASTSET_OP_OR)
+				kernels->op_or(res->words, res->words, posting->words, w);
+			else
+				kernels->op_andnot(res->words, res->words, posting->words, w);
+			continue;
+		}
+
+		while ((count = fastset_bitvec_extract(posting, index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+			for (i = 0; i < count; ++i) {
+				fastset_bitvec_word_t mask = (fastset_bitvec_word_t) 1 << (indexes[i] % 64);
+
+				if (op == FASTSET_OP_OR)
+					res->words[indexes[i] / 64] |= mask;
+				else
+					res->words[indexes[i] / 64] &= ~mask;
+			}
+			index = indexes[count - 1] + 1;
+		}
+	}
+
+	res->cardinality = -1;
+}
+
+/*
+ * Combine the postings collected in args, and return the ids of the
+ * result
+ */
+static PyObject *
+FastsetSetIndex_result(fastset_SetIndex *self, const fastset_bitvec_t **args, unsigned int nargs, int op)
+{
+	fastset_bitvec_t *res;
+	PyObject *result;
+
+	res = fastset_bitvec_new_pooled(&self->domain->pool, 0);
+	if (op != FASTSET_OP_AND)
+		FastsetSetIndex_accumulate(self, res, args, nargs, op);
+	else if (nargs)
+		fastset_bitvec_combine_into(res, args, nargs, op);
+
+	result = Fastset_bitvecIndices(res);
+	fastset_bitvec_release(res);
+	free(args);
+	return result;
+}
+
+static const fastset_bitvec_t **
+FastsetSetIndex_allocArgs(unsigned int nargs)
+{
+	const fastset_bitvec_t **args;
+
+	if (!(args = calloc(nargs? nargs : 1, sizeof(args[0]))))
+		abort();
+	return args;
+}
+
+/*
+ * Collect the postings of the members of set. Returns false if one of
+ * them has none.
+ */
+static bool
+FastsetSetIndex_memberPostings(fastset_SetIndex *self, const fastset_bitvec_t *vec,
+		const fastset_bitvec_t **args, unsigned int *nargs_p)
+{
+	uint32_t indexes[FASTSET_EXTRACT_BATCH];
+	unsigned int index = 0, count, i;
+	bool complete = true;
+
+	while ((count = fastset_bitvec_extract(vec, index, indexes, FASTSET_EXTRACT_BATCH)) != 0) {
+		for (i = 0; i < count; ++i) {
+			const fastset_bitvec_t *posting = FastsetSetIndex_posting(self, indexes[i]);
+
+			if (posting)
+				args[(*nargs_p)++] = posting;
+			else
+				complete = false;
+		}
+		index = indexes[count - 1] + 1;
+	}
+
+	return complete;
+}
+
+static PyObject *
+FastsetSetIndex_subsetsOf(fastset_SetIndex *self, PyObject *arg)
+{
+	const fastset_bitvec_t **args, *vec;
+	unsigned int nargs = 0, i;
+	fastset_Set *set;
+
+	if (!(set = FastsetSetIndex_castToSet(self, arg)))
+		return NULL;
+
+	FastsetSetIndex_scrub(self);
+	vec = Fastset_bitvec(set);
+
+	/* All sets, minus those with a member outside of set */
+	args = FastsetSetIndex_allocArgs(self->npostings);
+	for (i = 0; i < self->npostings; ++i) {
+		if (self->postings[i] && !fastset_bitvec_test_bit(vec, i))
+			args[nargs++] = self->postings[i];
+	}
+
+	return FastsetSetIndex_result(self, args, nargs, FASTSET_OP_ANDNOT);
+}
+
+static PyObject *
+FastsetSetIndex_supersetsOf(fastset_SetIndex *self, PyObject *arg)
+{
+	const fastset_bitvec_t **args, *vec;
+	unsigned int nargs = 0;
+	fastset_Set *set;
+
+	if (!(set = FastsetSetIndex_castToSet(self, arg)))
+		return NULL;
+
+	FastsetSetIndex_scrub(self);
+	vec = Fastset_bitvec(set);
+
+	args = FastsetSetIndex_allocArgs(fastset_bitvec_count_ones(vec) + 1);
+	if (!FastsetSetIndex_memberPostings(self, vec, args, &nargs)) {
+		/* No set contains a member that has no postings */
+		nargs = 0;
+	} else if (nargs == 0) {
+		/* Every set is a superset of the empty set */
+		args[nargs++] = self->all;
+	}
+
+	return FastsetSetIndex_result(self, args, nargs, FASTSET_OP_AND);
+}
+
+static PyObject *
+FastsetSetIndex_intersecting(fastset_SetIndex *self, PyObject *arg)
+{
+	const fastset_bitvec_t **args, *vec;
+	unsigned int nargs = 0;
+	fastset_Set *set;
+
+	if (!(set = FastsetSetIndex_castToSet(self, arg)))
+		return NULL;
+
+	FastsetSetIndex_scrub(self);
+	vec = Fastset_bitvec(set);
+
+	args = FastsetSetIndex_allocArgs(fastset_bitvec_count_ones(vec));
+	FastsetSetIndex_memberPostings(self, vec, args, &nargs);
+
+	return FastsetSetIndex_result(self, args, nargs, FASTSET_OP_OR);
+}
+
+/*
+ * Move the postings of all set indexes of the domain, which is being
+ * compacted, to the new slots of their members
+ */
+void
+FastsetSetIndex_remapAll(fastset_Domain *domain, const fastset_bitvec_transform_t *trans)
+{
+	fastset_DomainLink *link;
+
+	for (link = domain->set_indexes; link; link = link->next) {
+		fastset_SetIndex *self = FASTSET_LINK_OWNER(link, fastset_SetIndex);
+		fastset_bitvec_t **postings;
+		unsigned int i;
+
+		FastsetSetIndex_scrub(self);
+		if (self->npostings == 0)
+			continue;
+
+		postings = calloc(self->npostings, sizeof(postings[0]));
+		if (postings == NULL)
+			abort();
+
+		for (i = 0; i < self->npostings; ++i) {
+			if (i < trans->max_index && trans->mapping[i] >= 0)
+				postings[trans->mapping[i]] = self->postings[i];
+			else
+				fastset_bitvec_drop(&self->postings[i]);
+		}
+
+		free(self->postings);
+		self->postings = postings;
+	}
+}
@@ -0,0 +1,557 @@
+/*
+fastsets - vectorized bitvec kernels
+
+Copyright (C) 2023 SUSE
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "fastsets.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# define FASTSET_HAVE_X86_KERNELS
+# include <immintrin.h>
+#endif
+
+/*
+ * The word loops below are the hot path of all set operations.
+ * We compile one version per instruction set, using per-function
+ * target attributes rather than global -m flags, and pick the best
+ * one supported by the CPU when the module is loaded. That way, a
+ * single build works everywhere.
+ */
+
+/*
+ * Portable versions
+ */
+static void
+generic_or(fastset_bitvec_word_t *res, const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords)
+{
+	unsigned int n;
+
+	for (n = 0; n < nwords; ++n)
+		res[n] = a[n] | b[n];
+}
+
+static void
+generic_and(fastset_bitvec_word_t *res, const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords)
+{
+	unsigned int n;
+
+	for (n = 0; n < nwords; ++n)
+		res[n] = a[n] & b[n];
+}
+
+static void
+generic_andnot(fastset_bitvec_word_t *res, const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords)
+{
+	unsigned int n;
+
+	for (n = 0; n < nwords; ++n)
+		res[n] = a[n] & ~(b[n]);
+}
+
+static void
+generic_xor(fastset_bitvec_word_t *res, const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords)
+{
+	unsigned int n;
+
+	for (n = 0; n < nwords; ++n)
+		res[n] = a[n] ^ b[n];
+}
+
+static bool
+generic_test_and(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords)
+{
+	unsigned int n;
+
+	for (n = 0; n < nwords; ++n) {
+		if (a[n] & b[n])
+			return true;
+	}
+	return false;
+}
+
+static bool
+generic_test_andnot(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords)
+{
+	unsigned int n;
+
+	for (n = 0; n < nwords; ++n) {
+		if (a[n] & ~(b[n]))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Without a target that has the popcnt instruction, __builtin_popcountll
+ * turns into a call to libgcc. So the popcount loops are compiled a second
+ * time for CPUs that have it, and swapped into the generic kernels at
+ * load time.
+ */
+#define WORD_POPCOUNT_KERNEL(attr, name, params, word) \
+attr \
+static unsigned int \
+name params \
+{ \
+	unsigned int n, result = 0; \
+ \
+	for (n = 0; n < nwords; ++n) \
+		result += __builtin_popcountll(word); \
+	return result; \
+}
+
+#define WORD_POPCOUNT_KERNELS(attr, prefix) \
+WORD_POPCOUNT_KERNEL(attr, prefix##_popcount, \
+		(const fastset_bitvec_word_t *a, unsigned int nwords), \
+		a[n]) \
+WORD_POPCOUNT_KERNEL(attr, prefix##_popcount_and, \
+		(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords), \
+		a[n] & b[n]) \
+WORD_POPCOUNT_KERNEL(attr, prefix##_popcount_or, \
+		(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords), \
+		a[n] | b[n]) \
+WORD_POPCOUNT_KERNEL(attr, prefix##_popcount_andnot, \
+		(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords), \
+		a[n] & ~(b[n]))
+
+WORD_POPCOUNT_KERNELS(, generic)
+#ifdef FASTSET_HAVE_X86_KERNELS
+WORD_POPCOUNT_KERNELS(__attribute__((target("popcnt"))), popcnt)
+#endif
+
+static fastset_bitvec_kernels_t	generic_kernels = {
+	.name		= "generic",
+	.op_or		= generic_or,
+	.op_and		= generic_and,
+	.op_andnot	= generic_andnot,
+	.op_xor		= generic_xor,
+	.test_and	= generic_test_and,
+	.test_andnot	= generic_test_andnot,
+	.popcount	= generic_popcount,
+	.popcount_and	= generic_popcount_and,
+	.popcount_or	= generic_popcount_or,
+	.popcount_andnot = generic_popcount_andnot,
+};
+
+#ifdef FASTSET_HAVE_X86_KERNELS
+/*
+ * AVX2 versions, processing 4 words per iteration
+ */
+#define AVX2_BINARY_KERNEL(name, vecop, wordop) \
+__attribute__((target("avx2"))) \
+static void \
+avx2_##name(fastset_bitvec_word_t *res, const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords) \
+{ \
+	unsigned int n; \
+ \
+	for (n = 0; n + 4 <= nwords; n += 4) { \
+		__m256i va = _mm256_loadu_si256((const __m256i *) (a + n)); \
+		__m256i vb = _mm256_loadu_si256((const __m256i *) (b + n)); \
+ \
+		_mm256_storeu_si256((__m256i *) (res + n), vecop); \
+	} \
+	for (; n < nwords; ++n) \
+		res[n] = wordop; \
+}
+
+AVX2_BINARY_KERNEL(or, _mm256_or_si256(va, vb), a[n] | b[n])
+AVX2_BINARY_KERNEL(and, _mm256_and_si256(va, vb), a[n] & b[n])
+AVX2_BINARY_KERNEL(andnot, _mm256_andnot_si256(vb, va), a[n] & ~(b[n]))
+AVX2_BINARY_KERNEL(xor, _mm256_xor_si256(va, vb), a[n] ^ b[n])
+
+__attribute__((target("avx2")))
+static bool
+avx2_test_and(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords)
+{
+	unsigned int n;
+
+	for (n = 0; n + 4 <= nwords; n += 4) {
+		__m256i va = _mm256_loadu_si256((const __m256i *) (a + n));
+		__m256i vb = _mm256_loadu_si256((const __m256i *) (b + n));
+
+		/* testz returns 1 iff (va & vb) == 0 */
+		if (!_mm256_testz_si256(va, vb))
+			return true;
+	}
+	for (; n < nwords; ++n) {
+		if (a[n] & b[n])
+			return true;
+	}
+	return false;
+}
+
+__attribute__((target("avx2")))
+static bool
+avx2_test_andnot(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords)
+{
+	unsigned int n;
+
+	for (n = 0; n + 4 <= nwords; n += 4) {
+		__m256i va = _mm256_loadu_si256((const __m256i *) (a + n));
+		__m256i vb = _mm256_loadu_si256((const __m256i *) (b + n));
+
+		/* testc returns 1 iff (~vb & va) == 0 */
+		if (!_mm256_testc_si256(vb, va))
+			return true;
+	}
+	for (; n < nwords; ++n) {
+		if (a[n] & ~(b[n]))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Population count using the Harley-Seal carry-save adder scheme
+ * (see Mula, Kurz, Lemire: "Faster Population Counts Using AVX2
+ * Instructions"). We feed 16 vectors at a time through a tree of
+ * CSAs, and only need to do a full per-byte popcount (using vpshufb
+ * on nibbles) once per 16 vectors.
+ */
+__attribute__((target("avx2")))
+static inline __m256i
+avx2_popcount256(__m256i v)
+{
+	const __m256i lookup = _mm256_setr_epi8(
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0f);
+	__m256i lo, hi, cnt;
+
+	lo = _mm256_and_si256(v, low_mask);
+	hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+	cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+
+	/* sum the byte counts into four 64bit lanes */
+	return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline void
+avx2_csa(__m256i *h, __m256i *l, __m256i a, __m256i b, __m256i c)
+{
+	__m256i u = _mm256_xor_si256(a, b);
+
+	*h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+	*l = _mm256_xor_si256(u, c);
+}
+
+/*
+ * LOAD(i) must yield the i-th 256bit vector of input, WORD(n) the
+ * n-th 64bit word.
+ */
+#define AVX2_POPCOUNT_KERNEL(name, args, LOAD, WORD) \
+__attribute__((target("avx2,popcnt"))) \
+static unsigned int \
+avx2_##name args \
+{ \
+	__m256i total = _mm256_setzero_si256(); \
+	__m256i ones = _mm256_setzero_si256(), twos = _mm256_setzero_si256(); \
+	__m256i fours = _mm256_setzero_si256(), eights = _mm256_setzero_si256(); \
+	__m256i sixteens, twosA, twosB, foursA, foursB, eightsA, eightsB; \
+	unsigned int i, n, nvecs = nwords / 4; \
+	uint64_t result; \
+ \
+	for (i = 0; i + 16 <= nvecs; i += 16) { \
+		avx2_csa(&twosA, &ones, ones, LOAD(i + 0), LOAD(i + 1)); \
+		avx2_csa(&twosB, &ones, ones, LOAD(i + 2), LOAD(i + 3)); \
+		avx2_csa(&foursA, &twos, twos, twosA, twosB); \
+		avx2_csa(&twosA, &ones, ones, LOAD(i + 4), LOAD(i + 5)); \
+		avx2_csa(&twosB, &ones, ones, LOAD(i + 6), LOAD(i + 7)); \
+		avx2_csa(&foursB, &twos, twos, twosA, twosB); \
+		avx2_csa(&eightsA, &fours, fours, foursA, foursB); \
+		avx2_csa(&twosA, &ones, ones, LOAD(i + 8), LOAD(i + 9)); \
+		avx2_csa(&twosB, &ones, ones, LOAD(i + 10), LOAD(i + 11)); \
+		avx2_csa(&foursA, &twos, twos, twosA, twosB); \
+		avx2_csa(&twosA, &ones, ones, LOAD(i + 12), LOAD(i + 13)); \
+		avx2_csa(&twosB, &ones, ones, LOAD(i + 14), LOAD(i + 15)); \
+		avx2_csa(&foursB, &twos, twos, twosA, twosB); \
+		avx2_csa(&eightsB, &fours, fours, foursA, foursB); \
+		avx2_csa(&sixteens, &eights, eights, eightsA, eightsB); \
+ \
+		total = _mm256_add_epi64(total, avx2_popcount256(sixteens)); \
+	} \
+ \
+	total = _mm256_slli_epi64(total, 4); \
+	total = _mm256_add_epi64(total, _mm256_slli_epi64(avx2_popcount256(eights), 3)); \
+	total = _mm256_add_epi64(total, _mm256_slli_epi64(avx2_popcount256(fours), 2)); \
+	total = _mm256_add_epi64(total, _mm256_slli_epi64(avx2_popcount256(twos), 1)); \
+	total = _mm256_add_epi64(total, avx2_popcount256(ones)); \
+ \
+	for (; i < nvecs; ++i) \
+		total = _mm256_add_epi64(total, avx2_popcount256(LOAD(i))); \
+ \
+	result = _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) \
+	       + _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3); \
+ \
+	for (n = 4 * nvecs; n < nwords; ++n) \
+		result += _mm_popcnt_u64(WORD(n)); \
+ \
+	return result; \
+}
+
+#define AVX2_LOAD(p, i)		_mm256_loadu_si256((const __m256i *) ((p) + 4 * (i)))
+
+#define POPCOUNT_LOAD(i)	AVX2_LOAD(a, i)
+#define POPCOUNT_WORD(n)	a[n]
+AVX2_POPCOUNT_KERNEL(popcount,
+		(const fastset_bitvec_word_t *a, unsigned int nwords),
+		POPCOUNT_LOAD, POPCOUNT_WORD)
+
+/* Fused versions that combine two vectors on the fly */
+#define POPCOUNT_AND_LOAD(i)	_mm256_and_si256(AVX2_LOAD(a, i), AVX2_LOAD(b, i))
+#define POPCOUNT_AND_WORD(n)	(a[n] & b[n])
+AVX2_POPCOUNT_KERNEL(popcount_and,
+		(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords),
+		POPCOUNT_AND_LOAD, POPCOUNT_AND_WORD)
+
+#define POPCOUNT_OR_LOAD(i)	_mm256_or_si256(AVX2_LOAD(a, i), AVX2_LOAD(b, i))
+#define POPCOUNT_OR_WORD(n)	(a[n] | b[n])
+AVX2_POPCOUNT_KERNEL(popcount_or,
+		(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords),
+		POPCOUNT_OR_LOAD, POPCOUNT_OR_WORD)
+
+#define POPCOUNT_ANDNOT_LOAD(i)	_mm256_andnot_si256(AVX2_LOAD(b, i), AVX2_LOAD(a, i))
+#define POPCOUNT_ANDNOT_WORD(n)	(a[n] & ~(b[n]))
+AVX2_POPCOUNT_KERNEL(popcount_andnot,
+		(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords),
+		POPCOUNT_ANDNOT_LOAD, POPCOUNT_ANDNOT_WORD)
+
+static const fastset_bitvec_kernels_t	avx2_kernels = {
+	.name		= "avx2",
+	.op_or		= avx2_or,
+	.op_and		= avx2_and,
+	.op_andnot	= avx2_andnot,
+	.op_xor		= avx2_xor,
+	.test_and	= avx2_test_and,
+	.test_andnot	= avx2_test_andnot,
+	.popcount	= avx2_popcount,
+	.popcount_and	= avx2_popcount_and,
+	.popcount_or	= avx2_popcount_or,
+	.popcount_andnot = avx2_popcount_andnot,
+};
+
+/*
+ * AVX-512 versions, processing 8 words per iteration. The tail is handled
+ * with masked loads and stores rather than a scalar loop.
+ */
+#define AVX512_BINARY_KERNEL(name, vecop) \
+__attribute__((target("avx512f"))) \
+static void \
+avx512_##name(fastset_bitvec_word_t *res, const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords) \
+{ \
+	unsigned int n; \
+ \
+	for (n = 0; n + 8 <= nwords; n += 8) { \
+		__m512i va = _mm512_loadu_si512((const void *) (a + n)); \
+		__m512i vb = _mm512_loadu_si512((const void *) (b + n)); \
+ \
+		_mm512_storeu_si512((void *) (res + n), vecop); \
+	} \
+	if (n < nwords) { \
+		__mmask8 tail = (1U << (nwords - n)) - 1; \
+		__m512i va = _mm512_maskz_loadu_epi64(tail, a + n); \
+		__m512i vb = _mm512_maskz_loadu_epi64(tail, b + n); \
+ \
+		_mm512_mask_storeu_epi64(res + n, tail, vecop); \
+	} \
+}
+
+AVX512_BINARY_KERNEL(or, _mm512_or_si512(va, vb))
+AVX512_BINARY_KERNEL(and, _mm512_and_si512(va, vb))
+AVX512_BINARY_KERNEL(andnot, _mm512_andnot_si512(vb, va))
+AVX512_BINARY_KERNEL(xor, _mm512_xor_si512(va, vb))
+
+__attribute__((target("avx512f")))
+static bool
+avx512_test_and(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords)
+{
+	unsigned int n;
+
+	for (n = 0; n + 8 <= nwords; n += 8) {
+		__m512i va = _mm512_loadu_si512((const void *) (a + n));
+		__m512i vb = _mm512_loadu_si512((const void *) (b + n));
+
+		if (_mm512_test_epi64_mask(va, vb))
+			return true;
+	}
+	if (n < nwords) {
+		__mmask8 tail = (1U << (nwords - n)) - 1;
+		__m512i va = _mm512_maskz_loadu_epi64(tail, a + n);
+		__m512i vb = _mm512_maskz_loadu_epi64(tail, b + n);
+
+		if (_mm512_test_epi64_mask(va, vb))
+			return true;
+	}
+	return false;
+}
+
+__attribute__((target("avx512f")))
+static bool
+avx512_test_andnot(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords)
+{
+	unsigned int n;
+
+	for (n = 0; n + 8 <= nwords; n += 8) {
+		__m512i va = _mm512_loadu_si512((const void *) (a + n));
+		__m512i vb = _mm512_loadu_si512((const void *) (b + n));
+		__m512i vx = _mm512_andnot_si512(vb, va);
+
+		if (_mm512_test_epi64_mask(vx, vx))
+			return true;
+	}
+	if (n < nwords) {
+		__mmask8 tail = (1U << (nwords - n)) - 1;
+		__m512i va = _mm512_maskz_loadu_epi64(tail, a + n);
+		__m512i vb = _mm512_maskz_loadu_epi64(tail, b + n);
+		__m512i vx = _mm512_andnot_si512(vb, va);
+
+		if (_mm512_test_epi64_mask(vx, vx))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * This requires the VPOPCNTDQ extension, which not all AVX-512 CPUs
+ * have. If it's missing, we fall back to the AVX2 version.
+ */
+#define AVX512_POPCOUNT_KERNEL(name, args, LOAD) \
+__attribute__((target("avx512f,avx512vpopcntdq"))) \
+static unsigned int \
+avx512_##name args \
+{ \
+	__m512i total = _mm512_setzero_si512(); \
+	unsigned int n; \
+ \
+	for (n = 0; n + 8 <= nwords; n += 8) \
+		total = _mm512_add_epi64(total, _mm512_popcnt_epi64(LOAD(0xff))); \
+	if (n < nwords) { \
+		__mmask8 tail = (1U << (nwords - n)) - 1; \
+ \
+		total = _mm512_add_epi64(total, _mm512_popcnt_epi64(LOAD(tail))); \
+	} \
+ \
+	return _mm512_reduce_add_epi64(total); \
+}
+
+#define AVX512_LOAD(p, mask)	_mm512_maskz_loadu_epi64(mask, (p) + n)
+
+#define POPCOUNT512_LOAD(mask)	AVX512_LOAD(a, mask)
+AVX512_POPCOUNT_KERNEL(popcount,
+		(const fastset_bitvec_word_t *a, unsigned int nwords),
+		POPCOUNT512_LOAD)
+
+#define POPCOUNT512_AND_LOAD(mask) \
+	_mm512_and_si512(AVX512_LOAD(a, mask), AVX512_LOAD(b, mask))
+AVX512_POPCOUNT_KERNEL(popcount_and,
+		(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords),
+		POPCOUNT512_AND_LOAD)
+
+#define POPCOUNT512_OR_LOAD(mask) \
+	_mm512_or_si512(AVX512_LOAD(a, mask), AVX512_LOAD(b, mask))
+AVX512_POPCOUNT_KERNEL(popcount_or,
+		(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords),
+		POPCOUNT512_OR_LOAD)
+
+#define POPCOUNT512_ANDNOT_LOAD(mask) \
+	_mm512_andnot_si512(AVX512_LOAD(b, mask), AVX512_LOAD(a, mask))
+AVX512_POPCOUNT_KERNEL(popcount_andnot,
+		(const fastset_bitvec_word_t *a, const fastset_bitvec_word_t *b, unsigned int nwords),
+		POPCOUNT512_ANDNOT_LOAD)
+
+static fastset_bitvec_kernels_t	avx512_kernels = {
+	.name		= "avx512",
+	.op_or		= avx512_or,
+	.op_and		= avx512_and,
+	.op_andnot	= avx512_andnot,
+	.op_xor		= avx512_xor,
+	.test_and	= avx512_test_and,
+	.test_andnot	= avx512_test_andnot,
+	.popcount	= avx512_popcount,
+	.popcount_and	= avx512_popcount_and,
+	.popcount_or	= avx512_popcount_or,
+	.popcount_andnot = avx512_popcount_andnot,
+};
+#endif /* FASTSET_HAVE_X86_KERNELS */
+
+const fastset_bitvec_kernels_t *fastset_bitvec_kernels = &generic_kernels;
+
+static const fastset_bitvec_kernels_t *
+fastset_kernels_by_name(const char *name)
+{
+	if (!strcmp(name, generic_kernels.name))
+		return &generic_kernels;
+#ifdef FASTSET_HAVE_X86_KERNELS
+	if (!strcmp(name, avx2_kernels.name) && __builtin_cpu_supports("avx2"))
+		return &avx2_kernels;
+	if (!strcmp(name, avx512_kernels.name) && __builtin_cpu_supports("avx512f"))
+		return &avx512_kernels;
+#endif
+	return NULL;
+}
+
+/*
+ * Select the kernels to use. This is called once when the module is loaded.
+ * Setting FASTSET_SIMD=generic|avx2|avx512 in the environment overrides
+ * the automatic selection (as long as the CPU supports the requested
+ * instruction set), which is mostly useful for testing.
+ */
+void
+fastset_bitvec_kernels_init(void)
+{
+	const fastset_bitvec_kernels_t *kernels = NULL;
+	const char *override;
+
+#ifdef FASTSET_HAVE_X86_KERNELS
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("popcnt")) {
+		generic_kernels.popcount = popcnt_popcount;
+		generic_kernels.popcount_and = popcnt_popcount_and;
+		generic_kernels.popcount_or = popcnt_popcount_or;
+		generic_kernels.popcount_andnot = popcnt_popcount_andnot;
+	}
+#endif
+
+	if ((override = getenv("FASTSET_SIMD")) != NULL) {
+		kernels = fastset_kernels_by_name(override);
+		if (kernels == NULL)
+			fprintf(stderr, "fastset: ignoring unsupported FASTSET_SIMD=%s\n", override);
+	}
+
+#ifdef FASTSET_HAVE_X86_KERNELS
+	if (kernels == NULL && __builtin_cpu_supports("avx512f"))
+		kernels = &avx512_kernels;
+
+	if (kernels == &avx512_kernels && !__builtin_cpu_supports("avx512vpopcntdq")) {
+		avx512_kernels.popcount = avx2_popcount;
+		avx512_kernels.popcount_and = avx2_popcount_and;
+		avx512_kernels.popcount_or = avx2_popcount_or;
+		avx512_kernels.popcount_andnot = avx2_popcount_andnot;
+	}
+	if (kernels == NULL && __builtin_cpu_supports("avx2"))
+		kernels = &avx2_kernels;
+#endif
+	if (kernels == NULL)
+		kernels = &generic_kernels;
+
+	fastset_bitvec_kernels = kernels;
+}
@@ -1,6 +1,7 @@
 import fastset
 import string
 import random
+import threading
 import time
 
 if False:
@@ -20,7 +21,7 @@ class Label(LabelDomain.member):
 
 class LabelSet(LabelDomain.set):
 	def asSet(self):
-		return set(self)
+		return self.to_pyset()
 
 class LabelDictionary(dict):
 	def add(self, name):
@@ -31,9 +32,10 @@ class LabelDictionary(dict):
 		return label
 
 class FastsetTester:
-	def __init__(self, keys):
+	def __init__(self, keys, maxSetSize = None):
 		self.keys = keys
 		self.setsize = len(self.keys)
+		self.maxSetSize = maxSetSize or self.setsize
 		self.labelDict = LabelDictionary()
 
 		for s in keys:
@@ -43,13 +45,15 @@ class FastsetTester:
 
 	def test(self, numIterations):
 		print("******************************************************************")
-		print(f"Performing {numIterations} tests of random combinations of sets")
+		print(f"Performing {numIterations} tests of random combinations of sets ({fastset.simd} kernels)")
 		for i in range(numIterations):
-			t.testRandomPair()
+			self.testRandomPair()
 
 		# this should fail safely
 		# x = LabelSet.union(set(), LabelSet((1, 2)))
 
+		stats = LabelDomain.allocator_stats()
+		print(f"Allocator recycled {stats['words_hits']} of {stats['words_hits'] + stats['words_misses']} word arrays")
 		print(f"Done, tests checked out OK")
 		print()
 
@@ -61,9 +65,10 @@ class FastsetTester:
 		self.timeUnarySetOperation('len', len)
 		self.timeUnarySetOperation('bool', bool)
 		self.timeSetOperations(('union', 'intersection', 'difference', 'symmetric_difference', 'issubset', 'issuperset', 'isdisjoint'))
+		self.timeCountOperations(('intersection', 'union', 'difference'))
 
 	def randomSet(self, klass = set):
-		nelements = random.randrange(self.setsize)
+		nelements = random.randrange(self.maxSetSize)
 		return klass(map(self.labelDict.add, random.choices(self.keys, k = nelements)))
 
 		print(f"Done.")
@@ -170,15 +175,441 @@ class FastsetTester:
 
 		debug(f" {name} OK")
 
+	def testCountOperation(self, name, a, b, func):
+		avec = LabelSet(a)
+		bvec = LabelSet(b)
+
+		r1 = func(a, b)
+		r2 = getattr(avec, name)(bvec)
+
+		if r1 != r2:
+			print(f"Operation {name} test failed: expected {r1}, got {r2}")
+			raise Exception(name)
+
+		debug(f" {name} OK")
+
 	def testContains(self, a):
 		avec = LabelSet(a)
-		for label in self.allLabels:
+		for label in random.sample(self.allLabels, min(len(self.allLabels), 1000)):
 			b1 = label in a
 			b2 = label in avec
 			assert(b1 == b2)
 
 		debug(f" __contains__ OK")
 
+	def testLength(self, a):
+		avec = LabelSet(a)
+		control = set(a)
+		for label in random.choices(self.allLabels, k = 20):
+			if random.randrange(2):
+				avec.add(label)
+				control.add(label)
+			else:
+				avec.discard(label)
+				control.discard(label)
+			if len(avec) != len(control):
+				raise Exception("len() out of sync after add/discard")
+
+		avec.intersection_update(LabelSet(a))
+		if len(avec) != len(control.intersection(a)):
+			raise Exception("len() out of sync after intersection_update")
+
+		debug(f" len() OK")
+
+	def testCopyOnWrite(self, a, b):
+		avec = LabelSet(a)
+		acopy = avec.copy()
+
+		# the iterator must see a snapshot of the set
+		seen = set()
+		for label in avec:
+			seen.add(label)
+			avec.difference_update(LabelSet(b))
+			avec.add(random.choice(self.allLabels))
+		if seen != a:
+			raise Exception("iterator affected by modification of set")
+
+		acopy.update(LabelSet(b))
+		if LabelSet(a) != LabelSet(a).copy() or avec.copy() != avec:
+			raise Exception("copy is not equal to original")
+		if acopy.asSet() != a.union(b):
+			raise Exception("modifying a copy affected the original")
+
+		debug(f" copy-on-write OK")
+
+	def testReserve(self, a, b):
+		avec = LabelSet(a)
+		avec.reserve(2 * self.setsize)
+		if avec.asSet() != a:
+			raise Exception("reserve() changed the set")
+
+		size = avec.__sizeof__()
+		avec.difference_update(LabelSet(b))
+		avec.shrink_to_fit()
+		if avec.asSet() != a.difference(b):
+			raise Exception("shrink_to_fit() changed the set")
+		if avec.__sizeof__() > size:
+			raise Exception("shrink_to_fit() did not release memory")
+
+		debug(f" reserve/shrink_to_fit OK")
+
+	def testMaterialize(self, a):
+		avec = LabelSet(a)
+		ordered = list(avec)
+		if set(ordered) != a:
+			raise Exception("iterating over the set yields the wrong members")
+		if avec.to_list() != ordered or avec.to_tuple() != tuple(ordered):
+			raise Exception("to_list()/to_tuple() return the wrong members")
+		if avec.to_pyset() != a:
+			raise Exception("to_pyset() returns the wrong members")
+		if list(avec.indices()) != [label.index for label in ordered]:
+			raise Exception("indices() returns the wrong indices")
+
+		debug(f" materialize OK")
+
+	def testNarySetOperations(self, a, b, c):
+		avec = LabelSet(a)
+		bvec = LabelSet(b)
+		cvec = LabelSet(c)
+
+		for name, update in ('union', 'update'), ('intersection', 'intersection_update'), ('difference', 'difference_update'):
+			r = getattr(set, name)(a, b, c)
+			rvec = getattr(LabelSet, name)(avec, bvec, cvec)
+			if r != rvec.asSet():
+				raise Exception(f"{name} of three sets failed")
+
+			r = a.copy()
+			rvec = avec.copy()
+			getattr(set, update)(r, b, c)
+			getattr(LabelSet, update)(rvec, bvec, cvec)
+			if r != rvec.asSet():
+				raise Exception(f"{update} with three sets failed")
+
+		if LabelDomain.union_all([avec, bvec, cvec]).to_pyset() != a | b | c:
+			raise Exception("union_all failed")
+		if LabelDomain.intersection_all(iter([avec, bvec, cvec])).to_pyset() != a & b & c:
+			raise Exception("intersection_all failed")
+		if LabelDomain.union_all([avec] * 40 + [bvec]).to_pyset() != a | b:
+			raise Exception("union_all of many sets failed")
+		if type(LabelDomain.union_all([avec, bvec])) is not LabelSet or type(LabelDomain.intersection_all([LabelDomain.set(a), bvec])) is not LabelDomain.set:
+			raise Exception("union_all/intersection_all do not take the class of the first set")
+		if (LabelDomain.union_all([avec, cvec]) | bvec).to_pyset() != a | b | c:
+			raise Exception("result of union_all does not combine with sets")
+
+		debug(f" n-ary operations OK")
+
+	def testLazyExpression(self, a, b, c):
+		avec = LabelSet(a)
+		bvec = LabelSet(b)
+		cvec = LabelSet(c)
+
+		r = ((a | b) & c) ^ (a - c)
+		expr = ((avec.lazy() | bvec) & cvec) ^ (avec - cvec)
+
+		if expr.materialize().to_pyset() != r:
+			raise Exception("lazy expression evaluates to the wrong set")
+		if type(expr.materialize()) is not LabelSet or type((LabelDomain.set(b).lazy() | avec).materialize()) is not LabelDomain.set:
+			raise Exception("lazy expression does not take the class of its leftmost set")
+		if (expr.materialize() & bvec).to_pyset() != r & b:
+			raise Exception("materialized expression does not combine with sets")
+		if len(expr) != len(r) or set(expr) != r:
+			raise Exception("lazy expression has the wrong members")
+		for label in self.allLabels[:50]:
+			if (label in expr) != (label in r):
+				raise Exception("lazy expression has the wrong members")
+
+		debug(f" lazy expression OK")
+
+	def testComplement(self, a, b):
+		avec = LabelSet(a)
+		bvec = LabelSet(b)
+		universe = LabelDomain.universe().to_pyset()
+
+		if avec.complement().to_pyset() != universe - a or (~avec).to_pyset() != universe - a:
+			raise Exception("complement returns the wrong members")
+		if (bvec.lazy() & ~avec).materialize().to_pyset() != b - a:
+			raise Exception("lazy expression with complement evaluates to the wrong set")
+
+		debug(f" complement OK")
+
+	def testMixedClasses(self, a, b):
+		avec = LabelSet(a)
+		bvec = LabelDomain.set(b)
+
+		# Sets of the same domain combine regardless of their class,
+		# and the result has the class of the left operand
+		for r, expect, klass in (avec | bvec, a | b, LabelSet), (bvec & avec, b & a, LabelDomain.set), \
+				(avec - bvec, a - b, LabelSet), (bvec ^ avec, b ^ a, LabelDomain.set), \
+				(avec.union(bvec), a | b, LabelSet), (bvec.difference(avec), b - a, LabelDomain.set):
+			if type(r) is not klass or r.to_pyset() != expect:
+				raise Exception("operation on sets of different classes failed")
+
+		rvec = LabelSet(a)
+		rvec -= bvec
+		if type(rvec) is not LabelSet or rvec.asSet() != a - b:
+			raise Exception("in-place operation on sets of different classes failed")
+		if (avec <= bvec) != (a <= b) or (avec == bvec) != (a == b):
+			raise Exception("comparison of sets of different classes failed")
+
+		if (LabelDomain.universe() - avec).to_pyset() != LabelDomain.universe().to_pyset() - a:
+			raise Exception("universe() - set failed")
+
+		debug(f" mixed classes OK")
+
+	def testCreateMembers(self, a):
+		avec = LabelSet(a)
+		size = len(LabelDomain.universe())
+
+		# The domain has no holes here, so new members are appended
+		members = LabelDomain.create_members(5, type = Label)
+		if len(members) != 5 or any(type(m) is not Label for m in members):
+			raise Exception("create_members() returns the wrong members")
+		if sorted(m.index for m in members) != list(range(size, size + 5)):
+			raise Exception("create_members() assigns the wrong indices")
+		if (avec | LabelSet(members)).to_pyset() != a | set(members):
+			raise Exception("members from create_members() do not work in sets")
+
+		for klass in LabelSet, int:
+			try:
+				LabelDomain.create_members(1, type = klass)
+			except TypeError:
+				pass
+			else:
+				raise Exception("create_members() accepts a type that is not a member class")
+
+		# Registered members take the slots of removed ones first
+		old = LabelSet(members)
+		freed = {m.index for m in members[:3]}
+		for m in members[:3]:
+			LabelDomain.remove(m)
+
+		new = [Label.__new__(Label) for i in range(4)]
+		LabelDomain.bulk_register(new)
+		if not freed <= {m.index for m in new} or any(m in old for m in new):
+			raise Exception("bulk_register() did not reuse the slots of removed members")
+		if (LabelSet(new) - avec).to_pyset() != set(new) or LabelSet(new + members[3:]) & old != LabelSet(members[3:]):
+			raise Exception("members from bulk_register() do not work in sets")
+
+		for m in new + members[3:]:
+			LabelDomain.remove(m)
+		if LabelDomain.compact() != 6:
+			raise Exception("compact() did not reclaim the slots of created members")
+
+		debug(f" create_members/bulk_register OK")
+
+	def testSlotReuse(self, a):
+		if not a:
+			return
+
+		avec = LabelSet(a)
+		old = random.choice(list(a))
+		index = old.index
+
+		# Replace the label by a new one, which reuses its index
+		LabelDomain.remove(old)
+		new = self.labelDict[old.name] = Label(old.name)
+		self.allLabels[self.allLabels.index(old)] = new
+
+		if new.index != index:
+			raise Exception("index of removed member was not reused")
+
+		# These must not see the stale bit of the removed member, so
+		# check them before anything else gets to scrub avec
+		if new in LabelDomain.union_all([avec]):
+			raise Exception("union_all() sees the removed member")
+		if new in LabelDomain.intersection_all([avec, LabelSet((a - {old}) | {new})]):
+			raise Exception("intersection_all() sees the removed member")
+
+		if old in avec or new in avec or avec.to_pyset() != a - {old}:
+			raise Exception("set still contains the removed member")
+
+		debug(f" slot reuse OK")
+
+	def testCompact(self, a, b):
+		if not a:
+			return
+
+		avec = LabelSet(a)
+		bvec = LabelSet(b)
+		old = random.choice(list(a))
+
+		LabelDomain.remove(old)
+		if LabelDomain.compact() != 1:
+			raise Exception("compact() did not reclaim the slot of the removed member")
+
+		universe = LabelDomain.universe()
+		if sorted(label.index for label in universe) != list(range(len(universe))):
+			raise Exception("compact() did not renumber members densely")
+
+		a = a - {old}
+		b = b - {old}
+		if avec.to_pyset() != a or bvec.to_pyset() != b or (avec & bvec).to_pyset() != a & b:
+			raise Exception("compact() did not remap existing sets")
+
+		new = self.labelDict[old.name] = Label(old.name)
+		self.allLabels[self.allLabels.index(old)] = new
+
+		debug(f" compact OK")
+
+	def makeTransform(self, mapping):
+		# Members of other testers share the domain; leave them alone
+		return fastset.Transform(LabelDomain, lambda label: mapping.get(label, label))
+
+	def testTransform(self, a, b):
+		# Creating a transform calls the mapping function for every member
+		if self.setsize > 10000:
+			return
+
+		avec = LabelSet(a)
+		bvec = LabelSet(b)
+		perm = dict(zip(self.allLabels, random.sample(self.allLabels, len(self.allLabels))))
+		halve = {label: self.allLabels[i // 2] for i, label in enumerate(self.allLabels)}
+		t1 = self.makeTransform(perm)
+		t2 = self.makeTransform(halve)
+
+		r = {halve[perm[label]] for label in a}
+		if (t2 @ t1)(avec).to_pyset() != r or t2(t1(avec)).to_pyset() != r:
+			raise Exception("composed transform returns the wrong image")
+		if t1.preimage(bvec).to_pyset() != {label for label in self.allLabels if perm[label] in b}:
+			raise Exception("transform returns the wrong preimage")
+		if [x.to_pyset() for x in t1.apply_all([avec, bvec])] != [{perm[label] for label in s} for s in (a, b)]:
+			raise Exception("apply_all() returns the wrong images")
+
+		if t1.inverse()(t1(avec)).to_pyset() != a:
+			raise Exception("inverse transform does not undo the transform")
+		try:
+			t2.inverse()
+		except ValueError:
+			pass
+		else:
+			raise Exception("inverse() of a transform that is not one-to-one did not fail")
+
+		debug(f" transform OK")
+
+	def testTransformCompile(self):
+		# Transforms over the large domain of the sparse tester are
+		# expensive to create, so only test them now and then
+		if self.setsize > 10000 and random.randrange(10):
+			return
+
+		# A shift by 8 maps every input byte into a single output word,
+		# which is done by table lookup. A random permutation does not,
+		# and is applied bit by bit.
+		byIndex = {label.index: label for label in self.allLabels}
+		shift = {label: byIndex[label.index + 8] for label in self.allLabels if label.index + 8 in byIndex}
+		perm = dict(zip(self.allLabels, random.sample(self.allLabels, len(self.allLabels))))
+
+		# A dense set, a short sparse one, and a few members from all
+		# over the domain, which is compressed in the sparse tester
+		inputs = [set(random.sample(self.allLabels, len(self.allLabels) // 2)),
+			  set(sorted(self.allLabels, key = lambda label: label.index)[:3]),
+			  set(random.sample(self.allLabels, 3))]
+
+		for mapping in shift, perm:
+			trans = self.makeTransform(mapping)
+			expect = [{mapping.get(label, label) for label in s} for s in inputs]
+			if [trans(LabelSet(s)).to_pyset() for s in inputs] != expect:
+				raise Exception("transform returns the wrong image")
+			if [x.to_pyset() for x in trans.apply_all([LabelSet(s) for s in inputs])] != expect:
+				raise Exception("apply_all() returns the wrong images")
+
+		debug(f" transform compile OK")
+
+	def testRelation(self, a, b):
+		# A relation is a dense matrix over the whole domain
+		if self.setsize > 10000:
+			return
+
+		avec = LabelSet(a)
+		bvec = LabelSet(b)
+		rel = fastset.Relation(LabelDomain)
+		for label in a:
+			rel.update(label, bvec)
+
+		if rel(avec).to_pyset() != (b if a else set()):
+			raise Exception("relation returns the wrong image")
+		if rel.preimage(bvec).to_pyset() != (a if b else set()):
+			raise Exception("relation returns the wrong preimage")
+
+		# Everything reachable from a is reached in the first step
+		if rel.reachable(avec).to_pyset() != (b if a else set()):
+			raise Exception("relation returns the wrong set of reachable members")
+		if rel.closure(threads = 2)(avec) != rel.reachable(avec):
+			raise Exception("transitive closure disagrees with reachable()")
+
+		inverse = rel.inverse()
+		for label in b:
+			if inverse.row(label).to_pyset() != a:
+				raise Exception("inverse relation is wrong")
+
+		debug(f" relation OK")
+
+	def testClosureCompact(self):
+		if self.setsize > 10000:
+			return
+
+		# A chain through all labels, closed while another thread keeps
+		# compacting the domain
+		chain = sorted(self.allLabels, key = lambda label: label.index)
+		rel = fastset.Relation(LabelDomain)
+		for i in range(len(chain) - 1):
+			rel.add(chain[i], chain[i + 1])
+
+		done = threading.Event()
+		def churn():
+			while not done.is_set():
+				LabelDomain.remove(Label("churn"))
+				LabelDomain.compact()
+
+		thread = threading.Thread(target = churn)
+		thread.start()
+		try:
+			closure = rel.closure(threads = 4)
+		finally:
+			done.set()
+			thread.join()
+
+		if closure(LabelSet(chain[:1])).to_pyset() != set(chain[1:]):
+			raise Exception("closure() is wrong after compacting the domain while it ran")
+
+		debug(f" closure with compact OK")
+
+	def testSetArray(self, a, b):
+		avec = LabelSet(a)
+		bvec = LabelSet(b)
+		array = fastset.SetArray(LabelDomain, (avec, bvec), type = LabelSet)
+
+		if len(array) != 2 or array[0] != avec or array[-1] != bvec:
+			raise Exception("set array does not hold the sets it was created from")
+		if list(array.counts()) != [len(a), len(b)]:
+			raise Exception("set array returns the wrong set sizes")
+		if list(array.subsets_of(avec)) != [0] + ([1] if b <= a else []):
+			raise Exception("set array returns the wrong subsets")
+		if list(array.disjoint_from(avec)) != ([0] if not a else []) + ([1] if not a & b else []):
+			raise Exception("set array returns the wrong disjoint sets")
+
+		array.update_all(bvec)
+		if array[0].to_pyset() != a | b:
+			raise Exception("set array update_all() is broken")
+
+		debug(f" set array OK")
+
+	def testSetIndex(self, a, b):
+		avec = LabelSet(a)
+		bvec = LabelSet(b)
+		index = fastset.SetIndex(LabelDomain, (avec, bvec))
+
+		if len(index) != 2 or index.add(LabelSet()) != 2:
+			raise Exception("set index assigns the wrong ids")
+		if list(index.subsets_of(avec)) != [0] + ([1] if b <= a else []) + [2]:
+			raise Exception("set index returns the wrong subsets")
+		if list(index.supersets_of(avec)) != [0] + ([1] if b >= a else []) + ([2] if not a else []):
+			raise Exception("set index returns the wrong supersets")
+		if list(index.intersecting(avec)) != ([0] if a else []) + ([1] if a & b else []):
+			raise Exception("set index returns the wrong intersecting sets")
+
+		debug(f" set index OK")
+
 	def testPop(self, a):
 		avec = LabelSet(a)
 		control = set()
@@ -192,19 +623,28 @@ class FastsetTester:
 
 	def testSetOperations(self, a, b):
 		debug("Testing pair of sets")
-		for name in 'union', 'intersection', 'difference', 'symmetric_difference':
+		for name in 'union', 'intersection', 'difference', 'symmetric_difference', '__or__', '__and__', '__sub__', '__xor__':
 			self.testBinarySetOperation(name, a, b)
 
 		# for name in 'update', 'intersection_update', 'difference_update', 'symmetric_difference_update':
-		for name in 'intersection_update',:
+		for name in 'intersection_update', '__ior__', '__iand__', '__isub__', '__ixor__':
 			self.testBinarySetOperationUpdate(name, a, b)
 
 		for name in 'issubset', 'issuperset', 'isdisjoint', '__lt__', '__le__', '__gt__', '__ge__', '__eq__', '__ne__':
 			self.testBinarySetOperationBool(name, a, b)
 
+		self.testCountOperation('intersection_count', a, b, lambda a, b: len(a & b))
+		self.testCountOperation('union_count', a, b, lambda a, b: len(a | b))
+		self.testCountOperation('difference_count', a, b, lambda a, b: len(a - b))
+		self.testCountOperation('jaccard', a, b, lambda a, b: len(a & b) / len(a | b) if a or b else 1.0)
+
 		self.testUnaryFunction('len', len, a)
 		self.testUnaryFunction('bool', bool, a)
 		self.testContains(a)
+		self.testLength(a)
+		self.testCopyOnWrite(a, b)
+		self.testReserve(a, b)
+		self.testMaterialize(a)
 		self.testPop(a)
 
 	def testRandomPair(self):
@@ -215,6 +655,19 @@ class FastsetTester:
 		self.testSetOperations(a, b)
 		self.testSetOperations(e, b)
 		self.testSetOperations(a, e)
+		self.testNarySetOperations(a, b, self.randomSet())
+		self.testLazyExpression(a, b, self.randomSet())
+		self.testComplement(a, b)
+		self.testMixedClasses(a, b)
+		self.testTransform(a, b)
+		self.testTransformCompile()
+		self.testRelation(a, b)
+		self.testClosureCompact()
+		self.testSetArray(a, b)
+		self.testSetIndex(a, b)
+		self.testCreateMembers(a)
+		self.testSlotReuse(a)
+		self.testCompact(self.randomSet(), self.randomSet())
 
 	def timeBinaryOperation(self, name, klass, iterations = 100, loopcount = 10000):
 		func = getattr(klass, name)
@@ -264,6 +717,14 @@ class FastsetTester:
 
 			print(f" {name:20} {t1:12.3} {t2:12.3}")
 
+	def timeCountOperations(self, operationNames):
+		for name in operationNames:
+			t1 = t.timeBinaryOperation(name, set)
+			t2 = t.timeBinaryOperation(f"{name}_count", LabelSet)
+
+			name = f"{name}_count"
+			print(f" {name:20} {t1:12.3} {t2:12.3}")
+
 	def timeUnarySetOperation(self, name, func):
 		t1 = t.timeUnaryOperation(name, func, set)
 		t2 = t.timeUnaryOperation(name, func, LabelSet)
@@ -284,6 +745,10 @@ keys = list(map(str, range(1000)))
 t = FastsetTester(keys)
 t.test(2000)
 
+# Sparse sets over a large domain use the compressed representation
+sparse = FastsetTester(list(map(str, range(200000))), maxSetSize = 100)
+sparse.test(200)
+
 t.performTimingTests()
 
 exit(0)
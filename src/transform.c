@@ -28,14 +28,31 @@ static int		Fastset_initTransform(fastset_Transform *self, PyObject *args, PyObj
 static void		Fastset_deallocTransform(fastset_Transform *self);
 static PyObject *	FastsetTransform_Call(fastset_Transform *callable, PyObject *args, PyObject *kwargs);
 static PyObject *	FastsetTransform_Update(fastset_Transform *callable, PyObject *args, PyObject *kwargs);
+static PyObject *	FastsetTransform_apply_all(fastset_Transform *self, PyObject *arg);
+static PyObject *	FastsetTransform_preimage(fastset_Transform *self, PyObject *arg);
+static PyObject *	FastsetTransform_inverse(fastset_Transform *self, PyObject *unused);
+static PyObject *	FastsetTransform_compose(PyObject *outer, PyObject *inner);
 
 static PyMethodDef fastset_transformMethods[] = {
       { "update", (PyCFunction) FastsetTransform_Update, METH_VARARGS | METH_KEYWORDS,
         "update the transform for one input value"
       },
+      { "apply_all", (PyCFunction) FastsetTransform_apply_all, METH_O,
+        "apply the transform to all sets of an iterable, and return a list of the results"
+      },
+      { "preimage", (PyCFunction) FastsetTransform_preimage, METH_O,
+        "return the set of all members that the transform maps into the given set"
+      },
+      { "inverse", (PyCFunction) FastsetTransform_inverse, METH_NOARGS,
+        "return the inverse transform"
+      },
       { NULL }
 };
 
+static PyNumberMethods	fastset_transformNumberMethods = {
+	.nb_matrix_multiply	= (binaryfunc) FastsetTransform_compose,
+};
+
 
 PyTypeObject	fastset_TransformType = {
 	PyVarObject_HEAD_INIT(NULL, 0)
@@ -50,6 +67,7 @@ PyTypeObject	fastset_TransformType = {
 	.tp_new		= Fastset_newTransform,
 	.tp_dealloc	= (destructor) Fastset_deallocTransform,
 	.tp_call	= (ternaryfunc) FastsetTransform_Call,
+	.tp_as_number	= &fastset_transformNumberMethods,
 };
 
 
@@ -69,6 +87,35 @@ Fastset_newTransform(PyTypeObject *type, PyObject *args, PyObject *kwds)
 	return (PyObject *) self;
 }
 
+/*
+ * Drop the mappings from and to members unregistered since the transform
+ * was last used
+ */
+static fastset_bitvec_transform_t *
+FastsetTransform_bittrans(fastset_Transform *self)
+{
+	fastset_bitvec_transform_t *trans = self->bittrans;
+	fastset_Domain *domain = self->domain;
+	fastset_bitvec_word_t *changed;
+	unsigned int i;
+
+	if (!(changed = FastsetDomain_changedSlots(domain, &self->link, domain->size)))
+		return trans;
+
+	for (i = 0; i < trans->max_index && i < domain->size; ++i) {
+		int res_index = trans->mapping[i];
+
+		if (res_index < 0 || (unsigned int) res_index >= domain->size)
+			continue;
+		if (((changed[i / 64] >> (i % 64)) & 1)
+		 || ((changed[res_index / 64] >> (res_index % 64)) & 1))
+			fastset_bitvec_transform_add(trans, i, -1);
+	}
+
+	free(changed);
+	return trans;
+}
+
 static int
 Fastset_initTransform(fastset_Transform *self, PyObject *args, PyObject *kwds)
 {
@@ -90,17 +137,23 @@ Fastset_initTransform(fastset_Transform *self, PyObject *args, PyObject *kwds)
 		return -1;
 	}
 
+	FastsetDomain_unlink(&self->link);
+	Py_CLEAR(self->domain);
+	if (self->bittrans)
+		fastset_bitvec_transform_free(self->bittrans);
+
 	self->domain = (fastset_Domain *) domainObject;
 	Py_INCREF(domainObject);
+	FastsetDomain_link(self->domain, &self->domain->transforms, &self->link);
 
-	self->bittrans = fastset_bitvec_transform_new(self->domain->count);
+	self->bittrans = fastset_bitvec_transform_new(self->domain->size);
 
 	/* Initialize undefined transform that can be set up using transform.update() */
 	if (functionObject == NULL)
 		return 0;
 
 	callArgs = PyTuple_New(1);
-	for (i = 0; i < self->domain->count; ++i) {
+	for (i = 0; i < self->domain->size; ++i) {
 		fastset_Member *arg_member = (fastset_Member *) self->domain->domain_objects[i];
 		fastset_Member *res_member;
 		PyObject *result;
@@ -135,6 +188,7 @@ Fastset_initTransform(fastset_Transform *self, PyObject *args, PyObject *kwds)
 	return 0;
 
 failed:
+	FastsetDomain_unlink(&self->link);
 	Py_CLEAR(self->domain);
 	Py_CLEAR(callArgs);
 	return -1;
@@ -143,12 +197,67 @@ failed:
 static void
 Fastset_deallocTransform(fastset_Transform *self)
 {
+	FastsetDomain_unlink(&self->link);
 	Py_CLEAR(self->domain);
 
 	if (self->bittrans) {
 		fastset_bitvec_transform_free(self->bittrans);
 		self->bittrans = NULL;
 	}
+
+	Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+/*
+ * Create a transform object for a mapping computed from other transforms
+ */
+static PyObject *
+FastsetTransform_fromBittrans(fastset_Domain *domain, fastset_bitvec_transform_t *bittrans)
+{
+	fastset_Transform *self;
+
+	self = (fastset_Transform *) Fastset_newTransform(&fastset_TransformType, NULL, NULL);
+	if (self == NULL) {
+		fastset_bitvec_transform_free(bittrans);
+		return NULL;
+	}
+
+	Py_INCREF(domain);
+	self->domain = domain;
+	FastsetDomain_link(domain, &domain->transforms, &self->link);
+
+	self->bittrans = bittrans;
+	return (PyObject *) self;
+}
+
+/*
+ * Renumber the mappings of all transforms of the domain, which is being
+ * compacted
+ */
+void
+FastsetTransform_remapAll(fastset_Domain *domain, const fastset_bitvec_transform_t *trans)
+{
+	fastset_DomainLink *link;
+
+	for (link = domain->transforms; link; link = link->next) {
+		fastset_Transform *self = FASTSET_LINK_OWNER(link, fastset_Transform);
+		const fastset_bitvec_transform_t *old = FastsetTransform_bittrans(self);
+		fastset_bitvec_transform_t *new;
+		unsigned int i;
+
+		new = fastset_bitvec_transform_new(domain->count);
+		for (i = 0; i < old->max_index && i < trans->max_index; ++i) {
+			int res_index = old->mapping[i];
+
+			if (trans->mapping[i] < 0 || res_index < 0 || (unsigned int) res_index >= trans->max_index)
+				continue;
+			if (trans->mapping[res_index] >= 0)
+				fastset_bitvec_transform_add(new, trans->mapping[i], trans->mapping[res_index]);
+		}
+
+		fastset_bitvec_transform_free(self->bittrans);
+		self->bittrans = new;
+	}
 }
 
 PyObject *
@@ -174,7 +283,11 @@ FastsetTransform_Call(fastset_Transform *self, PyObject *args, PyObject *kwds)
 	}
 
 	if (FastsetDomain_IsSet(self->domain, argObject)) {
-		result = FastsetSet_TransformBitvec((fastset_Set *) argObject, self->bittrans);
+		fastset_bitvec_transform_t *trans = FastsetTransform_bittrans(self);
+
+		/* Pay for compiling the transform once, rather than on every call */
+		fastset_bitvec_transform_compile(trans);
+		result = FastsetSet_TransformBitvec((fastset_Set *) argObject, trans);
 	} else {
 		PyErr_SetString(PyExc_ValueError, "unsupported argument type");
 		return NULL;
@@ -222,8 +335,119 @@ FastsetTransform_Update(fastset_Transform *self, PyObject *args, PyObject *kwds)
 	if ((res_index = fastset_objectToMemberIndex(self, resObject, "result")) < 0)
 		return NULL;
 
-	fastset_bitvec_transform_add(self->bittrans, arg_index, res_index);
+	fastset_bitvec_transform_add(FastsetTransform_bittrans(self), arg_index, res_index);
 
 	Py_INCREF(Py_None);
 	return Py_None;
 }
+
+/*
+ * Check that obj is a set of the transform's domain
+ */
+static fastset_Set *
+FastsetTransform_castToSet(fastset_Transform *self, PyObject *obj)
+{
+	if (self->domain == NULL || !FastsetDomain_IsSet(self->domain, obj)) {
+		PyErr_SetString(PyExc_ValueError, "argument is not a set of the transform's domain");
+		return NULL;
+	}
+
+	return (fastset_Set *) obj;
+}
+
+/*
+ * Transform a batch of sets in one call. The mapping and its tables are
+ * looked up once, and stay in the cache from one set to the next.
+ */
+static PyObject *
+FastsetTransform_apply_all(fastset_Transform *self, PyObject *arg)
+{
+	fastset_bitvec_transform_t *trans;
+	PyObject *iter, *item, *list;
+
+	if (!(iter = PyObject_GetIter(arg)))
+		return NULL;
+
+	if (!(list = PyList_New(0))) {
+		Py_DECREF(iter);
+		return NULL;
+	}
+
+	while ((item = PyIter_Next(iter)) != NULL) {
+		PyObject *result = NULL;
+		fastset_Set *set;
+
+		if ((set = FastsetTransform_castToSet(self, item)) != NULL) {
+			trans = FastsetTransform_bittrans(self);
+			fastset_bitvec_transform_compile(trans);
+			result = FastsetSet_TransformBitvec(set, trans);
+		}
+		Py_DECREF(item);
+
+		if (result == NULL || PyList_Append(list, result) < 0) {
+			Py_XDECREF(result);
+			break;
+		}
+		Py_DECREF(result);
+	}
+
+	Py_DECREF(iter);
+	if (PyErr_Occurred()) {
+		Py_DECREF(list);
+		return NULL;
+	}
+
+	return list;
+}
+
+static PyObject *
+FastsetTransform_preimage(fastset_Transform *self, PyObject *arg)
+{
+	fastset_Set *set;
+
+	if (!(set = FastsetTransform_castToSet(self, arg)))
+		return NULL;
+
+	return FastsetSet_PreimageBitvec(set, FastsetTransform_bittrans(self));
+}
+
+static PyObject *
+FastsetTransform_inverse(fastset_Transform *self, PyObject *unused)
+{
+	fastset_bitvec_transform_t *inverse;
+
+	if (self->domain == NULL) {
+		PyErr_SetString(PyExc_ValueError, "transform has no domain");
+		return NULL;
+	}
+
+	if (!(inverse = fastset_bitvec_transform_invert(FastsetTransform_bittrans(self)))) {
+		PyErr_SetString(PyExc_ValueError, "transform maps several members to the same result, and cannot be inverted");
+		return NULL;
+	}
+
+	return FastsetTransform_fromBittrans(self->domain, inverse);
+}
+
+/*
+ * outer @ inner applies inner first, and outer to its result
+ */
+static PyObject *
+FastsetTransform_compose(PyObject *outerObject, PyObject *innerObject)
+{
+	fastset_Transform *outer, *inner;
+
+	if (!PyObject_TypeCheck(outerObject, &fastset_TransformType)
+	 || !PyObject_TypeCheck(innerObject, &fastset_TransformType))
+		Py_RETURN_NOTIMPLEMENTED;
+
+	outer = (fastset_Transform *) outerObject;
+	inner = (fastset_Transform *) innerObject;
+	if (outer->domain == NULL || outer->domain != inner->domain) {
+		PyErr_SetString(PyExc_ValueError, "transforms are from different domains");
+		return NULL;
+	}
+
+	return FastsetTransform_fromBittrans(outer->domain,
+			fastset_bitvec_transform_compose(FastsetTransform_bittrans(outer), FastsetTransform_bittrans(inner)));
+}